@@ -0,0 +1,318 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/basisCurves.h"
+
+#include <pxr/base/work/loops.h>
+
+#include <pxr/imaging/hdAi/instancer.h>
+#include <pxr/imaging/hdAi/material.h>
+#include <pxr/imaging/hdAi/utils.h>
+
+#include <algorithm>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace {
+namespace Str {
+const AtString name("name");
+const AtString curves("curves");
+const AtString points("points");
+const AtString num_points("num_points");
+const AtString radius("radius");
+const AtString orientations("orientations");
+const AtString basis("basis");
+const AtString mode("mode");
+const AtString oriented("oriented");
+const AtString bezier("bezier");
+const AtString b_spline("b-spline");
+const AtString catmull_rom("catmull-rom");
+const AtString linear("linear");
+const AtString visibility("visibility");
+const AtString matrix("matrix");
+const AtString shader("shader");
+const AtString opaque("opaque");
+const AtString id("id");
+} // namespace Str
+
+AtString _GetBasis(const HdBasisCurvesTopology& topology, const SdfPath& id) {
+    if (topology.GetCurveType() == HdTokens->linear) { return Str::linear; }
+    const auto& basis = topology.GetCurveBasis();
+    if (basis == HdTokens->bezier) {
+        return Str::bezier;
+    } else if (basis == HdTokens->bSpline) {
+        return Str::b_spline;
+    } else if (basis == HdTokens->catmullRom) {
+        return Str::catmull_rom;
+    }
+    TF_WARN(
+        "Can't translate basis type %s on %s, falling back to linear.",
+        basis.GetText(), id.GetText());
+    return Str::linear;
+}
+
+// Arnold expects a radius per point, without the end points of b-spline and
+// catmull-rom curves, so uniform widths are expanded and vertex widths are
+// trimmed. The curves are converted in parallel, since grooms can have
+// millions of them. Returns nullptr if the widths don't match the topology.
+AtArray* _ConvertRadius(
+    const VtFloatArray& widths, HdInterpolation interpolation,
+    const VtIntArray& curveVertexCounts, bool skipEndPoints) {
+    const auto isUniform = interpolation == HdInterpolationUniform;
+    const auto isVertex = interpolation == HdInterpolationVertex;
+    if (!isUniform && !(isVertex && skipEndPoints)) {
+        return HdAiConvertWidths(widths);
+    }
+    const auto numCurves = curveVertexCounts.size();
+    // Offsets of the first width and radius of each curve.
+    std::vector<uint32_t> widthOffsets(numCurves);
+    std::vector<uint32_t> radiusOffsets(numCurves);
+    uint32_t numWidths = 0;
+    uint32_t numRadii = 0;
+    for (auto i = decltype(numCurves){0}; i < numCurves; ++i) {
+        const auto numVertices = std::max(0, curveVertexCounts[i]);
+        widthOffsets[i] = numWidths;
+        radiusOffsets[i] = numRadii;
+        numWidths += isUniform ? 1 : numVertices;
+        numRadii += skipEndPoints ? std::max(0, numVertices - 2) : numVertices;
+    }
+    if (numWidths != widths.size()) { return nullptr; }
+    auto* a = AiArrayAllocate(numRadii, 1, AI_TYPE_FLOAT);
+    if (numRadii == 0) { return a; }
+    auto* out = static_cast<float*>(AiArrayMap(a));
+    const auto* in = widths.cdata();
+    const auto firstWidth = isVertex ? 1 : 0;
+    WorkParallelForN(numCurves, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) {
+            const auto numVertices = std::max(0, curveVertexCounts[i]);
+            const auto count =
+                skipEndPoints ? std::max(0, numVertices - 2) : numVertices;
+            const auto* curveWidths = in + widthOffsets[i];
+            auto* curveRadii = out + radiusOffsets[i];
+            for (auto j = decltype(count){0}; j < count; ++j) {
+                curveRadii[j] =
+                    (isUniform ? curveWidths[0] : curveWidths[j + firstWidth]) *
+                    0.5f;
+            }
+        }
+    });
+    AiArrayUnmap(a);
+    return a;
+}
+
+} // namespace
+
+HdAiBasisCurves::HdAiBasisCurves(
+    HdAiRenderDelegate* delegate, const SdfPath& id, const SdfPath& instancerId)
+    : HdBasisCurves(id, instancerId), _delegate(delegate) {
+    _curves = AiNode(delegate->GetUniverse(), Str::curves);
+    AiNodeSetStr(_curves, Str::name, id.GetText());
+}
+
+HdAiBasisCurves::~HdAiBasisCurves() {
+    _delegate->GetMaterialBindings().Unbind(GetId());
+    for (auto* instance : _instances) { AiNodeDestroy(instance); }
+    AiNodeDestroy(_curves);
+}
+
+// Same as the meshes, the data is converted here and the node edits are
+// recorded in the node edit journal.
+void HdAiBasisCurves::Sync(
+    HdSceneDelegate* delegate, HdRenderParam* renderParam,
+    HdDirtyBits* dirtyBits, const TfToken& reprToken) {
+    TF_UNUSED(renderParam);
+    TF_UNUSED(reprToken);
+    auto& journal = _delegate->GetNodeEditJournal();
+    auto* curves = _curves;
+    const auto& id = GetId();
+
+    const auto shutter = _delegate->GetShutterRange();
+    auto motionChanged = false;
+    if (HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points)) {
+        auto* positions =
+            HdAiConvertPoints(delegate, id, HdTokens->points, shutter);
+        if (positions != nullptr) {
+            motionChanged = true;
+            journal.Record([curves, positions]() {
+                AiNodeSetArray(curves, Str::points, positions);
+            });
+        }
+    }
+
+    if (*dirtyBits & HdChangeTracker::DirtyPrimID) {
+        const auto primId = static_cast<unsigned int>(GetPrimId()) + 1;
+        journal.Record(
+            [curves, primId]() { AiNodeSetUInt(curves, Str::id, primId); });
+    }
+
+    if (HdChangeTracker::IsVisibilityDirty(*dirtyBits, id)) {
+        _UpdateVisibility(delegate, dirtyBits);
+        const auto visibility = _sharedData.visible ? AI_RAY_ALL : uint8_t(0);
+        journal.Record([curves, visibility]() {
+            AiNodeSetByte(curves, Str::visibility, visibility);
+        });
+    }
+
+    const auto topologyDirty = HdChangeTracker::IsTopologyDirty(*dirtyBits, id);
+    if (topologyDirty) {
+        const auto topology = GetBasisCurvesTopology(delegate);
+        _curveVertexCounts = topology.GetCurveVertexCounts();
+        const auto basis = _GetBasis(topology, id);
+        _skipEndPoints = basis == Str::b_spline || basis == Str::catmull_rom;
+        auto* numPoints = HdAiConvertIndices(_curveVertexCounts);
+        journal.Record([curves, numPoints, basis]() {
+            AiNodeSetArray(curves, Str::num_points, numPoints);
+            AiNodeSetStr(curves, Str::basis, basis);
+        });
+    }
+
+    if (HdChangeTracker::IsTransformDirty(*dirtyBits, id)) {
+        motionChanged = true;
+        auto* matrices = HdAiConvertTransform(delegate, id, shutter);
+        journal.Record([curves, matrices]() {
+            AiNodeSetArray(curves, Str::matrix, matrices);
+        });
+    }
+
+    if (motionChanged) {
+        journal.Record(
+            [curves, shutter]() { HdAiSetMotionRange(curves, shutter); });
+    }
+
+    auto opacityChanged = false;
+    if (*dirtyBits & HdChangeTracker::DirtyMaterialId) {
+        const auto materialId = delegate->GetMaterialId(id);
+        const auto* material = reinterpret_cast<const HdAiMaterial*>(
+            delegate->GetRenderIndex().GetSprim(
+                HdPrimTypeTokens->material, materialId));
+        auto* bindings = &_delegate->GetMaterialBindings();
+        journal.Record([bindings, id, materialId]() {
+            bindings->Bind(id, materialId);
+        });
+        auto* shader = material != nullptr ? material->GetSurfaceShader()
+                                           : _delegate->GetFallbackShader();
+        journal.Record(
+            [curves, shader]() { AiNodeSetPtr(curves, Str::shader, shader); });
+        // Opaque shapes skip their shaders for shadow and transparency rays.
+        const auto isOpaque = material == nullptr || material->IsOpaque();
+        if (isOpaque != _isOpaque) {
+            _isOpaque = isOpaque;
+            opacityChanged = true;
+            journal.Record([curves, isOpaque]() {
+                AiNodeSetBool(curves, Str::opaque, isOpaque);
+            });
+        }
+    }
+
+    // The widths depend on the number of vertices of the curves.
+    if (topologyDirty ||
+        HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->widths) ||
+        HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->normals) ||
+        (*dirtyBits & HdChangeTracker::DirtyPrimvar)) {
+        auto widthsAuthored = false;
+        auto normalsAuthored = false;
+        std::vector<TfToken> primvars;
+        for (const auto interpolation :
+             {HdInterpolationConstant, HdInterpolationUniform,
+              HdInterpolationVarying, HdInterpolationVertex}) {
+            for (const auto& primvar :
+                 delegate->GetPrimvarDescriptors(id, interpolation)) {
+                if (primvar.name == HdTokens->points) { continue; }
+                const auto value = delegate->Get(id, primvar.name);
+                if (primvar.name == HdTokens->widths) {
+                    if (!value.IsHolding<VtFloatArray>()) { continue; }
+                    auto* radius = _ConvertRadius(
+                        value.UncheckedGet<VtFloatArray>(), interpolation,
+                        _curveVertexCounts, _skipEndPoints);
+                    if (radius == nullptr) { continue; }
+                    widthsAuthored = true;
+                    journal.Record([curves, radius]() {
+                        AiNodeSetArray(curves, Str::radius, radius);
+                    });
+                    continue;
+                }
+                if (primvar.name == HdTokens->normals) {
+                    if (interpolation != HdInterpolationVertex ||
+                        !value.IsHolding<VtVec3fArray>()) {
+                        continue;
+                    }
+                    normalsAuthored = true;
+                    const auto& normals = value.UncheckedGet<VtVec3fArray>();
+                    auto* orientations = AiArrayConvert(
+                        static_cast<uint32_t>(normals.size()), 1,
+                        AI_TYPE_VECTOR, normals.cdata());
+                    journal.Record([curves, orientations]() {
+                        AiNodeSetArray(
+                            curves, Str::orientations, orientations);
+                        AiNodeSetStr(curves, Str::mode, Str::oriented);
+                    });
+                    continue;
+                }
+                primvars.push_back(primvar.name);
+                if (interpolation == HdInterpolationConstant) {
+                    HdAiSetConstantPrimvar(journal, curves, primvar, value);
+                } else if (interpolation == HdInterpolationUniform) {
+                    HdAiSetUniformPrimvar(journal, curves, primvar, value);
+                } else {
+                    HdAiSetVertexPrimvar(journal, curves, primvar, value);
+                }
+            }
+        }
+        if (!widthsAuthored) {
+            journal.Record(
+                [curves]() { AiNodeResetParameter(curves, Str::radius); });
+        }
+        if (!normalsAuthored) {
+            journal.Record([curves]() {
+                AiNodeResetParameter(curves, Str::orientations);
+                AiNodeResetParameter(curves, Str::mode);
+            });
+        }
+        for (const auto& primvar : _primvars) {
+            if (std::find(primvars.begin(), primvars.end(), primvar) ==
+                primvars.end()) {
+                HdAiRemovePrimvar(journal, curves, primvar);
+            }
+        }
+        _primvars.swap(primvars);
+    }
+
+    HdAiSyncInstances(
+        delegate, id, GetInstancerId(), *dirtyBits, curves,
+        _sharedData.visible ? AI_RAY_ALL : uint8_t(0), &_instances,
+        opacityChanged);
+
+    *dirtyBits = HdChangeTracker::Clean;
+}
+
+HdDirtyBits HdAiBasisCurves::GetInitialDirtyBitsMask() const {
+    return HdChangeTracker::Clean | HdChangeTracker::InitRepr |
+           HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyTopology |
+           HdChangeTracker::DirtyWidths | HdChangeTracker::DirtyNormals |
+           HdChangeTracker::DirtyTransform | HdChangeTracker::DirtyMaterialId |
+           HdChangeTracker::DirtyPrimvar | HdChangeTracker::DirtyVisibility |
+           HdChangeTracker::DirtyPrimID | HdChangeTracker::DirtyInstancer |
+           HdChangeTracker::DirtyInstanceIndex;
+}
+
+HdDirtyBits HdAiBasisCurves::_PropagateDirtyBits(HdDirtyBits bits) const {
+    return bits & HdChangeTracker::AllDirty;
+}
+
+void HdAiBasisCurves::_InitRepr(
+    const TfToken& reprToken, HdDirtyBits* dirtyBits) {
+    TF_UNUSED(reprToken);
+    TF_UNUSED(dirtyBits);
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,73 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_BASIS_CURVES_H
+#define HDAI_BASIS_CURVES_H
+
+#include <pxr/pxr.h>
+#include "pxr/imaging/hdAi/api.h"
+
+#include <pxr/base/vt/types.h>
+
+#include <pxr/imaging/hd/basisCurves.h>
+
+#include "pxr/imaging/hdAi/renderDelegate.h"
+
+#include <ai.h>
+
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+class HdAiBasisCurves : public HdBasisCurves {
+public:
+    HDAI_API
+    HdAiBasisCurves(
+        HdAiRenderDelegate* delegate, const SdfPath& id,
+        const SdfPath& instancerId = SdfPath());
+
+    HDAI_API
+    ~HdAiBasisCurves() override;
+
+    HDAI_API
+    void Sync(
+        HdSceneDelegate* delegate, HdRenderParam* renderParam,
+        HdDirtyBits* dirtyBits, const TfToken& reprToken) override;
+
+    HDAI_API
+    HdDirtyBits GetInitialDirtyBitsMask() const override;
+
+protected:
+    HDAI_API
+    HdDirtyBits _PropagateDirtyBits(HdDirtyBits bits) const override;
+
+    HDAI_API
+    void _InitRepr(const TfToken& reprToken, HdDirtyBits* dirtyBits) override;
+
+    HdAiRenderDelegate* _delegate;
+    AtNode* _curves;
+    // Number of vertices of each curve, needed to convert the widths.
+    VtIntArray _curveVertexCounts;
+    // Cubic b-spline and catmull-rom curves don't use the end points.
+    bool _skipEndPoints = false;
+    // Opacity set on the curves.
+    bool _isOpaque = true;
+    // User parameters declared by the last sync.
+    std::vector<TfToken> _primvars;
+    // Ginstances of the curves, one per instance of the instancer.
+    std::vector<AtNode*> _instances;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_BASIS_CURVES_H
@@ -42,6 +42,34 @@ TF_DEFINE_ENV_SETTING(
 
 TF_DEFINE_ENV_SETTING(HDAI_shutter_end, "0.25f", "Shutter end for the camera.");
 
+TF_DEFINE_ENV_SETTING(
+    HDAI_direct_framebuffer, true,
+    "Write buckets straight into the framebuffer instead of queueing them.");
+
+TF_DEFINE_ENV_SETTING(
+    HDAI_target_frame_time, "0",
+    "Target time of the first pass in milliseconds after a camera change, "
+    "the resolution is lowered to reach it. Zero disables this.");
+
+TF_DEFINE_ENV_SETTING(
+    HDAI_max_motion_samples, 16,
+    "Maximum number of motion keys for transforms and deforming points.");
+
+TF_DEFINE_ENV_SETTING(
+    HDAI_deduplicate_meshes, false,
+    "Render meshes with identical geometry as instances of a single "
+    "polymesh.");
+
+TF_DEFINE_ENV_SETTING(
+    HDAI_persistent_session, false,
+    "Keep the Arnold session alive after the last render delegate is "
+    "destroyed.");
+
+TF_DEFINE_ENV_SETTING(
+    HDAI_subdiv_polygon_budget, 0,
+    "Number of subdivided polygons shared by all the meshes, distributed by "
+    "their size on screen. Zero disables the budget.");
+
 HdAiConfig::HdAiConfig() {
     bucket_size = std::max(1, TfGetEnvSetting(HDAI_bucket_size));
     abort_on_error = TfGetEnvSetting(HDAI_abort_on_error);
@@ -53,6 +81,15 @@ HdAiConfig::HdAiConfig() {
         std::atof(TfGetEnvSetting(HDAI_shutter_start).c_str()));
     shutter_end = static_cast<float>(
         std::atof(TfGetEnvSetting(HDAI_shutter_end).c_str()));
+    direct_framebuffer = TfGetEnvSetting(HDAI_direct_framebuffer);
+    target_frame_time = std::max(
+        0.0f, static_cast<float>(
+                  std::atof(TfGetEnvSetting(HDAI_target_frame_time).c_str())));
+    max_motion_samples = std::max(1, TfGetEnvSetting(HDAI_max_motion_samples));
+    deduplicate_meshes = TfGetEnvSetting(HDAI_deduplicate_meshes);
+    persistent_session = TfGetEnvSetting(HDAI_persistent_session);
+    subdiv_polygon_budget =
+        std::max(0, TfGetEnvSetting(HDAI_subdiv_polygon_budget));
 }
 
 const HdAiConfig& HdAiConfig::GetInstance() {
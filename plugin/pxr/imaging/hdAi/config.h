@@ -51,6 +51,24 @@ public:
     /// HDAI_shutter_end
     float shutter_end;
 
+    /// HDAI_direct_framebuffer
+    bool direct_framebuffer;
+
+    /// HDAI_target_frame_time
+    float target_frame_time;
+
+    /// HDAI_max_motion_samples
+    int max_motion_samples;
+
+    /// HDAI_deduplicate_meshes
+    bool deduplicate_meshes;
+
+    /// HDAI_persistent_session
+    bool persistent_session;
+
+    /// HDAI_subdiv_polygon_budget
+    int subdiv_polygon_budget;
+
 private:
     HDAI_API
     HdAiConfig();
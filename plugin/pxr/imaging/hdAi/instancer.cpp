@@ -0,0 +1,445 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/instancer.h"
+
+#include <pxr/base/gf/quaternion.h>
+#include <pxr/base/gf/rotation.h>
+#include <pxr/base/tf/stringUtils.h>
+
+#include <pxr/imaging/hd/renderIndex.h>
+#include <pxr/imaging/hd/tokens.h>
+
+#include "pxr/imaging/hdAi/config.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace {
+namespace Str {
+const AtString ginstance("ginstance");
+const AtString name("name");
+const AtString node("node");
+const AtString matrix("matrix");
+const AtString visibility("visibility");
+const AtString id("id");
+const AtString opaque("opaque");
+} // namespace Str
+
+template <typename T>
+inline T _Lerp(const T& a, const T& b, float w) {
+    return a * (1.0 - w) + b * w;
+}
+
+// Multiplies the matrices of the instances with the matrices built from the
+// samples of a transform primvar at a motion key.
+template <typename T, typename F>
+void _ApplyTransformPrimvar(
+    const HdTimeSampleArray<VtValue, HdAiMaxMotionSamples>* samples,
+    size_t key, size_t numKeys, const GfVec2f& shutter,
+    const VtIntArray& indices, VtMatrix4dArray& matrices, F&& toMatrix) {
+    if (samples == nullptr || samples->count == 0 ||
+        !samples->values[0].IsHolding<VtArray<T>>()) {
+        return;
+    }
+    const auto sample = HdAiGetKeySample(*samples, key, numKeys, shutter);
+    const auto& v0 = samples->values[sample.first].UncheckedGet<VtArray<T>>();
+    // Samples with a different type or size can't be interpolated.
+    const VtArray<T>* v1 = nullptr;
+    if (sample.first != sample.second &&
+        samples->values[sample.second].IsHolding<VtArray<T>>()) {
+        v1 = &samples->values[sample.second].UncheckedGet<VtArray<T>>();
+        if (v1->size() != v0.size()) { v1 = nullptr; }
+    }
+    const auto numValues = static_cast<int>(v0.size());
+    for (auto i = decltype(indices.size()){0}; i < indices.size(); ++i) {
+        const auto index = indices[i];
+        if (index < 0 || index >= numValues) { continue; }
+        matrices[i] = toMatrix(
+                          v1 == nullptr
+                              ? v0[index]
+                              : _Lerp(v0[index], (*v1)[index], sample.weight)) *
+                      matrices[i];
+    }
+}
+
+// Builds an array of @p count values from the instance primvar @p value,
+// @p getIndex returns the index of the value used by each instance.
+struct _RemapPrimvar {
+    size_t count;
+    std::function<int(size_t)> getIndex;
+    VtValue* out;
+
+    template <typename T>
+    void operator()(const VtArray<T>& in) const {
+        VtArray<T> remapped(count);
+        const auto numValues = static_cast<int>(in.size());
+        for (auto i = decltype(count){0}; i < count; ++i) {
+            const auto index = getIndex(i);
+            if (index >= 0 && index < numValues) { remapped[i] = in[index]; }
+        }
+        *out = VtValue::Take(remapped);
+    }
+};
+
+struct _GetElement {
+    size_t index;
+    VtValue* out;
+
+    template <typename T>
+    void operator()(const VtArray<T>& in) const {
+        if (index < in.size()) { *out = VtValue(in[index]); }
+    }
+};
+
+// Calls @p f with the array held by @p value, for the types supported by
+// constant user parameters.
+template <typename F>
+bool _VisitArray(const VtValue& value, const F& f) {
+    if (value.IsHolding<VtBoolArray>()) {
+        f(value.UncheckedGet<VtBoolArray>());
+    } else if (value.IsHolding<VtUCharArray>()) {
+        f(value.UncheckedGet<VtUCharArray>());
+    } else if (value.IsHolding<VtUIntArray>()) {
+        f(value.UncheckedGet<VtUIntArray>());
+    } else if (value.IsHolding<VtIntArray>()) {
+        f(value.UncheckedGet<VtIntArray>());
+    } else if (value.IsHolding<VtFloatArray>()) {
+        f(value.UncheckedGet<VtFloatArray>());
+    } else if (value.IsHolding<VtDoubleArray>()) {
+        f(value.UncheckedGet<VtDoubleArray>());
+    } else if (value.IsHolding<VtVec2fArray>()) {
+        f(value.UncheckedGet<VtVec2fArray>());
+    } else if (value.IsHolding<VtVec3fArray>()) {
+        f(value.UncheckedGet<VtVec3fArray>());
+    } else if (value.IsHolding<VtHalfArray>()) {
+        f(value.UncheckedGet<VtHalfArray>());
+    } else if (value.IsHolding<VtVec4fArray>()) {
+        f(value.UncheckedGet<VtVec4fArray>());
+    } else if (value.IsHolding<VtVec2dArray>()) {
+        f(value.UncheckedGet<VtVec2dArray>());
+    } else if (value.IsHolding<VtVec3dArray>()) {
+        f(value.UncheckedGet<VtVec3dArray>());
+    } else if (value.IsHolding<VtVec4dArray>()) {
+        f(value.UncheckedGet<VtVec4dArray>());
+    } else if (value.IsHolding<VtMatrix4dArray>()) {
+        f(value.UncheckedGet<VtMatrix4dArray>());
+    } else if (value.IsHolding<VtStringArray>()) {
+        f(value.UncheckedGet<VtStringArray>());
+    } else if (value.IsHolding<VtTokenArray>()) {
+        f(value.UncheckedGet<VtTokenArray>());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+HdAiInstancer::HdAiInstancer(
+    HdAiRenderDelegate* delegate, HdSceneDelegate* sceneDelegate,
+    const SdfPath& id, const SdfPath& parentInstancerId)
+    : HdInstancer(sceneDelegate, id, parentInstancerId), _delegate(delegate) {}
+
+size_t HdAiInstancer::GetNumInstances(const SdfPath& prototypeId) {
+    const auto numInstances =
+        GetDelegate()->GetInstanceIndices(GetId(), prototypeId).size();
+    auto* parent = _GetParentInstancer();
+    return parent == nullptr ? numInstances
+                             : numInstances * parent->GetNumInstances(GetId());
+}
+
+std::vector<VtMatrix4dArray> HdAiInstancer::CalculateInstanceMatrices(
+    const SdfPath& prototypeId, const GfVec2f& shutter) {
+    return _CalculateInstanceMatrices(prototypeId, shutter, _GetNumKeys());
+}
+
+HdAiInstancer::InstancePrimvars HdAiInstancer::CalculateInstancePrimvars(
+    const SdfPath& prototypeId) {
+    _SyncPrimvars();
+    const auto indices =
+        GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
+    const auto numLocal = indices.size();
+    auto* parent = _GetParentInstancer();
+    const auto numParent =
+        parent == nullptr ? size_t{1} : parent->GetNumInstances(GetId());
+    const auto numInstances = numLocal * numParent;
+    // Instances are ordered by the parent instance first.
+    InstancePrimvars ret;
+    for (const auto& primvar : _primvars) {
+        VtValue value;
+        if (_VisitArray(
+                primvar.second,
+                _RemapPrimvar{numInstances,
+                              [&indices, numLocal](size_t i) -> int {
+                                  return indices[i % numLocal];
+                              },
+                              &value})) {
+            ret.emplace_back(primvar.first, value);
+        }
+    }
+    if (parent == nullptr) { return ret; }
+    const auto numPrimvars = ret.size();
+    for (const auto& primvar : parent->CalculateInstancePrimvars(GetId())) {
+        const auto it = std::find_if(
+            ret.begin(), ret.begin() + numPrimvars,
+            [&primvar](const InstancePrimvars::value_type& p) -> bool {
+                return p.first.name == primvar.first.name;
+            });
+        if (it != ret.begin() + numPrimvars) { continue; }
+        VtValue value;
+        if (_VisitArray(
+                primvar.second,
+                _RemapPrimvar{numInstances,
+                              [numLocal](size_t i) -> int {
+                                  return static_cast<int>(i / numLocal);
+                              },
+                              &value})) {
+            ret.emplace_back(primvar.first, value);
+        }
+    }
+    return ret;
+}
+
+void HdAiInstancer::SyncInstances(
+    const SdfPath& prototypeId, AtNode* prototype, uint8_t visibility,
+    std::vector<AtNode*>* instances) {
+    const auto shutter = _delegate->GetShutterRange();
+    const auto matrices = CalculateInstanceMatrices(prototypeId, shutter);
+    const auto primvars = CalculateInstancePrimvars(prototypeId);
+    const auto numKeys = static_cast<uint32_t>(matrices.size());
+    const auto numInstances = matrices.front().size();
+    // The matrices are converted here, only the ginstances are created and
+    // updated in the journal.
+    auto arrays = std::make_shared<std::vector<AtArray*>>(numInstances);
+    for (auto i = decltype(numInstances){0}; i < numInstances; ++i) {
+        auto* a = AiArrayAllocate(1, numKeys, AI_TYPE_MATRIX);
+        auto* out = static_cast<AtMatrix*>(AiArrayMap(a));
+        for (auto key = decltype(numKeys){0}; key < numKeys; ++key) {
+            out[key] = HdAiConvertMatrix(matrices[key][i]);
+        }
+        AiArrayUnmap(a);
+        (*arrays)[i] = a;
+    }
+    auto* universe = _delegate->GetUniverse();
+    _delegate->GetNodeEditJournal().Record([prototype, instances, arrays,
+                                             primvars, visibility, shutter,
+                                             universe]() {
+        // The prototype is only rendered through its instances.
+        AiNodeSetByte(prototype, Str::visibility, 0);
+        while (instances->size() > arrays->size()) {
+            AiNodeDestroy(instances->back());
+            instances->pop_back();
+        }
+        const auto* prototypeName = AiNodeGetName(prototype);
+        const auto primId = AiNodeGetUInt(prototype, Str::id);
+        const auto opaque = AiNodeGetBool(prototype, Str::opaque);
+        std::vector<std::string> userParams;
+        std::vector<AtString> primvarNames;
+        primvarNames.reserve(primvars.size());
+        for (const auto& primvar : primvars) {
+            primvarNames.emplace_back(primvar.first.name.GetText());
+        }
+        for (auto i = decltype(arrays->size()){0}; i < arrays->size(); ++i) {
+            if (i == instances->size()) {
+                auto* instance = AiNode(universe, Str::ginstance);
+                AiNodeSetStr(
+                    instance, Str::name,
+                    TfStringPrintf("%s_instance_%zu", prototypeName, i)
+                        .c_str());
+                AiNodeSetPtr(instance, Str::node, prototype);
+                instances->push_back(instance);
+            } else {
+                // Primvars that are still authored are assigned again
+                // below, without declaring them again.
+                userParams.clear();
+                auto* iter = AiNodeGetUserParamIterator((*instances)[i]);
+                while (!AiUserParamIteratorFinished(iter)) {
+                    const auto* name = AiUserParamGetName(
+                        AiUserParamIteratorGetNext(iter));
+                    if (std::find(
+                            primvarNames.begin(), primvarNames.end(),
+                            AtString(name)) == primvarNames.end()) {
+                        userParams.emplace_back(name);
+                    }
+                }
+                AiUserParamIteratorDestroy(iter);
+                for (const auto& userParam : userParams) {
+                    AiNodeResetParameter((*instances)[i], userParam.c_str());
+                }
+            }
+            auto* instance = (*instances)[i];
+            AiNodeSetArray(instance, Str::matrix, (*arrays)[i]);
+            HdAiSetMotionRange(instance, shutter);
+            AiNodeSetByte(instance, Str::visibility, visibility);
+            AiNodeSetUInt(instance, Str::id, primId);
+            AiNodeSetBool(instance, Str::opaque, opaque);
+            for (const auto& primvar : primvars) {
+                VtValue value;
+                _VisitArray(primvar.second, _GetElement{i, &value});
+                if (!value.IsEmpty()) {
+                    HdAiAssignConstantPrimvar(instance, primvar.first, value);
+                }
+            }
+        }
+    });
+}
+
+void HdAiInstancer::_SyncPrimvars() {
+    auto& changeTracker = GetDelegate()->GetRenderIndex().GetChangeTracker();
+    const auto& id = GetId();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (changeTracker.GetInstancerDirtyBits(id) == HdChangeTracker::Clean) {
+        return;
+    }
+    auto* delegate = GetDelegate();
+    delegate->SampleInstancerTransform(id, &_transform);
+    _transformPrimvars.clear();
+    _primvars.clear();
+    for (const auto& primvar :
+         delegate->GetPrimvarDescriptors(id, HdInterpolationInstance)) {
+        if (primvar.name == HdInstancerTokens->translate ||
+            primvar.name == HdInstancerTokens->rotate ||
+            primvar.name == HdInstancerTokens->scale ||
+            primvar.name == HdInstancerTokens->instanceTransform) {
+            delegate->SamplePrimvar(
+                id, primvar.name, &_transformPrimvars[primvar.name]);
+        } else {
+            _primvars.emplace_back(primvar, delegate->Get(id, primvar.name));
+        }
+    }
+    changeTracker.MarkInstancerClean(id);
+}
+
+size_t HdAiInstancer::_GetNumKeys() {
+    _SyncPrimvars();
+    size_t numKeys = _transform.count;
+    for (const auto& primvar : _transformPrimvars) {
+        numKeys = std::max<size_t>(numKeys, primvar.second.count);
+    }
+    auto* parent = _GetParentInstancer();
+    if (parent != nullptr) {
+        numKeys = std::max(numKeys, parent->_GetNumKeys());
+    }
+    return std::max<size_t>(
+        1, std::min<size_t>(
+               numKeys, HdAiConfig::GetInstance().max_motion_samples));
+}
+
+std::vector<VtMatrix4dArray> HdAiInstancer::_CalculateInstanceMatrices(
+    const SdfPath& prototypeId, const GfVec2f& shutter, size_t numKeys) {
+    _SyncPrimvars();
+    const auto indices =
+        GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
+    const auto numInstances = indices.size();
+    const auto findSamples = [this](const TfToken& name) -> const _Samples* {
+        const auto it = _transformPrimvars.find(name);
+        return it == _transformPrimvars.end() ? nullptr : &it->second;
+    };
+    const auto* translates = findSamples(HdInstancerTokens->translate);
+    const auto* rotates = findSamples(HdInstancerTokens->rotate);
+    const auto* scales = findSamples(HdInstancerTokens->scale);
+    const auto* instanceTransforms =
+        findSamples(HdInstancerTokens->instanceTransform);
+
+    // instancerTransform * translate * rotate * scale * instanceTransform,
+    // applied from the left to match the row vectors of Gf.
+    std::vector<VtMatrix4dArray> ret(numKeys);
+    for (auto key = decltype(numKeys){0}; key < numKeys; ++key) {
+        GfMatrix4d instancerTransform(1.0);
+        if (_transform.count > 0) {
+            const auto sample =
+                HdAiGetKeySample(_transform, key, numKeys, shutter);
+            instancerTransform =
+                sample.first == sample.second
+                    ? _transform.values[sample.first]
+                    : _Lerp(
+                          _transform.values[sample.first],
+                          _transform.values[sample.second], sample.weight);
+        }
+        auto& matrices = ret[key];
+        matrices.assign(numInstances, instancerTransform);
+        _ApplyTransformPrimvar<GfVec3f>(
+            translates, key, numKeys, shutter, indices, matrices,
+            [](const GfVec3f& v) -> GfMatrix4d {
+                return GfMatrix4d(1.0).SetTranslate(GfVec3d(v));
+            });
+        _ApplyTransformPrimvar<GfVec4f>(
+            rotates, key, numKeys, shutter, indices, matrices,
+            [](const GfVec4f& v) -> GfMatrix4d {
+                return GfMatrix4d(1.0).SetRotate(GfRotation(
+                    GfQuaternion(v[0], GfVec3d(v[1], v[2], v[3]))));
+            });
+        _ApplyTransformPrimvar<GfVec3f>(
+            scales, key, numKeys, shutter, indices, matrices,
+            [](const GfVec3f& v) -> GfMatrix4d {
+                return GfMatrix4d(1.0).SetScale(GfVec3d(v));
+            });
+        _ApplyTransformPrimvar<GfMatrix4d>(
+            instanceTransforms, key, numKeys, shutter, indices, matrices,
+            [](const GfMatrix4d& v) -> GfMatrix4d { return v; });
+    }
+
+    auto* parent = _GetParentInstancer();
+    if (parent == nullptr) { return ret; }
+    // Every instance of the parent instancer instances all of ours.
+    const auto parentMatrices =
+        parent->_CalculateInstanceMatrices(GetId(), shutter, numKeys);
+    for (auto key = decltype(numKeys){0}; key < numKeys; ++key) {
+        const auto& parentKey = parentMatrices[key];
+        const auto& localKey = ret[key];
+        VtMatrix4dArray matrices(parentKey.size() * numInstances);
+        for (auto i = decltype(parentKey.size()){0}; i < parentKey.size();
+             ++i) {
+            for (auto j = decltype(numInstances){0}; j < numInstances; ++j) {
+                matrices[i * numInstances + j] = localKey[j] * parentKey[i];
+            }
+        }
+        ret[key] = matrices;
+    }
+    return ret;
+}
+
+void HdAiSyncInstances(
+    HdSceneDelegate* delegate, const SdfPath& id, const SdfPath& instancerId,
+    HdDirtyBits dirtyBits, AtNode* prototype, uint8_t visibility,
+    std::vector<AtNode*>* instances, bool prototypeChanged) {
+    if (instancerId.IsEmpty() ||
+        (!prototypeChanged &&
+         !(dirtyBits &
+           (HdChangeTracker::DirtyInstancer |
+            HdChangeTracker::DirtyInstanceIndex |
+            HdChangeTracker::DirtyVisibility | HdChangeTracker::DirtyPrimID |
+            HdChangeTracker::DirtyTransform)))) {
+        return;
+    }
+    auto* instancer = static_cast<HdAiInstancer*>(
+        delegate->GetRenderIndex().GetInstancer(instancerId));
+    if (instancer != nullptr) {
+        instancer->SyncInstances(id, prototype, visibility, instances);
+    }
+}
+
+HdAiInstancer* HdAiInstancer::_GetParentInstancer() const {
+    const auto& parentId = GetParentId();
+    if (parentId.IsEmpty()) { return nullptr; }
+    return static_cast<HdAiInstancer*>(
+        GetDelegate()->GetRenderIndex().GetInstancer(parentId));
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,116 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_INSTANCER_H
+#define HDAI_INSTANCER_H
+
+#include <pxr/pxr.h>
+#include "pxr/imaging/hdAi/api.h"
+
+#include <pxr/base/gf/vec2f.h>
+#include <pxr/base/vt/types.h>
+#include <pxr/base/vt/value.h>
+
+#include <pxr/imaging/hd/instancer.h>
+#include <pxr/imaging/hd/timeSampleArray.h>
+
+#include "pxr/imaging/hdAi/renderDelegate.h"
+#include "pxr/imaging/hdAi/utils.h"
+
+#include <ai.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Renders the instances of rprims as ginstances of their Arnold node.
+///
+/// The node of the prototype is hidden and every instance is a ginstance
+/// referencing it, so the geometry is only stored once per prototype.
+/// Instances of nested instancers are multiplied by the instances of their
+/// parents.
+///
+/// Hydra doesn't sync instancers, so the instance primvars are pulled by the
+/// rprims from their Sync, and cached behind a mutex.
+class HdAiInstancer : public HdInstancer {
+public:
+    /// Instance primvars with one value per instance.
+    using InstancePrimvars =
+        std::vector<std::pair<HdPrimvarDescriptor, VtValue>>;
+
+    HDAI_API
+    HdAiInstancer(
+        HdAiRenderDelegate* delegate, HdSceneDelegate* sceneDelegate,
+        const SdfPath& id, const SdfPath& parentInstancerId);
+
+    HDAI_API
+    ~HdAiInstancer() override = default;
+
+    /// Returns the number of instances of @p prototypeId, including the
+    /// instances of the parent instancers.
+    HDAI_API
+    size_t GetNumInstances(const SdfPath& prototypeId);
+
+    /// Calculates the matrices of the instances of @p prototypeId, one array
+    /// per motion key, with the keys evenly distributed over @p shutter.
+    HDAI_API
+    std::vector<VtMatrix4dArray> CalculateInstanceMatrices(
+        const SdfPath& prototypeId, const GfVec2f& shutter);
+
+    /// Calculates the primvars of the instances of @p prototypeId. Primvars
+    /// of nested instancers override the primvars of their parents.
+    HDAI_API
+    InstancePrimvars CalculateInstancePrimvars(const SdfPath& prototypeId);
+
+    /// Converts the instances of @p prototypeId, and records the ginstances
+    /// of @p prototype into the journal of the render delegate. The
+    /// ginstances are stored in @p instances, which is owned by the rprim.
+    HDAI_API
+    void SyncInstances(
+        const SdfPath& prototypeId, AtNode* prototype, uint8_t visibility,
+        std::vector<AtNode*>* instances);
+
+private:
+    using _Samples = HdTimeSampleArray<VtValue, HdAiMaxMotionSamples>;
+
+    void _SyncPrimvars();
+    size_t _GetNumKeys();
+    std::vector<VtMatrix4dArray> _CalculateInstanceMatrices(
+        const SdfPath& prototypeId, const GfVec2f& shutter, size_t numKeys);
+    HdAiInstancer* _GetParentInstancer() const;
+
+    HdAiRenderDelegate* _delegate;
+    std::mutex _mutex;
+    HdTimeSampleArray<GfMatrix4d, HdAiMaxMotionSamples> _transform;
+    // Samples of translate, rotate, scale and instanceTransform.
+    std::unordered_map<TfToken, _Samples, TfToken::HashFunctor>
+        _transformPrimvars;
+    InstancePrimvars _primvars;
+};
+
+/// Syncs the ginstances of the node of an rprim, if the rprim has an
+/// instancer and its instances changed. The ginstances are visible to the
+/// rays in @p visibility. @p prototypeChanged syncs them when a parameter
+/// the ginstances copy from the node of the rprim changed.
+HDAI_API
+void HdAiSyncInstances(
+    HdSceneDelegate* delegate, const SdfPath& id, const SdfPath& instancerId,
+    HdDirtyBits dirtyBits, AtNode* prototype, uint8_t visibility,
+    std::vector<AtNode*>* instances, bool prototypeChanged = false);
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_INSTANCER_H
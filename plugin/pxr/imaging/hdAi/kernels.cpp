@@ -0,0 +1,383 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/kernels.h"
+
+#include <pxr/base/arch/defines.h>
+
+#include <algorithm>
+
+// We rely on target attributes to compile the SIMD variants, so the rest of
+// the plugin doesn't have to be built with -mavx2.
+#if defined(ARCH_CPU_INTEL) && \
+    (defined(ARCH_COMPILER_GCC) || defined(ARCH_COMPILER_CLANG))
+#define HDAI_KERNELS_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace {
+
+// 4x4 Bayer matrix, remapped to [0, 1) and including the rounding offset.
+constexpr float _ditherMatrix[4][4] = {
+    {0.5f / 16.0f, 8.5f / 16.0f, 2.5f / 16.0f, 10.5f / 16.0f},
+    {12.5f / 16.0f, 4.5f / 16.0f, 14.5f / 16.0f, 6.5f / 16.0f},
+    {3.5f / 16.0f, 11.5f / 16.0f, 1.5f / 16.0f, 9.5f / 16.0f},
+    {15.5f / 16.0f, 7.5f / 16.0f, 13.5f / 16.0f, 5.5f / 16.0f}};
+
+inline uint8_t _Quantize(float in, float threshold) {
+    return static_cast<uint8_t>(
+        std::max(0.0f, std::min(1.0f, in)) * 255.0f + threshold);
+}
+
+inline void _QuantizeScalar(
+    const float* in, uint8_t* out, size_t count, const float* thresholds) {
+    for (auto i = decltype(count){0}; i < count; ++i) {
+        const auto threshold = thresholds[i & 3];
+        out[0] = _Quantize(in[0], threshold);
+        out[1] = _Quantize(in[1], threshold);
+        out[2] = _Quantize(in[2], threshold);
+        out[3] = _Quantize(in[3], threshold);
+        in += 4;
+        out += 4;
+    }
+}
+
+// Thresholds for the pixels starting at x, so the kernels can step over them
+// without a modulo.
+inline void _GetThresholds(int x, int y, float* thresholds) {
+    const auto* row = _ditherMatrix[y & 3];
+    for (auto i = 0; i < 4; ++i) { thresholds[i] = row[(x + i) & 3]; }
+}
+
+void _QuantizeRGBA8Scalar(
+    const float* in, uint8_t* out, size_t count, int x, int y) {
+    float thresholds[4];
+    _GetThresholds(x, y, thresholds);
+    _QuantizeScalar(in, out, count, thresholds);
+}
+
+void _ConvertFloatToHalfScalar(const float* in, GfHalf* out, size_t count) {
+    for (auto i = decltype(count){0}; i < count; ++i) { out[i] = in[i]; }
+}
+
+void _ConvertDoubleToFloatScalar(const double* in, float* out, size_t count) {
+    for (auto i = decltype(count){0}; i < count; ++i) {
+        out[i] = static_cast<float>(in[i]);
+    }
+}
+
+void _ConvertHalfToFloatScalar(const GfHalf* in, float* out, size_t count) {
+    for (auto i = decltype(count){0}; i < count; ++i) { out[i] = in[i]; }
+}
+
+inline float _ProjectDepth(
+    const GfMatrix4f& m, const float* p, const HdAiDepthRange& range) {
+    const auto z = p[0] * m[0][2] + p[1] * m[1][2] + p[2] * m[2][2] + m[3][2];
+    const auto w = p[0] * m[0][3] + p[1] * m[1][3] + p[2] * m[2][3] + m[3][3];
+    return std::max(
+        range.min, std::min(range.max, (z / w) * range.scale + range.offset));
+}
+
+inline void _ProjectDepthScalar(
+    const GfMatrix4f& viewProj, const float* p, const float* rgba, float* out,
+    size_t count, const HdAiDepthRange& range) {
+    for (auto i = decltype(count){0}; i < count; ++i) {
+        out[i] = rgba != nullptr && rgba[i * 4 + 3] == 0.0f
+                     ? range.background
+                     : _ProjectDepth(viewProj, p + i * 3, range);
+    }
+}
+
+#ifdef HDAI_KERNELS_X86
+
+// Quantizes a single pixel to four 32 bit integers.
+__attribute__((target("sse4.1"))) inline __m128i _QuantizeSSE4(
+    const float* pixel, __m128 threshold) {
+    const auto v = _mm_min_ps(
+        _mm_set1_ps(1.0f), _mm_max_ps(_mm_setzero_ps(), _mm_loadu_ps(pixel)));
+    return _mm_cvttps_epi32(
+        _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), threshold));
+}
+
+// Quantizes two pixels to eight 32 bit integers.
+__attribute__((target("avx2"))) inline __m256i _QuantizeAVX2(
+    const float* pixels, __m256 threshold) {
+    const auto v = _mm256_min_ps(
+        _mm256_set1_ps(1.0f),
+        _mm256_max_ps(_mm256_setzero_ps(), _mm256_loadu_ps(pixels)));
+    return _mm256_cvttps_epi32(
+        _mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(255.0f)), threshold));
+}
+
+__attribute__((target("sse4.1"))) void _QuantizeRGBA8SSE4(
+    const float* in, uint8_t* out, size_t count, int x, int y) {
+    float thresholds[4];
+    _GetThresholds(x, y, thresholds);
+    const auto t0 = _mm_set1_ps(thresholds[0]);
+    const auto t1 = _mm_set1_ps(thresholds[1]);
+    const auto t2 = _mm_set1_ps(thresholds[2]);
+    const auto t3 = _mm_set1_ps(thresholds[3]);
+    // Four pixels at a time, so we always use the same four thresholds.
+    const auto simdCount = count & ~size_t{3};
+    for (auto i = decltype(simdCount){0}; i < simdCount; i += 4) {
+        const auto p01 = _mm_packus_epi32(
+            _QuantizeSSE4(in, t0), _QuantizeSSE4(in + 4, t1));
+        const auto p23 = _mm_packus_epi32(
+            _QuantizeSSE4(in + 8, t2), _QuantizeSSE4(in + 12, t3));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out), _mm_packus_epi16(p01, p23));
+        in += 16;
+        out += 16;
+    }
+    _QuantizeScalar(in, out, count - simdCount, thresholds);
+}
+
+__attribute__((target("avx2"))) void _QuantizeRGBA8AVX2(
+    const float* in, uint8_t* out, size_t count, int x, int y) {
+    float thresholds[4];
+    _GetThresholds(x, y, thresholds);
+    // Each register holds two pixels.
+    const auto t01 = _mm256_setr_ps(
+        thresholds[0], thresholds[0], thresholds[0], thresholds[0],
+        thresholds[1], thresholds[1], thresholds[1], thresholds[1]);
+    const auto t23 = _mm256_setr_ps(
+        thresholds[2], thresholds[2], thresholds[2], thresholds[2],
+        thresholds[3], thresholds[3], thresholds[3], thresholds[3]);
+    // Packing works per 128 bit lane, this restores the order of the pixels.
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const auto simdCount = count & ~size_t{7};
+    for (auto i = decltype(simdCount){0}; i < simdCount; i += 8) {
+        const auto p0123 = _mm256_packus_epi32(
+            _QuantizeAVX2(in, t01), _QuantizeAVX2(in + 8, t23));
+        const auto p4567 = _mm256_packus_epi32(
+            _QuantizeAVX2(in + 16, t01), _QuantizeAVX2(in + 24, t23));
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(out),
+            _mm256_permutevar8x32_epi32(
+                _mm256_packus_epi16(p0123, p4567), order));
+        in += 32;
+        out += 32;
+    }
+    _QuantizeScalar(in, out, count - simdCount, thresholds);
+}
+
+__attribute__((target("avx,f16c"))) void _ConvertFloatToHalfF16C(
+    const float* in, GfHalf* out, size_t count) {
+    static_assert(sizeof(GfHalf) == 2, "GfHalf has to be 16 bits.");
+    const auto simdCount = count & ~size_t{7};
+    for (auto i = decltype(simdCount){0}; i < simdCount; i += 8) {
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out + i),
+            _mm256_cvtps_ph(
+                _mm256_loadu_ps(in + i),
+                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    }
+    _ConvertFloatToHalfScalar(
+        in + simdCount, out + simdCount, count - simdCount);
+}
+
+__attribute__((target("avx"))) void _ConvertDoubleToFloatAVX(
+    const double* in, float* out, size_t count) {
+    const auto simdCount = count & ~size_t{7};
+    for (auto i = decltype(simdCount){0}; i < simdCount; i += 8) {
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i)));
+        _mm_storeu_ps(
+            out + i + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i + 4)));
+    }
+    _ConvertDoubleToFloatScalar(
+        in + simdCount, out + simdCount, count - simdCount);
+}
+
+__attribute__((target("avx,f16c"))) void _ConvertHalfToFloatF16C(
+    const GfHalf* in, float* out, size_t count) {
+    const auto simdCount = count & ~size_t{7};
+    for (auto i = decltype(simdCount){0}; i < simdCount; i += 8) {
+        _mm256_storeu_ps(
+            out + i, _mm256_cvtph_ps(_mm_loadu_si128(
+                         reinterpret_cast<const __m128i*>(in + i))));
+    }
+    _ConvertHalfToFloatScalar(
+        in + simdCount, out + simdCount, count - simdCount);
+}
+
+__attribute__((target("sse4.1"))) void _ProjectDepthSSE4(
+    const GfMatrix4f& viewProj, const float* p, const float* rgba, float* out,
+    size_t count, const HdAiDepthRange& range) {
+    const auto m02 = _mm_set1_ps(viewProj[0][2]);
+    const auto m12 = _mm_set1_ps(viewProj[1][2]);
+    const auto m22 = _mm_set1_ps(viewProj[2][2]);
+    const auto m32 = _mm_set1_ps(viewProj[3][2]);
+    const auto m03 = _mm_set1_ps(viewProj[0][3]);
+    const auto m13 = _mm_set1_ps(viewProj[1][3]);
+    const auto m23 = _mm_set1_ps(viewProj[2][3]);
+    const auto m33 = _mm_set1_ps(viewProj[3][3]);
+    const auto scale = _mm_set1_ps(range.scale);
+    const auto offset = _mm_set1_ps(range.offset);
+    const auto minDepth = _mm_set1_ps(range.min);
+    const auto maxDepth = _mm_set1_ps(range.max);
+    const auto background = _mm_set1_ps(range.background);
+    const auto zero = _mm_setzero_ps();
+    const auto simdCount = count & ~size_t{3};
+    for (auto i = decltype(simdCount){0}; i < simdCount; i += 4) {
+        // Transposing four xyz triplets.
+        const auto a = _mm_loadu_ps(p);
+        const auto b = _mm_loadu_ps(p + 4);
+        const auto c = _mm_loadu_ps(p + 8);
+        const auto t = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+        const auto u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+        const auto px = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 3, 0));
+        const auto py = _mm_shuffle_ps(u, t, _MM_SHUFFLE(3, 1, 2, 0));
+        const auto pz = _mm_shuffle_ps(u, c, _MM_SHUFFLE(3, 0, 3, 1));
+        const auto z = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(px, m02), _mm_mul_ps(py, m12)),
+            _mm_add_ps(_mm_mul_ps(pz, m22), m32));
+        const auto w = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(px, m03), _mm_mul_ps(py, m13)),
+            _mm_add_ps(_mm_mul_ps(pz, m23), m33));
+        auto depth = _mm_max_ps(
+            minDepth,
+            _mm_min_ps(
+                maxDepth,
+                _mm_add_ps(_mm_mul_ps(_mm_div_ps(z, w), scale), offset)));
+        if (rgba != nullptr) {
+            const auto alpha =
+                _mm_setr_ps(rgba[3], rgba[7], rgba[11], rgba[15]);
+            depth =
+                _mm_blendv_ps(depth, background, _mm_cmpeq_ps(alpha, zero));
+            rgba += 16;
+        }
+        _mm_storeu_ps(out, depth);
+        p += 12;
+        out += 4;
+    }
+    _ProjectDepthScalar(viewProj, p, rgba, out, count - simdCount, range);
+}
+
+__attribute__((target("avx2"))) void _ProjectDepthAVX2(
+    const GfMatrix4f& viewProj, const float* p, const float* rgba, float* out,
+    size_t count, const HdAiDepthRange& range) {
+    const auto m02 = _mm256_set1_ps(viewProj[0][2]);
+    const auto m12 = _mm256_set1_ps(viewProj[1][2]);
+    const auto m22 = _mm256_set1_ps(viewProj[2][2]);
+    const auto m32 = _mm256_set1_ps(viewProj[3][2]);
+    const auto m03 = _mm256_set1_ps(viewProj[0][3]);
+    const auto m13 = _mm256_set1_ps(viewProj[1][3]);
+    const auto m23 = _mm256_set1_ps(viewProj[2][3]);
+    const auto m33 = _mm256_set1_ps(viewProj[3][3]);
+    const auto scale = _mm256_set1_ps(range.scale);
+    const auto offset = _mm256_set1_ps(range.offset);
+    const auto minDepth = _mm256_set1_ps(range.min);
+    const auto maxDepth = _mm256_set1_ps(range.max);
+    const auto background = _mm256_set1_ps(range.background);
+    const auto zero = _mm256_setzero_ps();
+    const auto pIndices = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const auto alphaIndices = _mm256_setr_epi32(3, 7, 11, 15, 19, 23, 27, 31);
+    const auto simdCount = count & ~size_t{7};
+    for (auto i = decltype(simdCount){0}; i < simdCount; i += 8) {
+        const auto px = _mm256_i32gather_ps(p, pIndices, 4);
+        const auto py = _mm256_i32gather_ps(p + 1, pIndices, 4);
+        const auto pz = _mm256_i32gather_ps(p + 2, pIndices, 4);
+        const auto z = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(px, m02), _mm256_mul_ps(py, m12)),
+            _mm256_add_ps(_mm256_mul_ps(pz, m22), m32));
+        const auto w = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(px, m03), _mm256_mul_ps(py, m13)),
+            _mm256_add_ps(_mm256_mul_ps(pz, m23), m33));
+        auto depth = _mm256_max_ps(
+            minDepth,
+            _mm256_min_ps(
+                maxDepth,
+                _mm256_add_ps(
+                    _mm256_mul_ps(_mm256_div_ps(z, w), scale), offset)));
+        if (rgba != nullptr) {
+            const auto alpha = _mm256_i32gather_ps(rgba, alphaIndices, 4);
+            depth = _mm256_blendv_ps(
+                depth, background, _mm256_cmp_ps(alpha, zero, _CMP_EQ_OQ));
+            rgba += 32;
+        }
+        _mm256_storeu_ps(out, depth);
+        p += 24;
+        out += 8;
+    }
+    _ProjectDepthScalar(viewProj, p, rgba, out, count - simdCount, range);
+}
+
+#endif
+
+struct Kernels {
+    decltype(&_QuantizeRGBA8Scalar) quantizeRGBA8 = _QuantizeRGBA8Scalar;
+    decltype(&_ConvertFloatToHalfScalar) convertFloatToHalf =
+        _ConvertFloatToHalfScalar;
+    decltype(&_ProjectDepthScalar) projectDepth = _ProjectDepthScalar;
+    decltype(&_ConvertDoubleToFloatScalar) convertDoubleToFloat =
+        _ConvertDoubleToFloatScalar;
+    decltype(&_ConvertHalfToFloatScalar) convertHalfToFloat =
+        _ConvertHalfToFloatScalar;
+
+    Kernels() {
+#ifdef HDAI_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            quantizeRGBA8 = _QuantizeRGBA8AVX2;
+            projectDepth = _ProjectDepthAVX2;
+        } else if (__builtin_cpu_supports("sse4.1")) {
+            quantizeRGBA8 = _QuantizeRGBA8SSE4;
+            projectDepth = _ProjectDepthSSE4;
+        }
+        if (__builtin_cpu_supports("avx")) {
+            convertDoubleToFloat = _ConvertDoubleToFloatAVX;
+        }
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (__builtin_cpu_supports("avx") &&
+            __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C) != 0) {
+            convertFloatToHalf = _ConvertFloatToHalfF16C;
+            convertHalfToFloat = _ConvertHalfToFloatF16C;
+        }
+#endif
+    }
+};
+
+const Kernels& _GetKernels() {
+    static const Kernels kernels;
+    return kernels;
+}
+
+} // namespace
+
+void HdAiQuantizeRGBA8(
+    const float* in, uint8_t* out, size_t count, int x, int y) {
+    _GetKernels().quantizeRGBA8(in, out, count, x, y);
+}
+
+void HdAiConvertFloatToHalf(const float* in, GfHalf* out, size_t count) {
+    _GetKernels().convertFloatToHalf(in, out, count);
+}
+
+void HdAiConvertDoubleToFloat(const double* in, float* out, size_t count) {
+    _GetKernels().convertDoubleToFloat(in, out, count);
+}
+
+void HdAiConvertHalfToFloat(const GfHalf* in, float* out, size_t count) {
+    _GetKernels().convertHalfToFloat(in, out, count);
+}
+
+void HdAiProjectDepth(
+    const GfMatrix4f& viewProj, const float* p, const float* rgba, float* out,
+    size_t count, const HdAiDepthRange& range) {
+    _GetKernels().projectDepth(viewProj, p, rgba, out, count, range);
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
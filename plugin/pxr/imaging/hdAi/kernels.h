@@ -0,0 +1,71 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/// Batched conversion kernels used by the driver, the render buffers and the
+/// primvar conversions.
+///
+/// Each kernel has a scalar implementation and SSE4.1 / AVX2 implementations
+/// on x86, the best one supported by the CPU is selected the first time a
+/// kernel is called.
+#ifndef HDAI_KERNELS_H
+#define HDAI_KERNELS_H
+
+#include <pxr/pxr.h>
+
+#include <pxr/base/gf/half.h>
+#include <pxr/base/gf/matrix4f.h>
+
+#include <cstddef>
+#include <cstdint>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Describes how clip space depth is remapped by HdAiProjectDepth.
+struct HdAiDepthRange {
+    float scale;
+    float offset;
+    float min;
+    float max;
+    /// Written for pixels where the alpha of the beauty is zero.
+    float background;
+};
+
+/// Quantizes @p count RGBA pixels to 8 bits per channel, using ordered
+/// dithering.
+///
+/// @p x and @p y are the image coordinates of the first pixel, and are used to
+/// look up the dither pattern.
+void HdAiQuantizeRGBA8(
+    const float* in, uint8_t* out, size_t count, int x, int y);
+
+/// Converts @p count floats to halves.
+void HdAiConvertFloatToHalf(const float* in, GfHalf* out, size_t count);
+
+/// Converts @p count doubles to floats.
+void HdAiConvertDoubleToFloat(const double* in, float* out, size_t count);
+
+/// Converts @p count halves to floats.
+void HdAiConvertHalfToFloat(const GfHalf* in, float* out, size_t count);
+
+/// Projects @p count positions with @p viewProj and writes the remapped clip
+/// space depth to @p out.
+///
+/// @p rgba is optional, when set, pixels with zero alpha are considered to be
+/// background.
+void HdAiProjectDepth(
+    const GfMatrix4f& viewProj, const float* p, const float* rgba, float* out,
+    size_t count, const HdAiDepthRange& range);
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_KERNELS_H
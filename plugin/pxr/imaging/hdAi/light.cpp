@@ -300,7 +300,7 @@ void HdAiLight::Sync(
     TF_UNUSED(sceneDelegate);
     TF_UNUSED(dirtyBits);
     if (*dirtyBits & HdLight::DirtyParams) {
-        param->End();
+        param->Interrupt();
         const auto id = GetId();
         const auto* nentry = AiNodeGetNodeEntry(_light);
         iterateParams(_light, nentry, id, sceneDelegate, genericParams);
@@ -312,8 +312,9 @@ void HdAiLight::Sync(
     }
 
     if (*dirtyBits & HdLight::DirtyTransform) {
-        param->End();
-        HdAiSetTransform(_light, sceneDelegate, GetId());
+        param->Interrupt();
+        HdAiSetTransform(
+            _light, sceneDelegate, GetId(), _delegate->GetShutterRange());
     }
     *dirtyBits = HdLight::Clean;
 }
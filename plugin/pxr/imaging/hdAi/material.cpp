@@ -13,24 +13,223 @@
 // limitations under the License.
 #include "pxr/imaging/hdAi/material.h"
 
+#include <pxr/base/arch/hash.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/tf/staticTokens.h>
+#include <pxr/base/tf/stopwatch.h>
+#include <pxr/base/tf/stringUtils.h>
+#include <pxr/base/work/loops.h>
+
+#include <pxr/imaging/hd/changeTracker.h>
+#include <pxr/imaging/hd/renderIndex.h>
+#include <pxr/imaging/hd/tokens.h>
+
 #include <pxr/usdImaging/usdImaging/tokens.h>
 
 #include "pxr/imaging/hdAi/debugCodes.h"
 #include "pxr/imaging/hdAi/utils.h"
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
+TF_DEFINE_PRIVATE_TOKENS(_tokens, (displacement)(volume));
+
 namespace {
 const AtString nameStr("name");
+
+AtString _GetNodeType(const HdMaterialNode& material) {
+    const auto* nodeTypeStr = material.identifier.GetText();
+    return AtString(
+        strncmp(nodeTypeStr, "ai:", 3) == 0 ? nodeTypeStr + 3 : nodeTypeStr);
 }
 
-HdAiMaterial::HdAiMaterial(HdAiRenderDelegate* delegate, const SdfPath& id)
-    : HdMaterial(id), _delegate(delegate) {
-    _surface = _delegate->GetFallbackShader();
+// The terminal is the first node that is not linked to another node.
+const HdMaterialNode* _GetTerminal(const HdMaterialNetwork& network) {
+    for (const auto& node : network.nodes) {
+        if (std::find_if(
+                network.relationships.begin(), network.relationships.end(),
+                [&](const HdMaterialRelationship& relationship) {
+                    return relationship.inputId == node.path;
+                }) == network.relationships.end()) {
+            return &node;
+        }
+    }
+    return nullptr;
+}
+
+// Parameter of a surface shader that makes the surface transparent, unless
+// it's left to its opaque value.
+struct _OpacityParam {
+    TfToken name;
+    float opaqueValue;
+};
+
+using _SurfaceOpacity =
+    std::vector<std::pair<AtString, std::vector<_OpacityParam>>>;
+
+// Built-in surface shaders that can be opaque. Other shaders are assumed to
+// be transparent. A positive opacityThreshold turns UsdPreviewSurface into a
+// cutout, even with a full opacity.
+const _SurfaceOpacity& _GetSurfaceOpacity() {
+    static const _SurfaceOpacity shaders{
+        {AtString("standard_surface"),
+         {{TfToken("opacity"), 1.0f}, {TfToken("transmission"), 0.0f}}},
+        {AtString("lambert"), {{TfToken("opacity"), 1.0f}}},
+        {AtString("utility"), {{TfToken("opacity"), 1.0f}}},
+        {AtString("UsdPreviewSurface"),
+         {{TfToken("opacity"), 1.0f}, {TfToken("opacityThreshold"), 0.0f}}},
+    };
+    return shaders;
+}
+
+bool _IsOpaqueValue(const VtValue& value, float opaqueValue) {
+    if (value.IsHolding<float>()) {
+        return value.UncheckedGet<float>() == opaqueValue;
+    } else if (value.IsHolding<GfVec3f>()) {
+        const auto& v = value.UncheckedGet<GfVec3f>();
+        return v[0] == opaqueValue && v[1] == opaqueValue &&
+               v[2] == opaqueValue;
+    }
+    return false;
+}
+
+// Returns true if the surface network can't let light through. Linked
+// opacity parameters could be transparent anywhere, so they are never
+// opaque.
+bool _IsOpaque(const HdMaterialNetwork& network) {
+    const auto* terminal = _GetTerminal(network);
+    if (terminal == nullptr) { return false; }
+    const auto nodeType = _GetNodeType(*terminal);
+    const auto& shaders = _GetSurfaceOpacity();
+    const auto shaderIt = std::find_if(
+        shaders.begin(), shaders.end(),
+        [&](const _SurfaceOpacity::value_type& shader) {
+            return shader.first == nodeType;
+        });
+    if (shaderIt == shaders.end()) { return false; }
+    for (const auto& param : shaderIt->second) {
+        const auto valueIt = terminal->parameters.find(param.name);
+        if (valueIt != terminal->parameters.end() &&
+            !_IsOpaqueValue(valueIt->second, param.opaqueValue)) {
+            return false;
+        }
+        // Links to a single channel are named after the parameter too.
+        const auto channelPrefix = param.name.GetString() + ".";
+        for (const auto& relationship : network.relationships) {
+            if (relationship.outputId == terminal->path &&
+                (relationship.outputName == param.name ||
+                 TfStringStartsWith(
+                     relationship.outputName.GetString(), channelPrefix))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Hashes the nodes of a network with the nodes linked to them, so identical
+// sub-networks of different materials have the same hashes.
+struct _NetworkHasher {
+    using Relationships = std::vector<const HdMaterialRelationship*>;
+
+    explicit _NetworkHasher(const HdMaterialNetwork& network) {
+        for (const auto& node : network.nodes) { nodes[node.path] = &node; }
+        for (const auto& relationship : network.relationships) {
+            links[relationship.outputId].push_back(&relationship);
+        }
+        // The order of the relationships doesn't change the network.
+        for (auto& it : links) {
+            std::sort(
+                it.second.begin(), it.second.end(),
+                [](const HdMaterialRelationship* a,
+                   const HdMaterialRelationship* b) {
+                    return a->outputName != b->outputName
+                               ? a->outputName < b->outputName
+                               : a->inputName < b->inputName;
+                });
+        }
+    }
+
+    uint64_t Get(const SdfPath& path) {
+        const auto hashIt = hashes.find(path);
+        if (hashIt != hashes.end()) { return hashIt->second; }
+        const auto nodeIt = nodes.find(path);
+        // Cycles are broken at the node visited twice.
+        if (nodeIt == nodes.end() || !visited.insert(path).second) {
+            return 0;
+        }
+        const auto& node = *nodeIt->second;
+        std::vector<uint64_t> data{node.identifier.Hash()};
+        for (const auto& param : node.parameters) {
+            data.push_back(param.first.Hash());
+            data.push_back(param.second.GetHash());
+        }
+        const auto linksIt = links.find(path);
+        if (linksIt != links.end()) {
+            for (const auto* relationship : linksIt->second) {
+                data.push_back(relationship->outputName.Hash());
+                data.push_back(relationship->inputName.Hash());
+                data.push_back(Get(relationship->inputId));
+            }
+        }
+        const auto hash = ArchHash64(
+            reinterpret_cast<const char*>(data.data()),
+            data.size() * sizeof(uint64_t));
+        hashes[path] = hash;
+        return hash;
+    }
+
+    std::unordered_map<SdfPath, const HdMaterialNode*, SdfPath::Hash> nodes;
+    std::unordered_map<SdfPath, Relationships, SdfPath::Hash> links;
+    std::unordered_map<SdfPath, uint64_t, SdfPath::Hash> hashes;
+    std::unordered_set<SdfPath, SdfPath::Hash> visited;
+};
+
+void _Link(
+    AtNode* inputNode, const TfToken& inputName, AtNode* outputNode,
+    const TfToken& outputName) {
+    // See if the inputName is a single channel we recognize
+    if (inputName.size() == 1) {
+        const char* channel = inputName.GetText();
+        if (channel[0] == 'r' || channel[0] == 'g' || channel[0] == 'b' ||
+            channel[0] == 'a' || channel[0] == 'x' || channel[0] == 'y' ||
+            channel[0] == 'z' || channel[0] == 'w') {
+            TF_DEBUG(HDAI_MATERIAL)
+                .Msg(
+                    "HdAiMaterial::ReadMaterialNetwork - Linking %s.%s => "
+                    "%s.%s\n",
+                    AiNodeGetName(inputNode), channel,
+                    AiNodeGetName(outputNode), outputName.GetText());
+            AiNodeLinkOutput(
+                inputNode, channel, outputNode, outputName.GetText());
+            return;
+        }
+    }
+    TF_DEBUG(HDAI_MATERIAL)
+        .Msg(
+            "HdAiMaterial::ReadMaterialNetwork - Linking %s => %s.%s\n",
+            AiNodeGetName(inputNode), AiNodeGetName(outputNode),
+            outputName.GetText());
+    AiNodeLink(inputNode, outputName.GetText(), outputNode);
 }
 
+} // namespace
+
+HdAiMaterial::HdAiMaterial(HdAiRenderDelegate* delegate, const SdfPath& id)
+    : HdMaterial(id), _delegate(delegate) {}
+
 HdAiMaterial::~HdAiMaterial() {
-    for (auto& node : _nodes) { AiNodeDestroy(node.second); }
+    auto& shaderCache = _delegate->GetShaderCache();
+    for (const auto* terminal : {&_surface, &_displacement, &_volume}) {
+        for (const auto& node : terminal->nodes) {
+            shaderCache.Release(node.second.hash);
+        }
+    }
 }
 
 void HdAiMaterial::Sync(
@@ -39,18 +238,48 @@ void HdAiMaterial::Sync(
     auto* param = reinterpret_cast<HdAiRenderParam*>(renderParam);
     const auto id = GetId();
     if ((*dirtyBits & HdMaterial::DirtyResource) && !id.IsEmpty()) {
-        param->End();
-        auto value = sceneDelegate->GetMaterialResource(GetId());
-        if (value.IsHolding<HdMaterialNetworkMap>()) {
-            const auto& map = value.UncheckedGet<HdMaterialNetworkMap>();
-            const auto* network =
-                TfMapLookupPtr(map.map, UsdImagingTokens->bxdf);
-            if (network != nullptr) {
-                auto* entry = ReadMaterialNetwork(*network);
-                _surface =
-                    entry == nullptr ? _delegate->GetFallbackShader() : entry;
+        // Only the changes to the network are applied, so interrupting the
+        // render is enough, even when nodes are added or removed.
+        param->Interrupt();
+        // The first material synced prepares all the dirty materials, the
+        // others are already prepared.
+        if (_prepared == nullptr) { PrepareMaterials(sceneDelegate); }
+        std::unique_ptr<_PreparedMaterial> prepared(std::move(_prepared));
+        if (prepared->resource.IsHolding<HdMaterialNetworkMap>()) {
+            TfStopwatch stopwatch;
+            stopwatch.Start();
+            // Every terminal is read, even after one of them changed.
+            const auto surfaceChanged =
+                ReadMaterialNetwork(prepared->surface, &_surface);
+            const auto displacementChanged =
+                ReadMaterialNetwork(prepared->displacement, &_displacement);
+            const auto volumeChanged =
+                ReadMaterialNetwork(prepared->volume, &_volume);
+            // The fallback shader is opaque.
+            const auto isOpaque =
+                _surface.node == nullptr || prepared->isOpaque;
+            const auto opacityChanged = isOpaque != _isOpaque;
+            _isOpaque = isOpaque;
+            // Rprims only read the shaders when their material id is dirty,
+            // and the previous terminals might have been destroyed. Edits
+            // keeping the terminal nodes are picked up by Arnold directly,
+            // and rprims only reassign the terminals that changed, so a
+            // surface edit doesn't touch the displacement of the meshes.
+            // New rprims are already dirty, so the first sync is skipped.
+            if ((surfaceChanged || displacementChanged || volumeChanged ||
+                 opacityChanged) &&
+                _wasSynced) {
+                _delegate->GetMaterialBindings().MarkRprimsDirty(
+                    id, sceneDelegate->GetRenderIndex().GetChangeTracker(),
+                    HdChangeTracker::DirtyMaterialId);
             }
+            stopwatch.Stop();
+            TF_DEBUG(HDAI_MATERIAL)
+                .Msg(
+                    "HdAiMaterial::Sync - %s - %.3f ms\n", id.GetText(),
+                    stopwatch.GetSeconds() * 1000.0);
         }
+        _wasSynced = true;
     }
     *dirtyBits = HdMaterial::Clean;
 }
@@ -61,123 +290,319 @@ HdDirtyBits HdAiMaterial::GetInitialDirtyBitsMask() const {
 
 void HdAiMaterial::Reload() {}
 
-AtNode* HdAiMaterial::GetSurfaceShader() const { return _surface; }
+AtNode* HdAiMaterial::GetSurfaceShader() const {
+    return _surface.node == nullptr ? _delegate->GetFallbackShader()
+                                    : _surface.node;
+}
+
+AtNode* HdAiMaterial::GetDisplacementShader() const {
+    return _displacement.node;
+}
+
+AtNode* HdAiMaterial::GetVolumeShader() const {
+    return _volume.node == nullptr ? GetSurfaceShader() : _volume.node;
+}
+
+bool HdAiMaterial::IsOpaque() const { return _isOpaque; }
 
-AtNode* HdAiMaterial::GetDisplacementShader() const { return _displacement; }
+void HdAiMaterial::PrepareMaterials(HdSceneDelegate* sceneDelegate) {
+    TfStopwatch readStopwatch;
+    readStopwatch.Start();
+    auto& renderIndex = sceneDelegate->GetRenderIndex();
+    auto& changeTracker = renderIndex.GetChangeTracker();
+    std::vector<HdAiMaterial*> materials{this};
+    // Sprims are synced one after the other, the materials not synced yet
+    // in this pass are still dirty.
+    for (const auto& id : _delegate->GetDirtyMaterials(sceneDelegate)) {
+        if (id == GetId() || !(changeTracker.GetSprimDirtyBits(id) &
+                               HdMaterial::DirtyResource)) {
+            continue;
+        }
+        auto* material = reinterpret_cast<HdAiMaterial*>(
+            renderIndex.GetSprim(HdPrimTypeTokens->material, id));
+        if (material != nullptr && material->_prepared == nullptr) {
+            materials.push_back(material);
+        }
+    }
+    // The scene delegate is not thread safe.
+    for (auto* material : materials) {
+        material->_prepared.reset(new _PreparedMaterial);
+        material->_prepared->resource =
+            sceneDelegate->GetMaterialResource(material->GetId());
+    }
+    readStopwatch.Stop();
 
-AtNode* HdAiMaterial::ReadMaterialNetwork(const HdMaterialNetwork& network) {
+    TfStopwatch prepareStopwatch;
+    prepareStopwatch.Start();
+    auto prepare = [&](size_t begin, size_t end) {
+        const HdMaterialNetwork emptyNetwork;
+        for (auto i = begin; i < end; ++i) {
+            auto& prepared = *materials[i]->_prepared;
+            if (!prepared.resource.IsHolding<HdMaterialNetworkMap>()) {
+                continue;
+            }
+            const auto& map =
+                prepared.resource.UncheckedGet<HdMaterialNetworkMap>();
+            // Terminals missing from the map release their nodes.
+            auto getNetwork =
+                [&](const TfToken& name) -> const HdMaterialNetwork& {
+                const auto* network = TfMapLookupPtr(map.map, name);
+                return network == nullptr ? emptyNetwork : *network;
+            };
+            const auto& surfaceNetwork = getNetwork(UsdImagingTokens->bxdf);
+            PrepareMaterialNetwork(surfaceNetwork, &prepared.surface);
+            PrepareMaterialNetwork(
+                getNetwork(_tokens->displacement), &prepared.displacement);
+            PrepareMaterialNetwork(
+                getNetwork(_tokens->volume), &prepared.volume);
+            prepared.isOpaque = _IsOpaque(surfaceNetwork);
+        }
+    };
+    // Editing a single material is the common interactive case, and isn't
+    // worth the tasks.
+    if (materials.size() == 1) {
+        prepare(0, 1);
+    } else {
+        WorkParallelForN(materials.size(), prepare);
+    }
+    prepareStopwatch.Stop();
     TF_DEBUG(HDAI_MATERIAL)
         .Msg(
-            "HdAiMaterial::ReadMaterialNetwork - %s - num nodes: %lu\n",
-            GetId().GetText(), network.nodes.size());
-    if (network.nodes.empty()) { return nullptr; }
+            "HdAiMaterial::PrepareMaterials - %lu materials - read: %.3f ms "
+            "- prepared: %.3f ms\n",
+            materials.size(), readStopwatch.GetSeconds() * 1000.0,
+            prepareStopwatch.GetSeconds() * 1000.0);
+}
 
-    std::vector<AtNode*> nodes;
-    nodes.reserve(network.nodes.size());
-    for (const auto& node : network.nodes) {
-        auto* n = ReadMaterial(node);
-        if (n != nullptr) { nodes.push_back(n); }
-    }
-
-    for (const auto& relationship : network.relationships) {
-        auto* inputNode = FindMaterial(relationship.inputId);
-        if (inputNode == nullptr) { continue; }
-        std::remove(nodes.begin(), nodes.end(), inputNode);
-        auto* outputNode = FindMaterial(relationship.outputId);
-        if (outputNode == nullptr) { continue; }
-
-        // See if the inputName is a single channel we recognize
-        bool usedInputName = false;
-        if (relationship.inputName.size() == 1) {
-            const char* inputName = relationship.inputName.GetText();
-            if (inputName[0] == 'r' || inputName[0] == 'g' ||
-                inputName[0] == 'b' || inputName[0] == 'a' ||
-                inputName[0] == 'x' || inputName[0] == 'y' ||
-                inputName[0] == 'z' || inputName[0] == 'w') {
-                usedInputName = true;
-                TF_DEBUG(HDAI_MATERIAL)
-                    .Msg(
-                        "HdAiMaterial::ReadMaterialNetwork - Linking %s.%s => "
-                        "%s.%s\n",
-                        relationship.inputId.GetText(),
-                        relationship.inputName.GetText(),
-                        relationship.outputId.GetText(),
-                        relationship.outputName.GetText());
-                AiNodeLinkOutput(
-                    inputNode, inputName, outputNode,
-                    relationship.outputName.GetText());
+void HdAiMaterial::PrepareMaterialNetwork(
+    const HdMaterialNetwork& network, _PreparedNetwork* prepared) {
+    _NetworkHasher hasher(network);
+    std::unordered_map<SdfPath, size_t, SdfPath::Hash> indices;
+    const auto numNodes = network.nodes.size();
+    for (auto i = decltype(numNodes){0}; i < numNodes; ++i) {
+        indices[network.nodes[i].path] = i;
+    }
+    prepared->nodes.resize(numNodes);
+    for (auto i = decltype(numNodes){0}; i < numNodes; ++i) {
+        const auto& node = network.nodes[i];
+        auto& preparedNode = prepared->nodes[i];
+        preparedNode.material = &node;
+        preparedNode.hash = hasher.Get(node.path);
+        preparedNode.nodeEntry = AiNodeEntryLookUp(_GetNodeType(node));
+        if (preparedNode.nodeEntry != nullptr) {
+            for (const auto& param : node.parameters) {
+                const auto* pentry = AiNodeEntryLookUpParameter(
+                    preparedNode.nodeEntry, AtString(param.first.GetText()));
+                if (pentry == nullptr) { continue; }
+                HdAiParameterValue value;
+                if (HdAiConvertParameter(pentry, param.second, &value)) {
+                    preparedNode.values.emplace_back(param.first, value);
+                }
             }
         }
-        if (!usedInputName) {
-            TF_DEBUG(HDAI_MATERIAL)
-                .Msg(
-                    "HdAiMaterial::ReadMaterialNetwork - Linking %s => %s.%s\n",
-                    relationship.inputId.GetText(),
-                    relationship.outputId.GetText(),
-                    relationship.outputName.GetText());
-            AiNodeLink(
-                inputNode, relationship.outputName.GetText(), outputNode);
+        const auto linksIt = hasher.links.find(node.path);
+        if (linksIt == hasher.links.end()) { continue; }
+        for (const auto* relationship : linksIt->second) {
+            const auto inputIt = indices.find(relationship->inputId);
+            if (inputIt == indices.end()) { continue; }
+            preparedNode.links.push_back(
+                {relationship->outputName, relationship->inputName,
+                 inputIt->second});
         }
     }
-
-    return nodes.empty() ? nullptr : nodes.front();
+    const auto* terminal = _GetTerminal(network);
+    prepared->terminal =
+        terminal == nullptr
+            ? numNodes
+            : static_cast<size_t>(terminal - network.nodes.data());
 }
 
-AtNode* HdAiMaterial::ReadMaterial(const HdMaterialNode& material) {
-    const auto nodeName = GetLocalNodeName(material.path);
-    const auto* nodeTypeStr = material.identifier.GetText();
-    const AtString nodeType(
-        strncmp(nodeTypeStr, "ai:", 3) == 0 ? nodeTypeStr + 3 : nodeTypeStr);
-
+bool HdAiMaterial::ReadMaterialNetwork(
+    const _PreparedNetwork& prepared, _Terminal* terminal) {
     TF_DEBUG(HDAI_MATERIAL)
         .Msg(
-            "HdAiMaterial::ReadMaterial - node %s - type %s\n",
-            nodeName.c_str(), nodeType.c_str());
-    AtNode* ret = nullptr;
-    const auto nodeIt = _nodes.find(nodeName);
-    if (nodeIt != _nodes.end()) {
-        if (AiNodeEntryGetNameAtString(AiNodeGetNodeEntry(nodeIt->second)) !=
-            nodeType) {
+            "HdAiMaterial::ReadMaterialNetwork - %s - num nodes: %lu\n",
+            GetId().GetText(), prepared.nodes.size());
+    auto& shaderCache = _delegate->GetShaderCache();
+    const auto numNodes = prepared.nodes.size();
+    _MaterialNodes nodes;
+    // Nodes of the network, in the order of the prepared nodes.
+    std::vector<_MaterialNode*> materialNodes(numNodes, nullptr);
+    // Nodes already in the cache have their parameters and links set.
+    std::vector<bool> acquired(numNodes, false);
+    // Released once the new nodes are referenced, so nodes that are still
+    // used are not destroyed.
+    std::vector<uint64_t> released;
+    for (auto i = decltype(numNodes){0}; i < numNodes; ++i) {
+        const auto& preparedNode = prepared.nodes[i];
+        const auto& path = preparedNode.material->path;
+        const auto hash = preparedNode.hash;
+        _MaterialNode materialNode;
+        const auto previousIt = terminal->nodes.find(path);
+        if (previousIt != terminal->nodes.end()) {
+            materialNode = std::move(previousIt->second);
+            terminal->nodes.erase(previousIt);
+            if (materialNode.hash == hash) {
+                acquired[i] = true;
+                materialNodes[i] =
+                    &nodes.emplace(path, std::move(materialNode))
+                         .first->second;
+                continue;
+            }
+            // Nodes no other material uses are edited in place, so changing
+            // a parameter doesn't create a new node.
+            if (!shaderCache.Contains(hash) &&
+                shaderCache.IsUnique(materialNode.hash) &&
+                UpdateMaterial(preparedNode, &materialNode)) {
+                shaderCache.Rehash(materialNode.hash, hash);
+                // The name has to follow the hash, or a later node of the
+                // same path reusing the old hash would collide with it.
+                AiNodeSetStr(
+                    materialNode.node, nameStr, GetNodeName(path, hash));
+                materialNode.hash = hash;
+                materialNodes[i] =
+                    &nodes.emplace(path, std::move(materialNode))
+                         .first->second;
+                continue;
+            }
+            released.push_back(materialNode.hash);
+            materialNode = _MaterialNode();
+        }
+        materialNode.hash = hash;
+        materialNode.parameters = preparedNode.material->parameters;
+        materialNode.node = shaderCache.Acquire(hash);
+        if (materialNode.node != nullptr) {
             TF_DEBUG(HDAI_MATERIAL)
                 .Msg(
-                    "  existing node found, but type mismatch - deleting old "
-                    "node\n");
-            AiNodeDestroy(nodeIt->second);
-            _nodes.erase(nodeIt);
+                    "  sharing node %s\n", AiNodeGetName(materialNode.node));
+            acquired[i] = true;
         } else {
-            TF_DEBUG(HDAI_MATERIAL).Msg("  existing node found - using it\n");
-            ret = nodeIt->second;
+            materialNode.node = ReadMaterial(preparedNode);
+            if (materialNode.node == nullptr) { continue; }
+            shaderCache.Add(hash, materialNode.node);
         }
+        materialNodes[i] =
+            &nodes.emplace(path, std::move(materialNode)).first->second;
     }
-    if (ret == nullptr) {
-        ret = AiNode(_delegate->GetUniverse(), nodeType);
-        if (ret == nullptr) {
-            TF_DEBUG(HDAI_MATERIAL)
-                .Msg(
-                    "  unable to create node of type %s - aborting\n",
-                    nodeType.c_str());
-            return nullptr;
+
+    // Only the links of nodes created or edited by this material are set,
+    // shared nodes already link to the nodes with the same hashes.
+    for (auto i = decltype(numNodes){0}; i < numNodes; ++i) {
+        auto* materialNode = materialNodes[i];
+        if (materialNode == nullptr) { continue; }
+        std::vector<_MaterialLink> links;
+        for (const auto& preparedLink : prepared.nodes[i].links) {
+            const auto* input = materialNodes[preparedLink.input];
+            if (input == nullptr) { continue; }
+            links.push_back(
+                {preparedLink.outputName, preparedLink.inputName,
+                 input->node});
         }
-        TF_DEBUG(HDAI_MATERIAL)
-            .Msg("  created node of type %s\n", nodeType.c_str());
-        AiNodeSetStr(ret, nameStr, nodeName);
-        _nodes.emplace(nodeName, ret);
+        if (!acquired[i]) {
+            for (const auto& link : materialNode->links) {
+                if (std::find_if(
+                        links.begin(), links.end(),
+                        [&](const _MaterialLink& l) {
+                            return l.outputName == link.outputName;
+                        }) == links.end()) {
+                    AiNodeUnlink(
+                        materialNode->node, link.outputName.GetText());
+                }
+            }
+            for (const auto& link : links) {
+                if (std::find(
+                        materialNode->links.begin(),
+                        materialNode->links.end(),
+                        link) == materialNode->links.end()) {
+                    _Link(
+                        link.input, link.inputName, materialNode->node,
+                        link.outputName);
+                }
+            }
+        }
+        materialNode->links = std::move(links);
     }
 
-    const auto* nentry = AiNodeGetNodeEntry(ret);
-    for (const auto& param : material.parameters) {
-        const auto& paramName = param.first;
-        const auto* pentry =
-            AiNodeEntryLookUpParameter(nentry, AtString(paramName.GetText()));
-        if (pentry == nullptr) { continue; }
-        HdAiSetParameter(ret, pentry, param.second);
+    // Nodes that dropped out of the network.
+    for (const auto& it : terminal->nodes) {
+        released.push_back(it.second.hash);
+    }
+    terminal->nodes = std::move(nodes);
+    for (const auto hash : released) { shaderCache.Release(hash); }
+
+    auto* terminalNode = prepared.terminal < numNodes &&
+                                 materialNodes[prepared.terminal] != nullptr
+                             ? materialNodes[prepared.terminal]->node
+                             : nullptr;
+    const auto changed = terminalNode != terminal->node;
+    terminal->node = terminalNode;
+    return changed;
+}
+
+AtNode* HdAiMaterial::ReadMaterial(const _PreparedNode& preparedNode) {
+    const auto& material = *preparedNode.material;
+    const auto nodeName = GetNodeName(material.path, preparedNode.hash);
+    const auto nodeType = _GetNodeType(material);
+    TF_DEBUG(HDAI_MATERIAL)
+        .Msg(
+            "HdAiMaterial::ReadMaterial - node %s - type %s\n",
+            nodeName.c_str(), nodeType.c_str());
+    auto* ret = preparedNode.nodeEntry == nullptr
+                    ? nullptr
+                    : AiNode(_delegate->GetUniverse(), nodeType);
+    if (ret == nullptr) {
+        TF_DEBUG(HDAI_MATERIAL)
+            .Msg(
+                "  unable to create node of type %s - aborting\n",
+                nodeType.c_str());
+        return nullptr;
+    }
+    TF_DEBUG(HDAI_MATERIAL)
+        .Msg("  created node of type %s\n", nodeType.c_str());
+    AiNodeSetStr(ret, nameStr, nodeName);
+    for (const auto& value : preparedNode.values) {
+        HdAiSetParameter(ret, value.second);
     }
     return ret;
 }
 
-AtNode* HdAiMaterial::FindMaterial(const SdfPath& path) const {
-    const auto nodeIt = _nodes.find(GetLocalNodeName(path));
-    return nodeIt == _nodes.end() ? nullptr : nodeIt->second;
+bool HdAiMaterial::UpdateMaterial(
+    const _PreparedNode& preparedNode, _MaterialNode* materialNode) {
+    const auto& material = *preparedNode.material;
+    auto* node = materialNode->node;
+    const auto* nentry = AiNodeGetNodeEntry(node);
+    if (nentry != preparedNode.nodeEntry) { return false; }
+    TF_DEBUG(HDAI_MATERIAL)
+        .Msg(
+            "HdAiMaterial::UpdateMaterial - node %s\n", AiNodeGetName(node));
+    // Parameters removed from the network go back to their defaults, which
+    // also removes their links.
+    for (const auto& param : materialNode->parameters) {
+        if (material.parameters.find(param.first) !=
+                material.parameters.end() ||
+            AiNodeEntryLookUpParameter(
+                nentry, AtString(param.first.GetText())) == nullptr) {
+            continue;
+        }
+        AiNodeResetParameter(node, param.first.GetText());
+        materialNode->links.erase(
+            std::remove_if(
+                materialNode->links.begin(), materialNode->links.end(),
+                [&](const _MaterialLink& link) {
+                    return link.outputName == param.first;
+                }),
+            materialNode->links.end());
+    }
+    for (const auto& value : preparedNode.values) {
+        const auto previousIt = materialNode->parameters.find(value.first);
+        if (previousIt != materialNode->parameters.end() &&
+            previousIt->second == material.parameters.at(value.first)) {
+            continue;
+        }
+        HdAiSetParameter(node, value.second);
+    }
+    materialNode->parameters = material.parameters;
+    return true;
 }
 
 AtString HdAiMaterial::GetLocalNodeName(const SdfPath& path) const {
@@ -187,4 +612,12 @@ AtString HdAiMaterial::GetLocalNodeName(const SdfPath& path) const {
     return AtString(p.GetText());
 }
 
+AtString HdAiMaterial::GetNodeName(const SdfPath& path, uint64_t hash) const {
+    return AtString(
+        TfStringPrintf(
+            "%s@%016llx", GetLocalNodeName(path).c_str(),
+            static_cast<unsigned long long>(hash))
+            .c_str());
+}
+
 PXR_NAMESPACE_CLOSE_SCOPE
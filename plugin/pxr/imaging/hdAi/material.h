@@ -20,10 +20,17 @@
 #include <pxr/imaging/hd/material.h>
 
 #include "pxr/imaging/hdAi/renderDelegate.h"
+#include "pxr/imaging/hdAi/utils.h"
 
 #include <ai.h>
 
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -47,24 +54,131 @@ public:
     AtNode* GetSurfaceShader() const;
     HDAI_API
     AtNode* GetDisplacementShader() const;
+    /// Returns the volume shader, or the surface shader if the material has
+    /// no volume network.
+    HDAI_API
+    AtNode* GetVolumeShader() const;
+    /// Returns true if the surface shader is known to be fully opaque. The
+    /// analysis is conservative, linked opacities and unknown shaders are
+    /// not opaque.
+    HDAI_API
+    bool IsOpaque() const;
 
 protected:
+    /// Link from the output of a node to a parameter.
+    struct _MaterialLink {
+        TfToken outputName;
+        TfToken inputName;
+        AtNode* input;
+
+        bool operator==(const _MaterialLink& other) const {
+            return outputName == other.outputName &&
+                   inputName == other.inputName && input == other.input;
+        }
+    };
+
+    /// Arnold node of a material node, shared through the shader cache of
+    /// the render delegate, and the parameters and links last set on it.
+    struct _MaterialNode {
+        AtNode* node = nullptr;
+        uint64_t hash = 0;
+        std::map<TfToken, VtValue> parameters;
+        std::vector<_MaterialLink> links;
+    };
+
+    using _MaterialNodes =
+        std::unordered_map<SdfPath, _MaterialNode, SdfPath::Hash>;
+
+    /// Network of a terminal of the material. Each terminal keeps its own
+    /// nodes, so editing one network leaves the other terminals untouched.
+    struct _Terminal {
+        _MaterialNodes nodes;
+        AtNode* node = nullptr;
+    };
+
+    /// Link of a prepared node, to the prepared node at index @p input.
+    struct _PreparedLink {
+        TfToken outputName;
+        TfToken inputName;
+        size_t input;
+    };
+
+    /// Material node with everything that doesn't need the Arnold nodes
+    /// resolved: its hash, its node entry and its converted parameters.
+    struct _PreparedNode {
+        const HdMaterialNode* material = nullptr;
+        uint64_t hash = 0;
+        const AtNodeEntry* nodeEntry = nullptr;
+        std::vector<std::pair<TfToken, HdAiParameterValue>> values;
+        std::vector<_PreparedLink> links;
+    };
+
+    /// Prepared nodes of the network of a terminal.
+    struct _PreparedNetwork {
+        std::vector<_PreparedNode> nodes;
+        /// Index of the terminal node, the number of nodes if there is none.
+        size_t terminal = 0;
+    };
+
+    /// Networks of a material read from the scene delegate, prepared until
+    /// the material is synced.
+    struct _PreparedMaterial {
+        /// Holds the networks referenced by the prepared nodes.
+        VtValue resource;
+        _PreparedNetwork surface;
+        _PreparedNetwork displacement;
+        _PreparedNetwork volume;
+        bool isOpaque = true;
+    };
+
+    /// Reads the networks of this material, and of all the other materials
+    /// of @p sceneDelegate waiting to be synced, and prepares them in
+    /// parallel. Hydra syncs the materials one at a time, so the syncs only
+    /// create and link the Arnold nodes.
+    HDAI_API
+    void PrepareMaterials(HdSceneDelegate* sceneDelegate);
+
+    /// Resolves everything in @p network that doesn't touch the Arnold
+    /// nodes, safe to call in parallel.
     HDAI_API
-    AtNode* ReadMaterialNetwork(const HdMaterialNetwork& network);
+    static void PrepareMaterialNetwork(
+        const HdMaterialNetwork& network, _PreparedNetwork* prepared);
 
+    /// Applies @p prepared to the Arnold nodes of @p terminal, by diffing it
+    /// against the last network applied. Returns true if the terminal node
+    /// changed.
     HDAI_API
-    AtNode* ReadMaterial(const HdMaterialNode& node);
+    bool ReadMaterialNetwork(
+        const _PreparedNetwork& prepared, _Terminal* terminal);
 
+    /// Creates the node of @p preparedNode, with all its parameters set.
+    /// Returns nullptr if the node can't be created.
     HDAI_API
-    AtNode* FindMaterial(const SdfPath& id) const;
+    AtNode* ReadMaterial(const _PreparedNode& preparedNode);
+
+    /// Updates the node of @p materialNode in place, only setting the
+    /// parameters that changed. Returns false if the type of the node
+    /// changed.
+    HDAI_API
+    bool UpdateMaterial(
+        const _PreparedNode& preparedNode, _MaterialNode* materialNode);
 
     HDAI_API
     AtString GetLocalNodeName(const SdfPath& path) const;
 
-    std::unordered_map<AtString, AtNode*, AtStringHash> _nodes;
+    /// Returns the name of the node of @p path with @p hash. A path can have
+    /// several nodes alive while older versions are still shared with other
+    /// materials, the hash keeps their names unique.
+    HDAI_API
+    AtString GetNodeName(const SdfPath& path, uint64_t hash) const;
+
     HdAiRenderDelegate* _delegate;
-    AtNode* _surface = nullptr;
-    AtNode* _displacement = nullptr;
+    _Terminal _surface;
+    _Terminal _displacement;
+    _Terminal _volume;
+    std::unique_ptr<_PreparedMaterial> _prepared;
+    bool _isOpaque = true;
+    bool _wasSynced = false;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,53 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/materialBindings.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+void HdAiMaterialBindings::Bind(
+    const SdfPath& rprimId, const SdfPath& materialId) {
+    auto& bound = _materials[rprimId];
+    if (bound == materialId && !bound.IsEmpty()) { return; }
+    if (!bound.IsEmpty()) {
+        const auto it = _rprims.find(bound);
+        if (it != _rprims.end()) {
+            it->second.erase(rprimId);
+            if (it->second.empty()) { _rprims.erase(it); }
+        }
+    }
+    bound = materialId;
+    // Rprims without a material use the fallback shader, which never
+    // changes.
+    if (materialId.IsEmpty()) {
+        _materials.erase(rprimId);
+    } else {
+        _rprims[materialId].insert(rprimId);
+    }
+}
+
+void HdAiMaterialBindings::Unbind(const SdfPath& rprimId) {
+    Bind(rprimId, SdfPath::EmptyPath());
+}
+
+void HdAiMaterialBindings::MarkRprimsDirty(
+    const SdfPath& materialId, HdChangeTracker& changeTracker,
+    HdDirtyBits bits) const {
+    const auto it = _rprims.find(materialId);
+    if (it == _rprims.end()) { return; }
+    for (const auto& rprimId : it->second) {
+        changeTracker.MarkRprimDirty(rprimId, bits);
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,67 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_MATERIAL_BINDINGS_H
+#define HDAI_MATERIAL_BINDINGS_H
+
+#include <pxr/pxr.h>
+#include "pxr/imaging/hdAi/api.h"
+
+#include <pxr/imaging/hd/changeTracker.h>
+#include <pxr/usd/sdf/path.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Tracks the material bound to each rprim.
+///
+/// Rprims only read the terminals of their material when their material id
+/// is dirty, so a material that replaced its terminal nodes dirties the
+/// rprims bound to it, instead of every rprim of the render index.
+///
+/// Not thread safe, rprims record their bindings in the node edit journal,
+/// and materials read them while syncing.
+class HdAiMaterialBindings {
+public:
+    HdAiMaterialBindings() = default;
+    ~HdAiMaterialBindings() = default;
+
+    /// Binds @p materialId to @p rprimId, replacing the previous binding.
+    HDAI_API
+    void Bind(const SdfPath& rprimId, const SdfPath& materialId);
+
+    /// Removes the binding of @p rprimId before it's destroyed.
+    HDAI_API
+    void Unbind(const SdfPath& rprimId);
+
+    /// Marks the rprims bound to @p materialId dirty with @p bits.
+    HDAI_API
+    void MarkRprimsDirty(
+        const SdfPath& materialId, HdChangeTracker& changeTracker,
+        HdDirtyBits bits) const;
+
+private:
+    HdAiMaterialBindings(const HdAiMaterialBindings&) = delete;
+    HdAiMaterialBindings& operator=(const HdAiMaterialBindings&) = delete;
+
+    using _PathSet = std::unordered_set<SdfPath, SdfPath::Hash>;
+
+    std::unordered_map<SdfPath, SdfPath, SdfPath::Hash> _materials;
+    std::unordered_map<SdfPath, _PathSet, SdfPath::Hash> _rprims;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_MATERIAL_BINDINGS_H
@@ -13,13 +13,21 @@
 // limitations under the License.
 #include "pxr/imaging/hdAi/mesh.h"
 
+#include <pxr/base/arch/hash.h>
 #include <pxr/base/gf/vec2f.h>
 
+#include <pxr/imaging/hdAi/config.h>
+#include <pxr/imaging/hdAi/instancer.h>
 #include <pxr/imaging/hdAi/material.h>
 #include <pxr/imaging/hdAi/utils.h>
 
 #include <pxr/imaging/pxOsd/tokens.h>
 
+#include "pxr/usd/usdAi/tokens.h"
+
+#include <unordered_set>
+#include <utility>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 TF_DEFINE_PRIVATE_TOKENS(_tokens, (st)(uv));
@@ -41,11 +49,90 @@ const AtString subdiv_type("subdiv_type");
 const AtString catclark("catclark");
 const AtString none("none");
 const AtString subdiv_iterations("subdiv_iterations");
+const AtString subdiv_adaptive_error("subdiv_adaptive_error");
+const AtString subdiv_adaptive_metric("subdiv_adaptive_metric");
+const AtString subdiv_adaptive_space("subdiv_adaptive_space");
+const AtString subdiv_uv_smoothing("subdiv_uv_smoothing");
+const AtString subdiv_smooth_derivs("subdiv_smooth_derivs");
+const AtString disp_padding("disp_padding");
+const AtString disp_height("disp_height");
+const AtString disp_zero_value("disp_zero_value");
+const AtString disp_autobump("disp_autobump");
+const AtString _auto("auto");
+const AtString raster("raster");
 const AtString crease_idxs("crease_idxs");
 const AtString crease_sharpness("crease_sharpness");
+const AtString id("id");
 
 } // namespace Str
 
+using _ShapeParams = std::vector<std::pair<TfToken, AtString>>;
+
+// UsdAiShapeAPI attributes copied as they are to the polymesh.
+const _ShapeParams& _GetShapeParams() {
+    static const _ShapeParams params{
+        {UsdAiTokens->aiSubdiv_adaptive_error, Str::subdiv_adaptive_error},
+        {UsdAiTokens->aiSubdiv_adaptive_metric, Str::subdiv_adaptive_metric},
+        {UsdAiTokens->aiSubdiv_adaptive_space, Str::subdiv_adaptive_space},
+        {UsdAiTokens->aiSubdiv_uv_smoothing, Str::subdiv_uv_smoothing},
+        {UsdAiTokens->aiSubdiv_smooth_derivs, Str::subdiv_smooth_derivs},
+        {UsdAiTokens->aiDisp_padding, Str::disp_padding},
+        {UsdAiTokens->aiDisp_height, Str::disp_height},
+        {UsdAiTokens->aiDisp_zero_value, Str::disp_zero_value},
+        {UsdAiTokens->aiDisp_autobump, Str::disp_autobump},
+    };
+    return params;
+}
+
+using _RayTypes = std::vector<std::pair<TfToken, uint8_t>>;
+
+const _RayTypes& _GetRayTypes() {
+    static const _RayTypes rayTypes{
+        {UsdAiTokens->aiVisibilityCamera, AI_RAY_CAMERA},
+        {UsdAiTokens->aiVisibilityShadow, AI_RAY_SHADOW},
+        {UsdAiTokens->aiVisibilityDiffuse_transmit, AI_RAY_DIFFUSE_TRANSMIT},
+        {UsdAiTokens->aiVisibilitySpecular_transmit,
+         AI_RAY_SPECULAR_TRANSMIT},
+        {UsdAiTokens->aiVisibilityVolume, AI_RAY_VOLUME},
+        {UsdAiTokens->aiVisibilityDiffuse_reflect, AI_RAY_DIFFUSE_REFLECT},
+        {UsdAiTokens->aiVisibilitySpecular_reflect, AI_RAY_SPECULAR_REFLECT},
+        {UsdAiTokens->aiVisibilitySubsurface, AI_RAY_SUBSURFACE},
+    };
+    return rayTypes;
+}
+
+// Shape attributes authored as primvars are not declared as user parameters.
+bool _IsShapeAttribute(const TfToken& name) {
+    using Attributes = std::unordered_set<TfToken, TfToken::HashFunctor>;
+    static const auto attributes = []() -> Attributes {
+        Attributes r{
+            UsdAiTokens->aiSubdiv_type, UsdAiTokens->aiSubdiv_iterations,
+            UsdAiTokens->aiOpaque};
+        for (const auto& param : _GetShapeParams()) { r.insert(param.first); }
+        for (const auto& ray : _GetRayTypes()) { r.insert(ray.first); }
+        return r;
+    }();
+    return attributes.find(name) != attributes.end();
+}
+
+void _SetShapeParam(AtNode* node, const AtString& name, const VtValue& value) {
+    if (value.IsHolding<bool>()) {
+        AiNodeSetBool(node, name, value.UncheckedGet<bool>());
+    } else if (value.IsHolding<float>()) {
+        AiNodeSetFlt(node, name, value.UncheckedGet<float>());
+    } else if (value.IsHolding<double>()) {
+        AiNodeSetFlt(
+            node, name, static_cast<float>(value.UncheckedGet<double>()));
+    } else if (value.IsHolding<TfToken>()) {
+        const auto& token = value.UncheckedGet<TfToken>();
+        // auto can't be used as a token in the schema.
+        AiNodeSetStr(
+            node, name,
+            token == UsdAiTokens->auto_ ? Str::_auto
+                                        : AtString(token.GetText()));
+    }
+}
+
 } // namespace
 
 HdAiMesh::HdAiMesh(
@@ -57,86 +144,134 @@ HdAiMesh::HdAiMesh(
     AiNodeSetByte(_mesh, Str::subdiv_iterations, 0);
 }
 
-HdAiMesh::~HdAiMesh() { AiNodeDestroy(_mesh); }
+HdAiMesh::~HdAiMesh() {
+    _delegate->GetMaterialBindings().Unbind(GetId());
+    _delegate->GetMeshCache().Remove(_mesh);
+    _delegate->GetSubdivBudget().Remove(_mesh);
+    for (auto* instance : _instances) { AiNodeDestroy(instance); }
+    AiNodeDestroy(_mesh);
+}
 
+// Sync is called in parallel for all the rprims, so the scene data is read and
+// converted here, and every change to the Arnold node is recorded in the node
+// edit journal of the render delegate, which is committed on a single thread.
 void HdAiMesh::Sync(
     HdSceneDelegate* delegate, HdRenderParam* renderParam,
     HdDirtyBits* dirtyBits, const TfToken& reprToken) {
-    auto* param = reinterpret_cast<HdAiRenderParam*>(renderParam);
+    TF_UNUSED(renderParam);
+    auto& journal = _delegate->GetNodeEditJournal();
+    auto* mesh = _mesh;
     const auto& id = GetId();
-
+    // With all the geometry uploaded, the polymesh can leave its group in the
+    // mesh cache.
+    const auto isGeometryComplete =
+        HdChangeTracker::IsTopologyDirty(*dirtyBits, id) &&
+        HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points);
+    const auto hasDirtyBits = *dirtyBits != HdChangeTracker::Clean;
+    // The geometry is only hashed for the mesh cache.
+    const auto deduplicate = HdAiConfig::GetInstance().deduplicate_meshes;
+    const auto topologyDirty = HdChangeTracker::IsTopologyDirty(*dirtyBits, id);
+    // Everything the subdivision budget needs to know about the mesh.
+    auto subdivRequestDirty =
+        topologyDirty || HdChangeTracker::IsExtentDirty(*dirtyBits, id) ||
+        HdChangeTracker::IsTransformDirty(*dirtyBits, id);
+
+    const auto shutter = _delegate->GetShutterRange();
+    auto motionChanged = false;
     if (HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points)) {
-        param->End();
-        constexpr size_t maxSamples = 2;
-        HdTimeSampleArray<VtValue, maxSamples> xf;
-        delegate->SamplePrimvar(id, HdTokens->points, &xf);
-        if (xf.count > 0 &&
-            ARCH_LIKELY(xf.values[0].IsHolding<VtVec3fArray>())) {
-            const auto& v0 = xf.values[0].Get<VtVec3fArray>();
-            if (xf.count > 1 &&
-                ARCH_UNLIKELY(!xf.values[1].IsHolding<VtVec3fArray>())) {
-                xf.count = 1;
-            }
-            auto* arr = AiArrayAllocate(v0.size(), xf.count, AI_TYPE_VECTOR);
-            AiArraySetKey(arr, 0, v0.data());
-            if (xf.count > 1) {
-                const auto& v1 = xf.values[1].Get<VtVec3fArray>();
-                if (ARCH_LIKELY(v1.size() == v0.size())) {
-                    AiArraySetKey(arr, 1, v1.data());
-                } else {
-                    AiArraySetKey(arr, 1, v0.data());
-                }
-            }
-            AiNodeSetArray(_mesh, Str::vlist, arr);
+        auto* vlist =
+            HdAiConvertPoints(delegate, id, HdTokens->points, shutter);
+        if (vlist != nullptr) {
+            motionChanged = true;
+            if (deduplicate) { _pointsHash = HdAiHashArray(vlist); }
+            journal.Record(
+                [mesh, vlist]() { AiNodeSetArray(mesh, Str::vlist, vlist); });
         }
     }
 
+    if (*dirtyBits & HdChangeTracker::DirtyPrimID) {
+        // The id is offset by one, so the background maps to -1 in the
+        // primId AOV.
+        const auto primId = static_cast<unsigned int>(GetPrimId()) + 1;
+        journal.Record(
+            [mesh, primId]() { AiNodeSetUInt(mesh, Str::id, primId); });
+    }
+
+    auto visibilityChanged = false;
     if (HdChangeTracker::IsVisibilityDirty(*dirtyBits, id)) {
         _UpdateVisibility(delegate, dirtyBits);
-        AiNodeSetByte(
-            _mesh, Str::visibility,
-            _sharedData.visible ? AI_RAY_ALL : uint8_t(0));
+        visibilityChanged = true;
     }
 
-    if (HdChangeTracker::IsTopologyDirty(*dirtyBits, id)) {
-        param->End();
-        const auto topology = GetMeshTopology(delegate);
-        const auto& vertexCounts = topology.GetFaceVertexCounts();
-        const auto& vertexIndices = topology.GetFaceVertexIndices();
-        const auto numFaces = topology.GetNumFaces();
-        const auto numVertexIndices = vertexIndices.size();
-        auto* nsides = AiArrayAllocate(numFaces, 1, AI_TYPE_UINT);
-        auto* vidxs = AiArrayAllocate(vertexIndices.size(), 1, AI_TYPE_UINT);
-        for (auto i = decltype(numFaces){0}; i < numFaces; ++i) {
-            AiArraySetUInt(
-                nsides, i, static_cast<unsigned int>(vertexCounts[i]));
+    // The topology is needed by the vertex interpolated uvs as well, so it's
+    // only queried once.
+    HdMeshTopology topology;
+    auto topologyQueried = false;
+    auto getTopology = [&]() -> const HdMeshTopology& {
+        if (!topologyQueried) {
+            topology = GetMeshTopology(delegate);
+            topologyQueried = true;
         }
-        for (auto i = decltype(numVertexIndices){0}; i < numVertexIndices;
-             ++i) {
-            AiArraySetUInt(
-                vidxs, i, static_cast<unsigned int>(vertexIndices[i]));
-        }
-        AiNodeSetArray(_mesh, Str::nsides, nsides);
-        AiNodeSetArray(_mesh, Str::vidxs, vidxs);
-        const auto scheme = topology.GetScheme();
-        if (scheme == PxOsdOpenSubdivTokens->catmullClark ||
-            scheme == PxOsdOpenSubdivTokens->catmark) {
-            AiNodeSetStr(_mesh, Str::subdiv_type, Str::catclark);
-        } else {
-            AiNodeSetStr(_mesh, Str::subdiv_type, Str::none);
+        return topology;
+    };
+
+    if (topologyDirty) {
+        auto* nsides =
+            HdAiConvertIndices(getTopology().GetFaceVertexCounts());
+        auto* vidxs = HdAiConvertIndices(getTopology().GetFaceVertexIndices());
+        if (deduplicate) {
+            _topologyHash = HdAiHashArray(vidxs, HdAiHashArray(nsides));
         }
+        _subdivRequest.numFaces = getTopology().GetNumFaces();
+        _subdivRequest.numFaceVertices =
+            getTopology().GetFaceVertexIndices().size();
+        journal.Record([mesh, nsides, vidxs]() {
+            AiNodeSetArray(mesh, Str::nsides, nsides);
+            AiNodeSetArray(mesh, Str::vidxs, vidxs);
+        });
     }
 
-    if (HdChangeTracker::IsDisplayStyleDirty(*dirtyBits, id)) {
-        const auto displayStyle = GetDisplayStyle(delegate);
-        AiNodeSetByte(
-            _mesh, Str::subdiv_iterations,
-            static_cast<uint8_t>(std::max(0, displayStyle.refineLevel)));
+    auto shapeSynced = false;
+    auto rayVisibilityChanged = false;
+    // The UsdAiShapeAPI attributes are either authored as primvars, or
+    // returned by the scene delegate from the attributes of the prim. They
+    // don't have dirty bits of their own, editing them dirties the primvars.
+    if (topologyDirty || HdChangeTracker::IsDisplayStyleDirty(*dirtyBits, id) ||
+        (*dirtyBits & HdChangeTracker::DirtyPrimvar)) {
+        const auto rayVisibility = _rayVisibility;
+        _SyncShape(delegate, journal, getTopology().GetScheme());
+        shapeSynced = true;
+        rayVisibilityChanged = rayVisibility != _rayVisibility;
+        subdivRequestDirty = true;
+        visibilityChanged = true;
+    }
+
+    // The prototype of an instancer is only rendered through its instances,
+    // which get the ray visibility instead.
+    if (visibilityChanged) {
+        const auto visibility =
+            _sharedData.visible && GetInstancerId().IsEmpty() ? _rayVisibility
+                                                              : uint8_t(0);
+        journal.Record([mesh, visibility]() {
+            AiNodeSetByte(mesh, Str::visibility, visibility);
+        });
+    }
+
+    if (HdChangeTracker::IsExtentDirty(*dirtyBits, id)) {
+        _subdivRequest.extent = delegate->GetExtent(id);
     }
 
     if (HdChangeTracker::IsTransformDirty(*dirtyBits, id)) {
-        param->End();
-        HdAiSetTransform(_mesh, delegate, GetId());
+        motionChanged = true;
+        _subdivRequest.transform = delegate->GetTransform(id);
+        auto* matrices = HdAiConvertTransform(delegate, id, shutter);
+        journal.Record(
+            [mesh, matrices]() { AiNodeSetArray(mesh, "matrix", matrices); });
+    }
+
+    if (motionChanged) {
+        journal.Record(
+            [mesh, shutter]() { HdAiSetMotionRange(mesh, shutter); });
     }
 
     if (HdChangeTracker::IsSubdivTagsDirty(*dirtyBits, id)) {
@@ -163,113 +298,362 @@ void HdAiMesh::Sync(
         auto* creaseSharpness =
             AiArrayAllocate(craseSharpnessCount, 1, AI_TYPE_FLOAT);
 
-        uint32_t ii = 0;
-        for (auto cornerIndex : cornerIndices) {
-            AiArraySetUInt(creaseIdxs, ii * 2, cornerIndex);
-            AiArraySetUInt(creaseIdxs, ii * 2 + 1, cornerIndex);
-            AiArraySetFlt(creaseSharpness, ii, cornerWeights[ii]);
-            ++ii;
-        }
+        if (craseSharpnessCount > 0) {
+            auto* idxs = static_cast<uint32_t*>(AiArrayMap(creaseIdxs));
+            auto* sharpness = static_cast<float*>(AiArrayMap(creaseSharpness));
+            uint32_t ii = 0;
+            for (auto cornerIndex : cornerIndices) {
+                idxs[ii * 2] = cornerIndex;
+                idxs[ii * 2 + 1] = cornerIndex;
+                sharpness[ii] = cornerWeights[ii];
+                ++ii;
+            }
 
-        uint32_t jj = 0;
-        for (auto creaseLength : creaseLengths) {
-            for (auto k = decltype(creaseLength){1}; k < creaseLength;
-                 ++k, ++ii) {
-                AiArraySetUInt(creaseIdxs, ii * 2, creaseIndices[jj + k - 1]);
-                AiArraySetUInt(creaseIdxs, ii * 2 + 1, creaseIndices[jj + k]);
-                AiArraySetFlt(creaseSharpness, ii, creaseWeights[jj]);
+            uint32_t jj = 0;
+            for (auto creaseLength : creaseLengths) {
+                for (auto k = decltype(creaseLength){1}; k < creaseLength;
+                     ++k, ++ii) {
+                    idxs[ii * 2] = creaseIndices[jj + k - 1];
+                    idxs[ii * 2 + 1] = creaseIndices[jj + k];
+                    sharpness[ii] = creaseWeights[jj];
+                }
+                jj += creaseLength;
             }
-            jj += creaseLength;
+            AiArrayUnmap(creaseIdxs);
+            AiArrayUnmap(creaseSharpness);
         }
 
-        AiNodeSetArray(_mesh, Str::crease_idxs, creaseIdxs);
-        AiNodeSetArray(_mesh, Str::crease_sharpness, creaseSharpness);
+        if (deduplicate) {
+            _subdivTagsHash =
+                HdAiHashArray(creaseSharpness, HdAiHashArray(creaseIdxs));
+        }
+        journal.Record([mesh, creaseIdxs, creaseSharpness]() {
+            AiNodeSetArray(mesh, Str::crease_idxs, creaseIdxs);
+            AiNodeSetArray(mesh, Str::crease_sharpness, creaseSharpness);
+        });
     }
 
     if (*dirtyBits & HdChangeTracker::DirtyMaterialId) {
-        param->End();
+        // Sprims are synced before rprims, so the material is up to date.
+        const auto materialId = delegate->GetMaterialId(id);
         const auto* material = reinterpret_cast<const HdAiMaterial*>(
             delegate->GetRenderIndex().GetSprim(
-                HdPrimTypeTokens->material, delegate->GetMaterialId(id)));
-        if (material != nullptr) {
-            AiNodeSetPtr(_mesh, Str::shader, material->GetSurfaceShader());
-            AiNodeSetPtr(
-                _mesh, Str::disp_map, material->GetDisplacementShader());
-            // TODO: We need a way to detect this.
-            AiNodeSetBool(_mesh, Str::opaque, false);
-        } else {
-            AiNodeSetPtr(_mesh, Str::shader, _delegate->GetFallbackShader());
-            AiNodeSetPtr(_mesh, Str::disp_map, nullptr);
+                HdPrimTypeTokens->material, materialId));
+        auto* bindings = &_delegate->GetMaterialBindings();
+        journal.Record([bindings, id, materialId]() {
+            bindings->Bind(id, materialId);
+        });
+        auto* surface = material != nullptr ? material->GetSurfaceShader()
+                                            : _delegate->GetFallbackShader();
+        auto* displacement =
+            material != nullptr ? material->GetDisplacementShader() : nullptr;
+        // The material id is dirtied when any terminal of the material
+        // changes, only the terminals that changed are set, so the mesh is
+        // not tessellated again for a new surface.
+        if (surface != _surface) {
+            _surface = surface;
+            journal.Record([mesh, surface]() {
+                AiNodeSetPtr(mesh, Str::shader, surface);
+            });
+        }
+        if (displacement != _displacement) {
+            _displacement = displacement;
+            subdivRequestDirty = true;
+            journal.Record([mesh, displacement]() {
+                AiNodeSetPtr(mesh, Str::disp_map, displacement);
+            });
         }
+        _isMaterialOpaque = material == nullptr || material->IsOpaque();
+    }
+
+    // Same as the UsdAiShapeAPI attributes, editing ai:opaque dirties the
+    // primvars.
+    if (topologyDirty || (*dirtyBits & HdChangeTracker::DirtyPrimvar)) {
+        const auto opaqueValue = delegate->Get(id, UsdAiTokens->aiOpaque);
+        _hasOpaqueOverride = opaqueValue.IsHolding<bool>();
+        _opaqueOverride =
+            _hasOpaqueOverride && opaqueValue.UncheckedGet<bool>();
+    }
+
+    // Opaque meshes skip their shaders for shadow and transparency rays.
+    const auto isOpaque =
+        _hasOpaqueOverride ? _opaqueOverride : _isMaterialOpaque;
+    const auto opacityChanged = isOpaque != _isOpaque;
+    if (opacityChanged) {
+        _isOpaque = isOpaque;
+        journal.Record([mesh, isOpaque]() {
+            AiNodeSetBool(mesh, Str::opaque, isOpaque);
+        });
     }
 
     // TODO: Implement all the primvars.
-    if (*dirtyBits & HdChangeTracker::DirtyPrimvar) {
-        param->End();
-        for (const auto& primvar : delegate->GetPrimvarDescriptors(
-                 id, HdInterpolation::HdInterpolationConstant)) {
-            HdAiSetConstantPrimvar(_mesh, id, delegate, primvar);
+    // Vertex uvs and collapsed face-varying primvars are indexed with the
+    // vertex indices, so everything is uploaded again when the topology
+    // changes. The entries are kept, so the primvars removed in the same
+    // sync are still reset.
+    if (topologyDirty) {
+        for (auto& primvar : _primvars) {
+            primvar.second.interpolation = HdInterpolationCount;
         }
-        for (const auto& primvar : delegate->GetPrimvarDescriptors(
-                 id, HdInterpolation::HdInterpolationUniform)) {
-            HdAiSetUniformPrimvar(_mesh, id, delegate, primvar);
-        }
-        for (const auto& primvar : delegate->GetPrimvarDescriptors(
-                 id, HdInterpolation::HdInterpolationVertex)) {
-            if (primvar.name == HdTokens->points) {
-                continue;
-            } else if (
-                primvar.name == _tokens->st || primvar.name == _tokens->uv) {
-                const auto v = delegate->Get(id, primvar.name);
-                if (v.IsHolding<VtArray<GfVec2f>>()) {
-                    const auto& uv = v.UncheckedGet<VtArray<GfVec2f>>();
-                    const auto numUVs = static_cast<unsigned int>(uv.size());
-                    // Can assume uvs are flattened, with indices matching
-                    // vert indices
-                    auto* uvlist =
-                        AiArrayConvert(numUVs, 1, AI_TYPE_VECTOR2, uv.data());
-                    auto* uvidxs =
-                        AiArrayCopy(AiNodeGetArray(_mesh, Str::vidxs));
-
-                    AiNodeSetArray(_mesh, Str::uvlist, uvlist);
-                    AiNodeSetArray(_mesh, Str::uvidxs, uvidxs);
+    }
+    if (topologyDirty || (*dirtyBits & HdChangeTracker::DirtyPrimvar)) {
+        for (auto& primvar : _primvars) { primvar.second.authored = false; }
+        for (const auto interpolation :
+             {HdInterpolationConstant, HdInterpolationUniform,
+              HdInterpolationVertex, HdInterpolationFaceVarying}) {
+            for (const auto& primvar :
+                 delegate->GetPrimvarDescriptors(id, interpolation)) {
+                if (primvar.name == HdTokens->points ||
+                    (interpolation == HdInterpolationConstant &&
+                     _IsShapeAttribute(primvar.name))) {
+                    continue;
                 }
-
-            } else {
-                HdAiSetVertexPrimvar(_mesh, id, delegate, primvar);
+                auto value = delegate->Get(id, primvar.name);
+                auto& entry = _primvars[primvar.name];
+                entry.authored = true;
+                // Hashing is cheaper than converting and uploading the data,
+                // and keeping the hash doesn't hold on to the buffers of the
+                // scene delegate.
+                const auto hash = value.GetHash();
+                const auto numElements = value.GetArraySize();
+                if (entry.interpolation == interpolation &&
+                    entry.role == primvar.role && !value.IsEmpty() &&
+                    entry.hash == hash && entry.numElements == numElements) {
+                    continue;
+                }
+                entry.interpolation = interpolation;
+                entry.role = primvar.role;
+                entry.hash = hash;
+                entry.numElements = numElements;
+                _SetPrimvar(journal, primvar, interpolation, value, [&]() {
+                    return getTopology().GetFaceVertexIndices();
+                });
             }
         }
-        for (const auto& primvar : delegate->GetPrimvarDescriptors(
-                 id, HdInterpolation::HdInterpolationFaceVarying)) {
-            if (primvar.name == _tokens->st || primvar.name == _tokens->uv) {
-                const auto v = delegate->Get(id, primvar.name);
-                if (v.IsHolding<VtArray<GfVec2f>>()) {
-                    const auto& uv = v.UncheckedGet<VtArray<GfVec2f>>();
-                    const auto numUVs = static_cast<unsigned int>(uv.size());
-                    // Same memory layout and this data is flattened.
-                    auto* uvlist =
-                        AiArrayConvert(numUVs, 1, AI_TYPE_VECTOR2, uv.data());
-                    auto* uvidxs = AiArrayAllocate(numUVs, 1, AI_TYPE_UINT);
-                    for (auto i = decltype(numUVs){0}; i < numUVs; ++i) {
-                        AiArraySetUInt(uvidxs, i, i);
-                    }
-                    AiNodeSetArray(_mesh, Str::uvlist, uvlist);
-                    AiNodeSetArray(_mesh, Str::uvidxs, uvidxs);
-                }
+        for (auto it = _primvars.begin(); it != _primvars.end();) {
+            if (it->second.authored) {
+                ++it;
+                continue;
+            }
+            if (it->first == _tokens->st || it->first == _tokens->uv) {
+                journal.Record([mesh]() {
+                    AiNodeResetParameter(mesh, Str::uvlist);
+                    AiNodeResetParameter(mesh, Str::uvidxs);
+                });
             } else {
-                HdAiSetFaceVaryingPrimvar(_mesh, id, delegate, primvar);
+                HdAiRemovePrimvar(journal, mesh, it->first);
             }
+            it = _primvars.erase(it);
+        }
+    }
+
+    const auto& instancerId = GetInstancerId();
+    if (subdivRequestDirty) {
+        auto* subdivBudget = &_delegate->GetSubdivBudget();
+        // The instances are spread over the screen, only the polymesh itself
+        // has a known size.
+        if (_isSubdivided && instancerId.IsEmpty()) {
+            _subdivRequest.displaced = _displacement != nullptr;
+            const auto request = _subdivRequest;
+            journal.Record([subdivBudget, mesh, request, shapeSynced]() {
+                subdivBudget->Update(mesh, request, shapeSynced);
+            });
+        } else {
+            journal.Record(
+                [subdivBudget, mesh]() { subdivBudget->Remove(mesh); });
         }
     }
 
+    // The ginstances copy the opacity of the polymesh, and use its ray
+    // visibility.
+    HdAiSyncInstances(
+        delegate, id, instancerId, *dirtyBits, mesh,
+        _sharedData.visible ? _rayVisibility : uint8_t(0), &_instances,
+        opacityChanged || rayVisibilityChanged);
+
+    // Instanced meshes already share their geometry.
+    if (hasDirtyBits && instancerId.IsEmpty() && deduplicate) {
+        auto* meshCache = &_delegate->GetMeshCache();
+        auto* universe = _delegate->GetUniverse();
+        const auto geometryHash = _GetGeometryHash();
+        journal.Record([meshCache, mesh, id, geometryHash, isGeometryComplete,
+                        universe]() {
+            meshCache->Update(
+                mesh, id, geometryHash, isGeometryComplete, universe);
+        });
+    }
+
     *dirtyBits = HdChangeTracker::Clean;
 }
 
+uint64_t HdAiMesh::_GetGeometryHash() const {
+    // Xor keeps the hash of the primvars independent of the order of the map.
+    uint64_t primvarsHash = 0;
+    for (const auto& primvar : _primvars) {
+        if (primvar.second.interpolation == HdInterpolationConstant) {
+            continue;
+        }
+        const uint64_t data[] = {
+            primvar.first.Hash(), primvar.second.role.Hash(),
+            primvar.second.hash,
+            static_cast<uint64_t>(primvar.second.interpolation)};
+        primvarsHash ^=
+            ArchHash64(reinterpret_cast<const char*>(data), sizeof(data));
+    }
+    const uint64_t data[] = {
+        _pointsHash,
+        _topologyHash,
+        _subdivTagsHash,
+        _shapeHash,
+        static_cast<uint64_t>(reinterpret_cast<uintptr_t>(_displacement)),
+        primvarsHash};
+    const auto hash =
+        ArchHash64(reinterpret_cast<const char*>(data), sizeof(data));
+    // Zero is used by the cache for meshes without a group.
+    return hash == 0 ? 1 : hash;
+}
+
+void HdAiMesh::_SyncShape(
+    HdSceneDelegate* delegate, HdAiNodeEditJournal& journal,
+    const TfToken& scheme) {
+    auto* mesh = _mesh;
+    const auto& id = GetId();
+    auto subdivType = scheme == PxOsdOpenSubdivTokens->catmullClark ||
+                              scheme == PxOsdOpenSubdivTokens->catmark
+                          ? Str::catclark
+                          : Str::none;
+    const auto subdivTypeValue = delegate->Get(id, UsdAiTokens->aiSubdiv_type);
+    if (subdivTypeValue.IsHolding<TfToken>()) {
+        subdivType =
+            AtString(subdivTypeValue.UncheckedGet<TfToken>().GetText());
+    }
+    // Authored iterations override the refine level of the viewport.
+    auto iterations = GetDisplayStyle(delegate).refineLevel;
+    const auto iterationsValue = VtValue::Cast<int>(
+        delegate->Get(id, UsdAiTokens->aiSubdiv_iterations));
+    if (!iterationsValue.IsEmpty()) {
+        iterations = iterationsValue.UncheckedGet<int>();
+    }
+    iterations = std::min(std::max(0, iterations), 255);
+
+    std::vector<uint64_t> hashes{
+        subdivType.hash(), static_cast<uint64_t>(iterations)};
+    std::vector<std::pair<AtString, VtValue>> params;
+    std::vector<AtString> resetParams;
+    _subdivRequest.adaptiveError = 0.0f;
+    _subdivRequest.adaptiveSpace = Str::raster;
+    for (const auto& param : _GetShapeParams()) {
+        const auto value = delegate->Get(id, param.first);
+        if (value.IsEmpty()) {
+            resetParams.push_back(param.second);
+            continue;
+        }
+        hashes.push_back(value.GetHash());
+        params.emplace_back(param.second, value);
+        if (param.second == Str::subdiv_adaptive_error &&
+            value.IsHolding<float>()) {
+            _subdivRequest.adaptiveError = value.UncheckedGet<float>();
+        } else if (
+            param.second == Str::subdiv_adaptive_space &&
+            value.IsHolding<TfToken>()) {
+            _subdivRequest.adaptiveSpace =
+                AtString(value.UncheckedGet<TfToken>().GetText());
+        }
+    }
+    _shapeHash = ArchHash64(
+        reinterpret_cast<const char*>(hashes.data()),
+        hashes.size() * sizeof(uint64_t));
+    _subdivRequest.iterations = static_cast<uint8_t>(iterations);
+    _isSubdivided = subdivType != Str::none && iterations > 0;
+
+    _rayVisibility = AI_RAY_ALL;
+    for (const auto& rayType : _GetRayTypes()) {
+        const auto value = delegate->Get(id, rayType.first);
+        if (value.IsHolding<bool>() && !value.UncheckedGet<bool>()) {
+            _rayVisibility &= ~rayType.second;
+        }
+    }
+
+    const auto subdivIterations = _subdivRequest.iterations;
+    journal.Record(
+        [mesh, subdivType, subdivIterations, params, resetParams]() {
+            AiNodeSetStr(mesh, Str::subdiv_type, subdivType);
+            AiNodeSetByte(mesh, Str::subdiv_iterations, subdivIterations);
+            for (const auto& param : resetParams) {
+                AiNodeResetParameter(mesh, param.c_str());
+            }
+            for (const auto& param : params) {
+                _SetShapeParam(mesh, param.first, param.second);
+            }
+        });
+}
+
+void HdAiMesh::_SetPrimvar(
+    HdAiNodeEditJournal& journal, const HdPrimvarDescriptor& primvar,
+    HdInterpolation interpolation, const VtValue& value,
+    const std::function<VtIntArray()>& getVertexIndices) {
+    auto* mesh = _mesh;
+    if (interpolation == HdInterpolationConstant) {
+        HdAiSetConstantPrimvar(journal, mesh, primvar, value);
+    } else if (interpolation == HdInterpolationUniform) {
+        HdAiSetUniformPrimvar(journal, mesh, primvar, value);
+    } else if (interpolation == HdInterpolationVertex) {
+        if (primvar.name == _tokens->st || primvar.name == _tokens->uv) {
+            if (value.IsHolding<VtArray<GfVec2f>>()) {
+                const auto& uv = value.UncheckedGet<VtArray<GfVec2f>>();
+                const auto numUVs = static_cast<unsigned int>(uv.size());
+                // Can assume uvs are flattened, with indices matching
+                // vert indices. The indices are taken from the topology,
+                // because the node can't be read before the journal is
+                // committed.
+                auto* uvlist =
+                    AiArrayConvert(numUVs, 1, AI_TYPE_VECTOR2, uv.data());
+                auto* uvidxs = HdAiConvertIndices(getVertexIndices());
+                journal.Record([mesh, uvlist, uvidxs]() {
+                    AiNodeSetArray(mesh, Str::uvlist, uvlist);
+                    AiNodeSetArray(mesh, Str::uvidxs, uvidxs);
+                });
+            }
+        } else {
+            HdAiSetVertexPrimvar(journal, mesh, primvar, value);
+        }
+    } else if (interpolation == HdInterpolationFaceVarying) {
+        const auto vertexIndices = getVertexIndices();
+        if (primvar.name == _tokens->st || primvar.name == _tokens->uv) {
+            if (value.IsHolding<VtArray<GfVec2f>>()) {
+                // This data is flattened, uvs without seams are stored
+                // per vertex and indexed like the vertices.
+                VtValue collapsed;
+                const auto isCollapsed =
+                    HdAiCollapseFaceVarying(value, vertexIndices, &collapsed);
+                const auto& uv = (isCollapsed ? collapsed : value)
+                                     .UncheckedGet<VtArray<GfVec2f>>();
+                const auto numUVs = static_cast<unsigned int>(uv.size());
+                // Same memory layout.
+                auto* uvlist =
+                    AiArrayConvert(numUVs, 1, AI_TYPE_VECTOR2, uv.data());
+                auto* uvidxs = isCollapsed ? HdAiConvertIndices(vertexIndices)
+                                           : HdAiGenerateIdxs(numUVs);
+                journal.Record([mesh, uvlist, uvidxs]() {
+                    AiNodeSetArray(mesh, Str::uvlist, uvlist);
+                    AiNodeSetArray(mesh, Str::uvidxs, uvidxs);
+                });
+            }
+        } else {
+            HdAiSetFaceVaryingPrimvar(
+                journal, mesh, primvar, value, &vertexIndices);
+        }
+    }
+}
+
 HdDirtyBits HdAiMesh::GetInitialDirtyBitsMask() const {
     return HdChangeTracker::Clean | HdChangeTracker::InitRepr |
            HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyTopology |
            HdChangeTracker::DirtyTransform | HdChangeTracker::DirtyMaterialId |
-           HdChangeTracker::DirtyPrimvar | HdChangeTracker::DirtyVisibility;
+           HdChangeTracker::DirtyPrimvar | HdChangeTracker::DirtyVisibility |
+           HdChangeTracker::DirtyPrimID | HdChangeTracker::DirtyInstancer |
+           HdChangeTracker::DirtyInstanceIndex |
+           HdChangeTracker::DirtyDisplayStyle | HdChangeTracker::DirtyExtent;
 }
 
 HdDirtyBits HdAiMesh::_PropagateDirtyBits(HdDirtyBits bits) const {
@@ -23,6 +23,11 @@
 
 #include <ai.h>
 
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdAiMesh : public HdMesh {
@@ -50,8 +55,54 @@ protected:
     HDAI_API
     void _InitRepr(const TfToken& reprToken, HdDirtyBits* dirtyBits) override;
 
+    /// Converts a primvar that changed since the last sync.
+    void _SetPrimvar(
+        HdAiNodeEditJournal& journal, const HdPrimvarDescriptor& primvar,
+        HdInterpolation interpolation, const VtValue& value,
+        const std::function<VtIntArray()>& getVertexIndices);
+
+    /// Converts the UsdAiShapeAPI attributes of the mesh.
+    void _SyncShape(
+        HdSceneDelegate* delegate, HdAiNodeEditJournal& journal,
+        const TfToken& scheme);
+
+    /// Returns the hash used to find meshes with the same geometry.
+    uint64_t _GetGeometryHash() const;
+
+    /// Hash and size of the last value uploaded for each primvar.
+    struct _PrimvarEntry {
+        TfToken role;
+        size_t hash = 0;
+        size_t numElements = 0;
+        HdInterpolation interpolation = HdInterpolationCount;
+        bool authored = false;
+    };
+
     HdAiRenderDelegate* _delegate;
     AtNode* _mesh;
+    std::unordered_map<TfToken, _PrimvarEntry, TfToken::HashFunctor>
+        _primvars;
+    // Hashes of the geometry uploaded so far.
+    uint64_t _pointsHash = 0;
+    uint64_t _topologyHash = 0;
+    uint64_t _subdivTagsHash = 0;
+    uint64_t _shapeHash = 0;
+    // Terminals of the material set on the polymesh.
+    const AtNode* _surface = nullptr;
+    const AtNode* _displacement = nullptr;
+    // Settings passed to the subdivision budget.
+    HdAiSubdivRequest _subdivRequest;
+    // Opacity authored on the prim, overriding the analysis of the material.
+    bool _hasOpaqueOverride = false;
+    bool _opaqueOverride = true;
+    bool _isMaterialOpaque = true;
+    // Opacity set on the polymesh.
+    bool _isOpaque = true;
+    // Rays the mesh is visible to, when it's visible.
+    uint8_t _rayVisibility = AI_RAY_ALL;
+    bool _isSubdivided = false;
+    // Ginstances of the polymesh, one per instance of the instancer.
+    std::vector<AtNode*> _instances;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
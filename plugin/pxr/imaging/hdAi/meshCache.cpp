@@ -0,0 +1,277 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/meshCache.h"
+
+#include <pxr/base/tf/stringUtils.h>
+
+#include <algorithm>
+#include <string>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace {
+namespace Str {
+const AtString ginstance("ginstance");
+const AtString name("name");
+const AtString node("node");
+const AtString inherit_xform("inherit_xform");
+const AtString matrix("matrix");
+const AtString motion_start("motion_start");
+const AtString motion_end("motion_end");
+const AtString visibility("visibility");
+const AtString id("id");
+const AtString shader("shader");
+const AtString opaque("opaque");
+const AtString vlist("vlist");
+const AtString nsides("nsides");
+const AtString vidxs("vidxs");
+const AtString uvlist("uvlist");
+const AtString uvidxs("uvidxs");
+} // namespace Str
+
+const char* _GetTypeName(uint8_t type) {
+    switch (type) {
+        case AI_TYPE_BOOLEAN: return "BOOL";
+        case AI_TYPE_BYTE: return "BYTE";
+        case AI_TYPE_INT: return "INT";
+        case AI_TYPE_UINT: return "UINT";
+        case AI_TYPE_FLOAT: return "FLOAT";
+        case AI_TYPE_RGB: return "RGB";
+        case AI_TYPE_RGBA: return "RGBA";
+        case AI_TYPE_VECTOR: return "VECTOR";
+        case AI_TYPE_VECTOR2: return "VECTOR2";
+        case AI_TYPE_STRING: return "STRING";
+        case AI_TYPE_MATRIX: return "MATRIX";
+        default: return nullptr;
+    }
+}
+
+// Copies a constant user parameter from the polymesh to its ginstance.
+void _CopyConstantUserParam(
+    const AtNode* from, AtNode* to, const AtUserParamEntry* entry) {
+    const auto* name = AiUserParamGetName(entry);
+    const auto type = AiUserParamGetType(entry);
+    if (AiNodeLookUpUserParameter(to, name) == nullptr) {
+        const auto* typeName = _GetTypeName(
+            type == AI_TYPE_ARRAY ? AiUserParamGetArrayType(entry) : type);
+        if (typeName == nullptr) { return; }
+        const auto declaration = type == AI_TYPE_ARRAY
+                                     ? std::string("constant ARRAY ") + typeName
+                                     : std::string("constant ") + typeName;
+        if (!AiNodeDeclare(to, name, declaration.c_str())) { return; }
+    }
+    switch (type) {
+        case AI_TYPE_BOOLEAN:
+            AiNodeSetBool(to, name, AiNodeGetBool(from, name));
+            break;
+        case AI_TYPE_BYTE:
+            AiNodeSetByte(to, name, AiNodeGetByte(from, name));
+            break;
+        case AI_TYPE_INT:
+            AiNodeSetInt(to, name, AiNodeGetInt(from, name));
+            break;
+        case AI_TYPE_UINT:
+            AiNodeSetUInt(to, name, AiNodeGetUInt(from, name));
+            break;
+        case AI_TYPE_FLOAT:
+            AiNodeSetFlt(to, name, AiNodeGetFlt(from, name));
+            break;
+        case AI_TYPE_RGB: {
+            const auto v = AiNodeGetRGB(from, name);
+            AiNodeSetRGB(to, name, v.r, v.g, v.b);
+        } break;
+        case AI_TYPE_RGBA: {
+            const auto v = AiNodeGetRGBA(from, name);
+            AiNodeSetRGBA(to, name, v.r, v.g, v.b, v.a);
+        } break;
+        case AI_TYPE_VECTOR: {
+            const auto v = AiNodeGetVec(from, name);
+            AiNodeSetVec(to, name, v.x, v.y, v.z);
+        } break;
+        case AI_TYPE_VECTOR2: {
+            const auto v = AiNodeGetVec2(from, name);
+            AiNodeSetVec2(to, name, v.x, v.y);
+        } break;
+        case AI_TYPE_STRING:
+            AiNodeSetStr(to, name, AiNodeGetStr(from, name));
+            break;
+        case AI_TYPE_MATRIX:
+            AiNodeSetMatrix(to, name, AiNodeGetMatrix(from, name));
+            break;
+        case AI_TYPE_ARRAY:
+            AiNodeSetArray(to, name, AiArrayCopy(AiNodeGetArray(from, name)));
+            break;
+        default: break;
+    }
+}
+
+// Copies the per prim parameters of the polymesh to its ginstance.
+void _SyncInstance(const AtNode* polymesh, AtNode* instance) {
+    AiNodeSetArray(
+        instance, Str::matrix,
+        AiArrayCopy(AiNodeGetArray(polymesh, Str::matrix)));
+    AiNodeSetFlt(
+        instance, Str::motion_start, AiNodeGetFlt(polymesh, Str::motion_start));
+    AiNodeSetFlt(
+        instance, Str::motion_end, AiNodeGetFlt(polymesh, Str::motion_end));
+    AiNodeSetByte(
+        instance, Str::visibility, AiNodeGetByte(polymesh, Str::visibility));
+    AiNodeSetUInt(instance, Str::id, AiNodeGetUInt(polymesh, Str::id));
+    AiNodeSetPtr(instance, Str::shader, AiNodeGetPtr(polymesh, Str::shader));
+    AiNodeSetBool(instance, Str::opaque, AiNodeGetBool(polymesh, Str::opaque));
+
+    // Constant primvars removed from the polymesh are removed from the
+    // ginstance too.
+    std::vector<std::string> removed;
+    auto* iter = AiNodeGetUserParamIterator(instance);
+    while (!AiUserParamIteratorFinished(iter)) {
+        const auto* name =
+            AiUserParamGetName(AiUserParamIteratorGetNext(iter));
+        if (AiNodeLookUpUserParameter(polymesh, name) == nullptr) {
+            removed.emplace_back(name);
+        }
+    }
+    AiUserParamIteratorDestroy(iter);
+    for (const auto& name : removed) {
+        AiNodeResetParameter(instance, name.c_str());
+    }
+
+    iter = AiNodeGetUserParamIterator(polymesh);
+    while (!AiUserParamIteratorFinished(iter)) {
+        const auto* entry = AiUserParamIteratorGetNext(iter);
+        if (AiUserParamGetCategory(entry) == AI_USERDEF_CONSTANT) {
+            _CopyConstantUserParam(polymesh, instance, entry);
+        }
+    }
+    AiUserParamIteratorDestroy(iter);
+}
+
+// Frees the geometry of a polymesh that is rendered through a ginstance.
+void _FreeGeometry(AtNode* polymesh) {
+    for (const auto& param :
+         {Str::vlist, Str::nsides, Str::vidxs, Str::uvlist, Str::uvidxs}) {
+        AiNodeResetParameter(polymesh, param);
+    }
+    std::vector<std::string> primvars;
+    auto* iter = AiNodeGetUserParamIterator(polymesh);
+    while (!AiUserParamIteratorFinished(iter)) {
+        const auto* entry = AiUserParamIteratorGetNext(iter);
+        if (AiUserParamGetCategory(entry) != AI_USERDEF_CONSTANT) {
+            primvars.emplace_back(AiUserParamGetName(entry));
+        }
+    }
+    AiUserParamIteratorDestroy(iter);
+    for (const auto& primvar : primvars) {
+        AiNodeResetParameter(polymesh, primvar.c_str());
+    }
+}
+
+} // namespace
+
+void HdAiMeshCache::Update(
+    AtNode* polymesh, const SdfPath& id, uint64_t geometryHash,
+    bool isComplete, AtUniverse* universe) {
+    auto& entry = _entries[polymesh];
+    entry.id = id;
+    if (entry.hash != geometryHash) {
+        if (entry.instance != nullptr && !isComplete) {
+            // The polymesh only has the geometry that changed, it keeps using
+            // the old source until it's fully synced.
+            if (std::find(
+                    _resyncRequests.begin(), _resyncRequests.end(),
+                    polymesh) == _resyncRequests.end()) {
+                _resyncRequests.push_back(polymesh);
+            }
+        } else {
+            if (entry.hash != 0) { _Leave(polymesh, entry); }
+            _Join(polymesh, entry, geometryHash, universe);
+        }
+    }
+    if (entry.instance != nullptr) { _SyncInstance(polymesh, entry.instance); }
+}
+
+void HdAiMeshCache::Remove(AtNode* polymesh) {
+    auto it = _entries.find(polymesh);
+    if (it == _entries.end()) { return; }
+    if (it->second.hash != 0) { _Leave(polymesh, it->second); }
+    _entries.erase(it);
+    _resyncRequests.erase(
+        std::remove(_resyncRequests.begin(), _resyncRequests.end(), polymesh),
+        _resyncRequests.end());
+}
+
+SdfPathVector HdAiMeshCache::TakeResyncRequests() {
+    SdfPathVector ret;
+    ret.reserve(_resyncRequests.size());
+    for (auto* polymesh : _resyncRequests) {
+        ret.push_back(_entries[polymesh].id);
+    }
+    _resyncRequests.clear();
+    return ret;
+}
+
+void HdAiMeshCache::_Join(
+    AtNode* polymesh, _Entry& entry, uint64_t hash, AtUniverse* universe) {
+    entry.hash = hash;
+    auto& group = _groups[hash];
+    if (group.members.empty()) {
+        group.members.push_back(polymesh);
+        return;
+    }
+    if (group.source == nullptr) {
+        // The first member is not instanced yet, so its polymesh still has
+        // all the geometry.
+        auto* first = group.members.front();
+        const auto sourceName = TfStringPrintf(
+            "HdAiMeshCache_%016llx", static_cast<unsigned long long>(hash));
+        group.source = AiNodeClone(first, AtString(sourceName.c_str()));
+        AiNodeSetByte(group.source, Str::visibility, 0);
+        _Instance(first, _entries[first], group.source, universe);
+    }
+    group.members.push_back(polymesh);
+    _Instance(polymesh, entry, group.source, universe);
+}
+
+void HdAiMeshCache::_Leave(AtNode* polymesh, _Entry& entry) {
+    auto it = _groups.find(entry.hash);
+    entry.hash = 0;
+    if (entry.instance != nullptr) {
+        AiNodeDestroy(entry.instance);
+        entry.instance = nullptr;
+        AiNodeSetDisabled(polymesh, false);
+    }
+    if (it == _groups.end()) { return; }
+    auto& members = it->second.members;
+    members.erase(
+        std::remove(members.begin(), members.end(), polymesh), members.end());
+    if (members.empty()) {
+        if (it->second.source != nullptr) { AiNodeDestroy(it->second.source); }
+        _groups.erase(it);
+    }
+}
+
+void HdAiMeshCache::_Instance(
+    AtNode* polymesh, _Entry& entry, AtNode* source, AtUniverse* universe) {
+    entry.instance = AiNode(universe, Str::ginstance);
+    AiNodeSetStr(
+        entry.instance, Str::name,
+        TfStringPrintf("%s_ginstance", AiNodeGetName(polymesh)).c_str());
+    AiNodeSetPtr(entry.instance, Str::node, source);
+    AiNodeSetBool(entry.instance, Str::inherit_xform, false);
+    _SyncInstance(polymesh, entry.instance);
+    _FreeGeometry(polymesh);
+    AiNodeSetDisabled(polymesh, true);
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,108 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_MESH_CACHE_H
+#define HDAI_MESH_CACHE_H
+
+#include <pxr/pxr.h>
+#include "pxr/imaging/hdAi/api.h"
+
+#include <pxr/imaging/hd/changeTracker.h>
+#include <pxr/usd/sdf/path.h>
+
+#include <ai.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Deduplicates polymeshes with identical geometry.
+///
+/// Meshes are grouped by a hash of their geometry, computed by the mesh while
+/// syncing. When a group has more than one mesh, the geometry of the first
+/// mesh is cloned into a hidden source polymesh, and every mesh of the group
+/// is rendered through a ginstance of the source. The polymeshes of the
+/// instanced meshes are disabled, and their geometry arrays are freed.
+///
+/// Per prim parameters, like the transform, the visibility, the shader and
+/// the constant primvars, stay on the polymesh of each mesh and are copied to
+/// its ginstance on every update.
+///
+/// A freed polymesh is only partially updated by the next sync, so an
+/// instanced mesh with new geometry keeps using its old source until it has
+/// been fully synced again. These meshes are returned by TakeResyncRequests.
+///
+/// Not thread safe, only used while committing the node edit journal.
+class HdAiMeshCache {
+public:
+    HdAiMeshCache() = default;
+    ~HdAiMeshCache() = default;
+
+    /// Dirty bits of the meshes returned by TakeResyncRequests. Freeing the
+    /// geometry of a polymesh frees the uvs and the non-constant primvars
+    /// too.
+    static constexpr HdDirtyBits resyncDirtyBits =
+        HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyTopology |
+        HdChangeTracker::DirtyPrimvar;
+
+    /// Updates the group of @p polymesh, synced from the rprim @p id, and its
+    /// ginstance.
+    ///
+    /// @p isComplete is true when all the geometry of the polymesh was
+    /// uploaded by the last sync.
+    HDAI_API
+    void Update(
+        AtNode* polymesh, const SdfPath& id, uint64_t geometryHash,
+        bool isComplete, AtUniverse* universe);
+
+    /// Removes @p polymesh before it's destroyed.
+    HDAI_API
+    void Remove(AtNode* polymesh);
+
+    /// Returns and clears the rprims that have to be synced with
+    /// resyncDirtyBits.
+    HDAI_API
+    SdfPathVector TakeResyncRequests();
+
+private:
+    HdAiMeshCache(const HdAiMeshCache&) = delete;
+    HdAiMeshCache& operator=(const HdAiMeshCache&) = delete;
+
+    struct _Entry {
+        SdfPath id;
+        uint64_t hash = 0;
+        AtNode* instance = nullptr;
+    };
+
+    struct _Group {
+        AtNode* source = nullptr;
+        std::vector<AtNode*> members;
+    };
+
+    void _Join(
+        AtNode* polymesh, _Entry& entry, uint64_t hash, AtUniverse* universe);
+    void _Leave(AtNode* polymesh, _Entry& entry);
+    void _Instance(
+        AtNode* polymesh, _Entry& entry, AtNode* source,
+        AtUniverse* universe);
+
+    std::unordered_map<AtNode*, _Entry> _entries;
+    std::unordered_map<uint64_t, _Group> _groups;
+    std::vector<AtNode*> _resyncRequests;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_MESH_CACHE_H
@@ -0,0 +1,31 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/nodeEditJournal.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+void HdAiNodeEditJournal::Record(Edit&& edit) {
+    _edits.local().push_back(std::move(edit));
+    _hasEdits = true;
+}
+
+void HdAiNodeEditJournal::Commit() {
+    if (!_hasEdits.exchange(false)) { return; }
+    for (auto& edits : _edits) {
+        for (auto& edit : edits) { edit(); }
+        edits.clear();
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,66 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_NODE_EDIT_JOURNAL_H
+#define HDAI_NODE_EDIT_JOURNAL_H
+
+#include <pxr/pxr.h>
+#include "pxr/imaging/hdAi/api.h"
+
+#include <tbb/enumerable_thread_specific.h>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Collects the edits of Arnold nodes made while syncing rprims.
+///
+/// Hydra syncs rprims from multiple threads, and the Arnold node API is not
+/// documented as thread safe. Rprims do the heavy lifting, like fetching
+/// primvars from the scene delegate and building arrays, in their Sync, and
+/// record the final node mutations in the journal. Each thread records into
+/// its own list, and the render delegate applies all the edits from a single
+/// thread in CommitResources. Edits recorded by the same thread are applied
+/// in order.
+class HdAiNodeEditJournal {
+public:
+    using Edit = std::function<void()>;
+
+    HdAiNodeEditJournal() = default;
+    ~HdAiNodeEditJournal() = default;
+
+    /// Records an edit, safe to call from multiple threads.
+    HDAI_API
+    void Record(Edit&& edit);
+
+    /// Returns true if there are edits waiting to be committed.
+    bool HasEdits() const { return _hasEdits.load(); }
+
+    /// Applies and clears all the recorded edits. Must not be called while
+    /// edits are being recorded.
+    HDAI_API
+    void Commit();
+
+private:
+    HdAiNodeEditJournal(const HdAiNodeEditJournal&) = delete;
+    HdAiNodeEditJournal& operator=(const HdAiNodeEditJournal&) = delete;
+
+    tbb::enumerable_thread_specific<std::vector<Edit>> _edits;
+    std::atomic<bool> _hasEdits{false};
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_NODE_EDIT_JOURNAL_H
@@ -13,11 +13,11 @@
 // limitations under the License.
 #include <ai.h>
 
-#include <tbb/concurrent_queue.h>
-
 #include <memory>
 
+#include "pxr/imaging/hdAi/kernels.h"
 #include "pxr/imaging/hdAi/nodes/nodes.h"
+#include "pxr/imaging/hdAi/renderBuffer.h"
 #include "pxr/imaging/hdAi/utils.h"
 
 PXR_NAMESPACE_USING_DIRECTIVE
@@ -26,6 +26,11 @@ AI_DRIVER_NODE_EXPORT_METHODS(HdAiDriverMtd);
 
 AtString HdAiDriver::projMtx("projMtx");
 AtString HdAiDriver::viewMtx("viewMtx");
+AtString HdAiDriver::aovs("aovs");
+AtString HdAiDriver::bucketQueue("bucketQueue");
+AtString HdAiDriver::framebuffer("framebuffer");
+AtString HdAiDriver::scale("scale");
+AtString HdAiDriver::passCount("passCount");
 
 namespace {
 const char* supportedExtensions[] = {nullptr};
@@ -34,27 +39,141 @@ struct DriverData {
     // I think we just uncovered a bug in Arnold.
     // This fails with AtMatrix, looks like as if the [3][3] of the proj
     // matrix is used incorrectly.
-    GfMatrix4f projMtx;
-    GfMatrix4f viewMtx;
+    // The view and the projection matrices are combined, so the depth of
+    // each pixel only requires a single transformation.
+    GfMatrix4f viewProjMtx;
+    // When not empty, buckets are written straight into the Hydra render
+    // buffers instead of being queued for the render pass.
+    HdAiDriverAovs aovs;
+    // Owned by the render pass, used when there are no render buffers.
+    HdAiBucketQueue* bucketQueue = nullptr;
+    // Owned by the render pass, when set, buckets are written directly to
+    // it, instead of being queued.
+    HdAiFramebuffer* framebuffer = nullptr;
+    // Owned by the render pass, incremented after each progressive pass.
+    std::atomic<unsigned int>* passCount = nullptr;
+    // The image is rendered downscaled by this factor, and upscaled when
+    // writing to the render buffers.
+    int scale = 1;
+};
+
+struct BucketOutput {
+    AtString name;
+    int pixelType;
+    const void* data;
 };
+
+HdFormat _GetBucketFormat(int pixelType) {
+    switch (pixelType) {
+        case AI_TYPE_RGBA:
+            return HdFormatFloat32Vec4;
+        case AI_TYPE_RGB:
+        case AI_TYPE_VECTOR:
+            return HdFormatFloat32Vec3;
+        case AI_TYPE_VECTOR2:
+            return HdFormatFloat32Vec2;
+        case AI_TYPE_FLOAT:
+            return HdFormatFloat32;
+        case AI_TYPE_INT:
+        case AI_TYPE_UINT:
+            return HdFormatInt32;
+        default:
+            return HdFormatInvalid;
+    }
+}
+
+// Depth expected by the render buffers.
+constexpr HdAiDepthRange _bufferDepthRange{0.5f, 0.5f, 0.0f, 1.0f, 1.0f};
+// Depth expected by the compositor.
+constexpr HdAiDepthRange _compositorDepthRange{1.0f, 0.0f, -1.0f, 1.0f,
+                                               1.0f - AI_EPSILON};
+
+// Converts the P output to the [0, 1] depth range expected by the render
+// buffers. Rays hitting the background will return a (0,0,0) vector, so
+// we are relying on the alpha of the beauty to detect those.
+void _WriteDepthBucket(
+    const DriverData* driverData, HdAiRenderBuffer* buffer,
+    const AtRGBA* beauty, const GfVec3f* pp, int bucketXO, int bucketYO,
+    int bucketWidth, int bucketHeight, int scale) {
+    const auto bucketSize = static_cast<size_t>(bucketWidth * bucketHeight);
+    // Arnold reuses the same threads for all the buckets.
+    thread_local std::vector<float> depth;
+    depth.resize(bucketSize);
+    HdAiProjectDepth(
+        driverData->viewProjMtx, pp->data(),
+        beauty == nullptr ? nullptr : &beauty->r, depth.data(), bucketSize,
+        _bufferDepthRange);
+    buffer->WriteBucket(
+        bucketXO, bucketYO, bucketWidth, bucketHeight, HdFormatFloat32,
+        depth.data(), scale);
+}
+
+void _WritePrimIdBucket(
+    HdAiRenderBuffer* buffer, const unsigned int* ids, int bucketXO,
+    int bucketYO, int bucketWidth, int bucketHeight, int scale) {
+    const auto bucketSize = bucketWidth * bucketHeight;
+    std::vector<int> primId(bucketSize);
+    for (auto i = decltype(bucketSize){0}; i < bucketSize; ++i) {
+        primId[i] = static_cast<int>(ids[i]) - 1;
+    }
+    buffer->WriteBucket(
+        bucketXO, bucketYO, bucketWidth, bucketHeight, HdFormatInt32,
+        primId.data(), scale);
+}
+
 } // namespace
 
-tbb::concurrent_queue<HdAiBucketData*> bucketQueue;
+void HdAiBucketQueue::Reset(int width, int height, int bucketSize) {
+    _bucketSize = std::max(1, bucketSize);
+    _numColumns = std::max(0, (width + _bucketSize - 1) / _bucketSize);
+    _numRows = std::max(0, (height + _bucketSize - 1) / _bucketSize);
+    const auto numSlots = static_cast<size_t>(_numColumns * _numRows);
+    const auto pixelsPerSlot = static_cast<size_t>(_bucketSize * _bucketSize);
+    _slots.reset(new Slot[numSlots]);
+    _beautyStorage.resize(numSlots * pixelsPerSlot);
+    _depthStorage.resize(numSlots * pixelsPerSlot);
+    for (auto i = decltype(numSlots){0}; i < numSlots; ++i) {
+        _slots[i].data.beauty = _beautyStorage.data() + i * pixelsPerSlot;
+        _slots[i].data.depth = _depthStorage.data() + i * pixelsPerSlot;
+    }
+}
 
-void hdAiEmptyBucketQueue(const std::function<void(const HdAiBucketData*)>& f) {
-    HdAiBucketData* data = nullptr;
-    while (bucketQueue.try_pop(data)) {
-        if (data) {
-            f(data);
-            delete data;
-            data = nullptr;
+void HdAiBucketQueue::Drain(
+    const std::function<void(const HdAiBucketData&)>& f) {
+    if (_slots == nullptr) { return; }
+    const auto numSlots = static_cast<size_t>(_numColumns * _numRows);
+    for (auto i = decltype(numSlots){0}; i < numSlots; ++i) {
+        auto& slot = _slots[i];
+        if (!slot.published.exchange(false, std::memory_order_acquire)) {
+            continue;
         }
+        // The producer is still writing the slot, and publishes it again
+        // when it's done.
+        if (slot.sequence.load(std::memory_order_acquire) % 2 != 0) {
+            continue;
+        }
+        // If the slot is overwritten while copying, the producer publishes
+        // it again and the torn pixels are replaced on the next drain.
+        f(slot.data);
+    }
+}
+
+void HdAiBucketQueue::Clear() {
+    if (_slots == nullptr) { return; }
+    const auto numSlots = static_cast<size_t>(_numColumns * _numRows);
+    for (auto i = decltype(numSlots){0}; i < numSlots; ++i) {
+        _slots[i].published.store(false, std::memory_order_relaxed);
     }
 }
 
 node_parameters {
     AiParameterMtx(HdAiDriver::projMtx, AiM4Identity());
     AiParameterMtx(HdAiDriver::viewMtx, AiM4Identity());
+    AiParameterPtr(HdAiDriver::aovs, nullptr);
+    AiParameterPtr(HdAiDriver::bucketQueue, nullptr);
+    AiParameterPtr(HdAiDriver::framebuffer, nullptr);
+    AiParameterInt(HdAiDriver::scale, 1);
+    AiParameterPtr(HdAiDriver::passCount, nullptr);
 }
 
 node_initialize {
@@ -66,16 +185,31 @@ node_initialize {
 
 node_update {
     auto* data = reinterpret_cast<DriverData*>(AiNodeGetLocalData(node));
-    data->projMtx =
+    data->viewProjMtx =
+        HdAiConvertMatrix(AiNodeGetMatrix(node, HdAiDriver::viewMtx)) *
         HdAiConvertMatrix(AiNodeGetMatrix(node, HdAiDriver::projMtx));
-    data->viewMtx =
-        HdAiConvertMatrix(AiNodeGetMatrix(node, HdAiDriver::viewMtx));
+    const auto* aovs = static_cast<const HdAiDriverAovs*>(
+        AiNodeGetPtr(node, HdAiDriver::aovs));
+    if (aovs == nullptr) {
+        data->aovs.clear();
+    } else {
+        data->aovs = *aovs;
+    }
+    data->bucketQueue = static_cast<HdAiBucketQueue*>(
+        AiNodeGetPtr(node, HdAiDriver::bucketQueue));
+    data->framebuffer = static_cast<HdAiFramebuffer*>(
+        AiNodeGetPtr(node, HdAiDriver::framebuffer));
+    data->passCount = static_cast<std::atomic<unsigned int>*>(
+        AiNodeGetPtr(node, HdAiDriver::passCount));
+    data->scale = std::max(1, AiNodeGetInt(node, HdAiDriver::scale));
 }
 
-node_finish {}
+node_finish {
+    delete reinterpret_cast<DriverData*>(AiNodeGetLocalData(node));
+}
 
 driver_supports_pixel_type {
-    return pixel_type == AI_TYPE_RGBA || pixel_type == AI_TYPE_VECTOR;
+    return _GetBucketFormat(pixel_type) != HdFormatInvalid;
 }
 
 driver_extension { return supportedExtensions; }
@@ -92,52 +226,111 @@ driver_process_bucket {
     const char* outputName = nullptr;
     int pixelType = AI_TYPE_RGBA;
     const void* bucketData = nullptr;
-    auto* data = new HdAiBucketData();
-    data->xo = bucket_xo;
-    data->yo = bucket_yo;
-    data->sizeX = bucket_size_x;
-    data->sizeY = bucket_size_y;
-    const auto bucketSize = bucket_size_x * bucket_size_y;
+    if (!driverData->aovs.empty()) {
+        constexpr size_t maxOutputs = 32;
+        BucketOutput outputs[maxOutputs];
+        size_t numOutputs = 0;
+        const AtRGBA* beauty = nullptr;
+        while (numOutputs < maxOutputs &&
+               AiOutputIteratorGetNext(
+                   iterator, &outputName, &pixelType, &bucketData)) {
+            outputs[numOutputs++] = {AtString(outputName), pixelType,
+                                     bucketData};
+            if (pixelType == AI_TYPE_RGBA && strcmp(outputName, "RGBA") == 0) {
+                beauty = reinterpret_cast<const AtRGBA*>(bucketData);
+            }
+        }
+        for (const auto& aov : driverData->aovs) {
+            for (auto i = decltype(numOutputs){0}; i < numOutputs; ++i) {
+                const auto& output = outputs[i];
+                if (output.name != aov.outputName) { continue; }
+                if (aov.type == HdAiDriverAov::Type::Depth) {
+                    if (output.pixelType != AI_TYPE_VECTOR) { break; }
+                    _WriteDepthBucket(
+                        driverData, aov.buffer, beauty,
+                        reinterpret_cast<const GfVec3f*>(output.data),
+                        bucket_xo, bucket_yo, bucket_size_x, bucket_size_y,
+                        driverData->scale);
+                } else if (aov.type == HdAiDriverAov::Type::PrimId) {
+                    if (output.pixelType != AI_TYPE_UINT) { break; }
+                    _WritePrimIdBucket(
+                        aov.buffer,
+                        reinterpret_cast<const unsigned int*>(output.data),
+                        bucket_xo, bucket_yo, bucket_size_x, bucket_size_y,
+                        driverData->scale);
+                } else {
+                    aov.buffer->WriteBucket(
+                        bucket_xo, bucket_yo, bucket_size_x, bucket_size_y,
+                        _GetBucketFormat(output.pixelType), output.data,
+                        driverData->scale);
+                }
+                break;
+            }
+        }
+        return;
+    }
+    const AtRGBA* inRGBA = nullptr;
+    const GfVec3f* pp = nullptr;
     while (AiOutputIteratorGetNext(
         iterator, &outputName, &pixelType, &bucketData)) {
         if (pixelType == AI_TYPE_RGBA && strcmp(outputName, "RGBA") == 0) {
-            data->beauty.resize(bucketSize);
-            const auto* inRGBA = reinterpret_cast<const AtRGBA*>(bucketData);
-            for (auto i = decltype(bucketSize){0}; i < bucketSize; ++i) {
-                const auto in = inRGBA[i];
-                const auto x = bucket_xo + i % bucket_size_x;
-                const auto y = bucket_yo + i / bucket_size_x;
-                AtRGBA8 out;
-                out.r = AiQuantize8bit(x, y, 0, in.r, true);
-                out.g = AiQuantize8bit(x, y, 1, in.g, true);
-                out.b = AiQuantize8bit(x, y, 2, in.b, true);
-                out.a = AiQuantize8bit(x, y, 3, in.a, true);
-                data->beauty[i] = out;
-            }
-
+            inRGBA = reinterpret_cast<const AtRGBA*>(bucketData);
         } else if (
             pixelType == AI_TYPE_VECTOR && strcmp(outputName, "P") == 0) {
-            data->depth.resize(bucketSize, 1.0f);
-            const auto* pp = reinterpret_cast<const GfVec3f*>(bucketData);
-            auto* pz = data->depth.data();
-            for (auto i = decltype(bucketSize){0}; i < bucketSize; ++i) {
-                // Rays hitting the background will return a (0,0,0) vector.
-                const auto p = driverData->projMtx.Transform(
-                    driverData->viewMtx.Transform(pp[i]));
-                pz[i] = std::max(-1.0f, std::min(1.0f, p[2]));
-            }
+            pp = reinterpret_cast<const GfVec3f*>(bucketData);
         }
     }
-    if (data->beauty.empty() || data->depth.empty()) {
-        delete data;
-    } else {
-        for (auto i = decltype(bucketSize){0}; i < bucketSize; ++i) {
-            if (data->beauty[i].a == 0) { data->depth[i] = 1.0f - AI_EPSILON; }
+    if (inRGBA == nullptr || pp == nullptr) { return; }
+
+    // Converts a row of the bucket, starting at the pixel index i. Rays
+    // hitting the background will return a (0,0,0) vector, the depth
+    // kernel relies on the alpha of the beauty to detect those.
+    auto convertRow = [&](int i, int x, int y, int count, AtRGBA8* beauty,
+                          float* depth) {
+        HdAiQuantizeRGBA8(
+            &inRGBA[i].r, &beauty->r, static_cast<size_t>(count), x, y);
+        HdAiProjectDepth(
+            driverData->viewProjMtx, pp[i].data(), &inRGBA[i].r, depth,
+            static_cast<size_t>(count), _compositorDepthRange);
+    };
+
+    auto* framebuffer = driverData->framebuffer;
+    if (framebuffer != nullptr) {
+        const auto xo = std::max(0, bucket_xo);
+        const auto xe = std::min(framebuffer->width, bucket_xo + bucket_size_x);
+        const auto yo = std::max(0, bucket_yo);
+        const auto ye =
+            std::min(framebuffer->height, bucket_yo + bucket_size_y);
+        if (xe <= xo || ye <= yo) { return; }
+        for (auto y = yo; y < ye; ++y) {
+            const auto outOffset =
+                framebuffer->width * (framebuffer->height - y - 1) + xo;
+            convertRow(
+                bucket_size_x * (y - bucket_yo) + xo - bucket_xo, xo, y,
+                xe - xo, framebuffer->color.data() + outOffset,
+                framebuffer->depth.data() + outOffset);
         }
-        bucketQueue.push(data);
+        framebuffer->dirty.store(true, std::memory_order_release);
+        return;
     }
+
+    if (driverData->bucketQueue == nullptr) { return; }
+    driverData->bucketQueue->Push(
+        bucket_xo, bucket_yo, bucket_size_x, bucket_size_y,
+        [&](HdAiBucketData& data) {
+            for (auto y = 0; y < bucket_size_y; ++y) {
+                const auto offset = bucket_size_x * y;
+                convertRow(
+                    offset, bucket_xo, bucket_yo + y, bucket_size_x,
+                    data.beauty + offset, data.depth + offset);
+            }
+        });
 }
 
 driver_write_bucket {}
 
-driver_close {}
+driver_close {
+    const auto* driverData =
+        reinterpret_cast<const DriverData*>(AiNodeGetLocalData(node));
+    if (driverData->passCount != nullptr) { (*driverData->passCount)++; }
+}
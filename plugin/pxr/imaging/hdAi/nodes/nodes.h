@@ -14,11 +14,20 @@
 #ifndef HDAI_NODES_H
 #define HDAI_NODES_H
 
+#include <pxr/pxr.h>
+
 #include <ai.h>
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <vector>
 
+PXR_NAMESPACE_OPEN_SCOPE
+class HdAiRenderBuffer;
+PXR_NAMESPACE_CLOSE_SCOPE
+
 namespace HdAiNodeNames {
 extern AtString driver;
 } // namespace HdAiNodeNames
@@ -26,8 +35,31 @@ extern AtString driver;
 namespace HdAiDriver {
 extern AtString projMtx;
 extern AtString viewMtx;
+extern AtString aovs;
+extern AtString bucketQueue;
+extern AtString framebuffer;
+extern AtString scale;
+extern AtString passCount;
 } // namespace HdAiDriver
 
+/// Describes where the driver writes a single Arnold output.
+struct HdAiDriverAov {
+    enum class Type {
+        // The output is written as is, after converting to the format of the
+        // render buffer.
+        Raw,
+        // The output is P, converted to the [0, 1] depth range.
+        Depth,
+        // The output is ID, offset by one so the background maps to -1.
+        PrimId,
+    };
+    AtString outputName;
+    PXR_NS::HdAiRenderBuffer* buffer = nullptr;
+    Type type = Type::Raw;
+};
+
+using HdAiDriverAovs = std::vector<HdAiDriverAov>;
+
 void hdAiInstallNodes();
 void hdAiUninstallNodes();
 
@@ -39,19 +71,111 @@ struct AtRGBA8 {
 };
 
 struct HdAiBucketData {
-    HdAiBucketData() = default;
-    ~HdAiBucketData() = default;
-    HdAiBucketData(const HdAiBucketData&) = delete;
-    HdAiBucketData(HdAiBucketData&&) = delete;
-    HdAiBucketData& operator=(const HdAiBucketData&) = delete;
     int xo = 0;
     int yo = 0;
     int sizeX = 0;
     int sizeY = 0;
-    std::vector<AtRGBA8> beauty;
+    // Both point to the preallocated storage of the bucket queue, and use
+    // sizeX as the row stride.
+    AtRGBA8* beauty = nullptr;
+    float* depth = nullptr;
+};
+
+/// Framebuffer shared between the driver and the render pass.
+///
+/// When set on the driver, the Arnold threads write buckets straight to
+/// their final, vertically flipped location, and flag the framebuffer dirty.
+/// Buckets are disjoint, so no locking is required, and the render thread
+/// only has to upload the pixels when the framebuffer is dirty.
+struct HdAiFramebuffer {
+    std::vector<AtRGBA8> color;
     std::vector<float> depth;
+    int width = 0;
+    int height = 0;
+    std::atomic<bool> dirty{false};
+};
+
+/// Lock-free grid of the latest buckets, written by multiple producers and
+/// read by a single consumer.
+///
+/// Every bucket of a pass has its own preallocated slot, and a newer pass
+/// overwrites the pending bucket at the same location instead of queueing
+/// behind it. Pushing never waits for the render thread, so Arnold threads
+/// are never stalled by a slow viewport, and the render thread always copies
+/// the most recent pixels.
+class HdAiBucketQueue {
+public:
+    HdAiBucketQueue() = default;
+    ~HdAiBucketQueue() = default;
+    HdAiBucketQueue(const HdAiBucketQueue&) = delete;
+    HdAiBucketQueue& operator=(const HdAiBucketQueue&) = delete;
+
+    /// Preallocates a slot for every bucket of a @p width by @p height image,
+    /// rendered with buckets of @p bucketSize pixels. Must not be called
+    /// while rendering.
+    void Reset(int width, int height, int bucketSize);
+
+    int GetBucketSize() const { return _bucketSize; }
+
+    /// Returns true if every bucket of a @p width by @p height image has a
+    /// slot.
+    bool Covers(int width, int height) const {
+        return _slots != nullptr && _numColumns * _bucketSize >= width &&
+               _numRows * _bucketSize >= height;
+    }
+
+    /// Fills the slot of the bucket via @p fill and publishes it, replacing
+    /// the previous bucket at the same location if it wasn't drained yet.
+    ///
+    /// Returns false if the bucket has no slot. Safe to call from multiple
+    /// threads, as long as they write different buckets.
+    template <typename F>
+    bool Push(int xo, int yo, int sizeX, int sizeY, F&& fill);
+
+    /// Calls @p f on every published bucket and unpublishes them. A bucket
+    /// that is overwritten while @p f reads it is published again by its
+    /// producer. Must only be called from a single thread.
+    void Drain(const std::function<void(const HdAiBucketData&)>& f);
+
+    /// Unpublishes every bucket.
+    void Clear();
+
+private:
+    struct Slot {
+        // Odd while a producer writes the slot.
+        std::atomic<unsigned int> sequence{0};
+        std::atomic<bool> published{false};
+        HdAiBucketData data;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    std::vector<AtRGBA8> _beautyStorage;
+    std::vector<float> _depthStorage;
+    int _numColumns = 0;
+    int _numRows = 0;
+    int _bucketSize = 0;
 };
 
-void hdAiEmptyBucketQueue(const std::function<void(const HdAiBucketData*)>& f);
+template <typename F>
+bool HdAiBucketQueue::Push(int xo, int yo, int sizeX, int sizeY, F&& fill) {
+    if (_slots == nullptr || sizeX > _bucketSize || sizeY > _bucketSize ||
+        xo < 0 || yo < 0 || xo % _bucketSize != 0 || yo % _bucketSize != 0) {
+        return false;
+    }
+    const auto column = xo / _bucketSize;
+    const auto row = yo / _bucketSize;
+    if (column >= _numColumns || row >= _numRows) { return false; }
+    auto& slot = _slots[row * _numColumns + column];
+    slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+    auto& data = slot.data;
+    data.xo = xo;
+    data.yo = yo;
+    data.sizeX = sizeX;
+    data.sizeY = sizeY;
+    fill(data);
+    slot.sequence.fetch_add(1, std::memory_order_release);
+    slot.published.store(true, std::memory_order_release);
+    return true;
+}
 
 #endif
@@ -0,0 +1,197 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/points.h"
+
+#include <pxr/imaging/hdAi/instancer.h>
+#include <pxr/imaging/hdAi/material.h>
+#include <pxr/imaging/hdAi/utils.h>
+
+#include <algorithm>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace {
+namespace Str {
+const AtString name("name");
+const AtString points("points");
+const AtString radius("radius");
+const AtString visibility("visibility");
+const AtString matrix("matrix");
+const AtString shader("shader");
+const AtString opaque("opaque");
+const AtString id("id");
+} // namespace Str
+} // namespace
+
+HdAiPoints::HdAiPoints(
+    HdAiRenderDelegate* delegate, const SdfPath& id, const SdfPath& instancerId)
+    : HdPoints(id, instancerId), _delegate(delegate) {
+    _points = AiNode(delegate->GetUniverse(), Str::points);
+    AiNodeSetStr(_points, Str::name, id.GetText());
+}
+
+HdAiPoints::~HdAiPoints() {
+    _delegate->GetMaterialBindings().Unbind(GetId());
+    for (auto* instance : _instances) { AiNodeDestroy(instance); }
+    AiNodeDestroy(_points);
+}
+
+// Same as the meshes, the data is converted here and the node edits are
+// recorded in the node edit journal.
+void HdAiPoints::Sync(
+    HdSceneDelegate* delegate, HdRenderParam* renderParam,
+    HdDirtyBits* dirtyBits, const TfToken& reprToken) {
+    TF_UNUSED(renderParam);
+    TF_UNUSED(reprToken);
+    auto& journal = _delegate->GetNodeEditJournal();
+    auto* points = _points;
+    const auto& id = GetId();
+
+    const auto shutter = _delegate->GetShutterRange();
+    auto motionChanged = false;
+    if (HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points)) {
+        auto* positions =
+            HdAiConvertPoints(delegate, id, HdTokens->points, shutter);
+        if (positions != nullptr) {
+            motionChanged = true;
+            journal.Record([points, positions]() {
+                AiNodeSetArray(points, Str::points, positions);
+            });
+        }
+    }
+
+    if (*dirtyBits & HdChangeTracker::DirtyPrimID) {
+        const auto primId = static_cast<unsigned int>(GetPrimId()) + 1;
+        journal.Record(
+            [points, primId]() { AiNodeSetUInt(points, Str::id, primId); });
+    }
+
+    if (HdChangeTracker::IsVisibilityDirty(*dirtyBits, id)) {
+        _UpdateVisibility(delegate, dirtyBits);
+        const auto visibility = _sharedData.visible ? AI_RAY_ALL : uint8_t(0);
+        journal.Record([points, visibility]() {
+            AiNodeSetByte(points, Str::visibility, visibility);
+        });
+    }
+
+    if (HdChangeTracker::IsTransformDirty(*dirtyBits, id)) {
+        motionChanged = true;
+        auto* matrices = HdAiConvertTransform(delegate, id, shutter);
+        journal.Record([points, matrices]() {
+            AiNodeSetArray(points, Str::matrix, matrices);
+        });
+    }
+
+    if (motionChanged) {
+        journal.Record(
+            [points, shutter]() { HdAiSetMotionRange(points, shutter); });
+    }
+
+    auto opacityChanged = false;
+    if (*dirtyBits & HdChangeTracker::DirtyMaterialId) {
+        const auto materialId = delegate->GetMaterialId(id);
+        const auto* material = reinterpret_cast<const HdAiMaterial*>(
+            delegate->GetRenderIndex().GetSprim(
+                HdPrimTypeTokens->material, materialId));
+        auto* bindings = &_delegate->GetMaterialBindings();
+        journal.Record([bindings, id, materialId]() {
+            bindings->Bind(id, materialId);
+        });
+        auto* shader = material != nullptr ? material->GetSurfaceShader()
+                                           : _delegate->GetFallbackShader();
+        journal.Record(
+            [points, shader]() { AiNodeSetPtr(points, Str::shader, shader); });
+        // Opaque shapes skip their shaders for shadow and transparency rays.
+        const auto isOpaque = material == nullptr || material->IsOpaque();
+        if (isOpaque != _isOpaque) {
+            _isOpaque = isOpaque;
+            opacityChanged = true;
+            journal.Record([points, isOpaque]() {
+                AiNodeSetBool(points, Str::opaque, isOpaque);
+            });
+        }
+    }
+
+    if (HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->widths) ||
+        (*dirtyBits & HdChangeTracker::DirtyPrimvar)) {
+        auto widthsAuthored = false;
+        std::vector<TfToken> primvars;
+        for (const auto interpolation :
+             {HdInterpolationConstant, HdInterpolationUniform,
+              HdInterpolationVarying, HdInterpolationVertex}) {
+            for (const auto& primvar :
+                 delegate->GetPrimvarDescriptors(id, interpolation)) {
+                if (primvar.name == HdTokens->points) { continue; }
+                const auto value = delegate->Get(id, primvar.name);
+                if (primvar.name == HdTokens->widths) {
+                    if (!value.IsHolding<VtFloatArray>()) { continue; }
+                    widthsAuthored = true;
+                    auto* radius =
+                        HdAiConvertWidths(value.UncheckedGet<VtFloatArray>());
+                    journal.Record([points, radius]() {
+                        AiNodeSetArray(points, Str::radius, radius);
+                    });
+                    continue;
+                }
+                primvars.push_back(primvar.name);
+                // Points have a single primitive, so uniform primvars are
+                // constant.
+                if (interpolation == HdInterpolationConstant ||
+                    interpolation == HdInterpolationUniform) {
+                    HdAiSetConstantPrimvar(journal, points, primvar, value);
+                } else {
+                    HdAiSetVertexPrimvar(journal, points, primvar, value);
+                }
+            }
+        }
+        if (!widthsAuthored) {
+            journal.Record(
+                [points]() { AiNodeResetParameter(points, Str::radius); });
+        }
+        for (const auto& primvar : _primvars) {
+            if (std::find(primvars.begin(), primvars.end(), primvar) ==
+                primvars.end()) {
+                HdAiRemovePrimvar(journal, points, primvar);
+            }
+        }
+        _primvars.swap(primvars);
+    }
+
+    HdAiSyncInstances(
+        delegate, id, GetInstancerId(), *dirtyBits, points,
+        _sharedData.visible ? AI_RAY_ALL : uint8_t(0), &_instances,
+        opacityChanged);
+
+    *dirtyBits = HdChangeTracker::Clean;
+}
+
+HdDirtyBits HdAiPoints::GetInitialDirtyBitsMask() const {
+    return HdChangeTracker::Clean | HdChangeTracker::InitRepr |
+           HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyWidths |
+           HdChangeTracker::DirtyTransform | HdChangeTracker::DirtyMaterialId |
+           HdChangeTracker::DirtyPrimvar | HdChangeTracker::DirtyVisibility |
+           HdChangeTracker::DirtyPrimID | HdChangeTracker::DirtyInstancer |
+           HdChangeTracker::DirtyInstanceIndex;
+}
+
+HdDirtyBits HdAiPoints::_PropagateDirtyBits(HdDirtyBits bits) const {
+    return bits & HdChangeTracker::AllDirty;
+}
+
+void HdAiPoints::_InitRepr(const TfToken& reprToken, HdDirtyBits* dirtyBits) {
+    TF_UNUSED(reprToken);
+    TF_UNUSED(dirtyBits);
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -13,37 +13,322 @@
 // limitations under the License.
 #include "pxr/imaging/hdAi/renderBuffer.h"
 
-#include "renderBuffer.h"
+#include "pxr/imaging/hdAi/kernels.h"
+
+#include <pxr/base/gf/half.h>
+#include <pxr/base/gf/vec2f.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/vec4f.h>
+#include <pxr/base/tf/enum.h>
+
+#include <algorithm>
+#include <cstring> // memcpy
+#include <type_traits>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
-HdAiRenderBuffer::HdAiRenderBuffer(const SdfPath& id) : HdRenderBuffer(id) {}
+namespace {
+
+template <typename TO, typename FROM>
+inline TO _ConvertComponent(FROM from) {
+    return static_cast<TO>(from);
+}
+
+template <>
+inline uint8_t _ConvertComponent<uint8_t, float>(float from) {
+    return static_cast<uint8_t>(
+        std::max(0.0f, std::min(1.0f, from)) * 255.0f + 0.5f);
+}
+
+template <>
+inline int8_t _ConvertComponent<int8_t, float>(float from) {
+    return static_cast<int8_t>(std::max(-1.0f, std::min(1.0f, from)) * 127.0f);
+}
+
+template <>
+inline GfHalf _ConvertComponent<GfHalf, float>(float from) {
+    return GfHalf(from);
+}
+
+template <>
+inline GfHalf _ConvertComponent<GfHalf, int>(int from) {
+    return GfHalf(static_cast<float>(from));
+}
+
+// Copies the overlapping region of a bucket into the buffer, flipping it
+// vertically, as Hydra expects the first row to be the bottom one.
+template <typename TO, typename FROM>
+inline void _WriteBucket(
+    uint8_t* buffer, int width, int height, size_t toComponents, int xo,
+    int xe, int yo, int ye, int bucketXO, int bucketYO, int bucketWidth,
+    const void* bucketData, size_t fromComponents) {
+    auto* to = reinterpret_cast<TO*>(buffer);
+    const auto* from = reinterpret_cast<const FROM*>(bucketData);
+    const auto numComponents = std::min(toComponents, fromComponents);
+    const auto zero = _ConvertComponent<TO, FROM>(FROM{0});
+    for (auto y = yo; y < ye; ++y) {
+        auto* outRow = to + (width * (height - y - 1) + xo) * toComponents;
+        const auto* inRow =
+            from + (bucketWidth * (y - bucketYO) + xo - bucketXO) *
+                       fromComponents;
+        if (std::is_same<TO, FROM>::value && toComponents == fromComponents) {
+            memcpy(outRow, inRow, (xe - xo) * toComponents * sizeof(TO));
+            continue;
+        }
+        if (std::is_same<TO, GfHalf>::value &&
+            std::is_same<FROM, float>::value &&
+            toComponents == fromComponents) {
+            HdAiConvertFloatToHalf(
+                reinterpret_cast<const float*>(inRow),
+                reinterpret_cast<GfHalf*>(outRow), (xe - xo) * toComponents);
+            continue;
+        }
+        for (auto x = xo; x < xe; ++x) {
+            for (auto c = decltype(numComponents){0}; c < numComponents; ++c) {
+                outRow[c] = _ConvertComponent<TO, FROM>(inRow[c]);
+            }
+            for (auto c = numComponents; c < toComponents; ++c) {
+                outRow[c] = zero;
+            }
+            outRow += toComponents;
+            inRow += fromComponents;
+        }
+    }
+}
+
+// Same as above, but each pixel of the bucket covers scale by scale pixels
+// of the buffer, the bucket coordinates are in the downscaled image.
+template <typename TO, typename FROM>
+inline void _WriteScaledBucket(
+    uint8_t* buffer, int width, int height, size_t toComponents, int xo,
+    int xe, int yo, int ye, int bucketXO, int bucketYO, int bucketWidth,
+    const void* bucketData, size_t fromComponents, int scale) {
+    auto* to = reinterpret_cast<TO*>(buffer);
+    const auto* from = reinterpret_cast<const FROM*>(bucketData);
+    const auto numComponents = std::min(toComponents, fromComponents);
+    const auto zero = _ConvertComponent<TO, FROM>(FROM{0});
+    const auto pixelSize = toComponents * sizeof(TO);
+    const auto outXO = xo * scale;
+    const auto outXE = std::min(width, xe * scale);
+    for (auto y = yo; y < ye; ++y) {
+        const auto outYO = y * scale;
+        const auto outYE = std::min(height, outYO + scale);
+        auto* outRow = to + width * (height - outYO - 1) * toComponents;
+        const auto* inRow =
+            from + (bucketWidth * (y - bucketYO) + xo - bucketXO) *
+                       fromComponents;
+        for (auto x = xo; x < xe; ++x) {
+            auto* out = outRow + x * scale * toComponents;
+            for (auto c = decltype(numComponents){0}; c < numComponents; ++c) {
+                out[c] = _ConvertComponent<TO, FROM>(inRow[c]);
+            }
+            for (auto c = numComponents; c < toComponents; ++c) {
+                out[c] = zero;
+            }
+            const auto replicas = std::min(scale, width - x * scale);
+            for (auto i = 1; i < replicas; ++i) {
+                memcpy(out + i * toComponents, out, pixelSize);
+            }
+            inRow += fromComponents;
+        }
+        for (auto outY = outYO + 1; outY < outYE; ++outY) {
+            memcpy(
+                to + (width * (height - outY - 1) + outXO) * toComponents,
+                outRow + outXO * toComponents, (outXE - outXO) * pixelSize);
+        }
+    }
+}
+
+template <typename TO, typename FROM>
+inline void _WriteBucket(
+    uint8_t* buffer, int width, int height, size_t toComponents, int xo,
+    int xe, int yo, int ye, int bucketXO, int bucketYO, int bucketWidth,
+    const void* bucketData, size_t fromComponents, int scale) {
+    if (scale == 1) {
+        _WriteBucket<TO, FROM>(
+            buffer, width, height, toComponents, xo, xe, yo, ye, bucketXO,
+            bucketYO, bucketWidth, bucketData, fromComponents);
+    } else {
+        _WriteScaledBucket<TO, FROM>(
+            buffer, width, height, toComponents, xo, xe, yo, ye, bucketXO,
+            bucketYO, bucketWidth, bucketData, fromComponents, scale);
+    }
+}
+
+template <typename FROM>
+inline void _WriteBucket(
+    uint8_t* buffer, int width, int height, HdFormat format, int xo, int xe,
+    int yo, int ye, int bucketXO, int bucketYO, int bucketWidth,
+    const void* bucketData, size_t fromComponents, int scale) {
+    const auto toComponents = HdGetComponentCount(format);
+    switch (HdGetComponentFormat(format)) {
+        case HdFormatUNorm8:
+            _WriteBucket<uint8_t, FROM>(
+                buffer, width, height, toComponents, xo, xe, yo, ye, bucketXO,
+                bucketYO, bucketWidth, bucketData, fromComponents, scale);
+            break;
+        case HdFormatSNorm8:
+            _WriteBucket<int8_t, FROM>(
+                buffer, width, height, toComponents, xo, xe, yo, ye, bucketXO,
+                bucketYO, bucketWidth, bucketData, fromComponents, scale);
+            break;
+        case HdFormatFloat16:
+            _WriteBucket<GfHalf, FROM>(
+                buffer, width, height, toComponents, xo, xe, yo, ye, bucketXO,
+                bucketYO, bucketWidth, bucketData, fromComponents, scale);
+            break;
+        case HdFormatFloat32:
+            _WriteBucket<float, FROM>(
+                buffer, width, height, toComponents, xo, xe, yo, ye, bucketXO,
+                bucketYO, bucketWidth, bucketData, fromComponents, scale);
+            break;
+        case HdFormatInt32:
+            _WriteBucket<int, FROM>(
+                buffer, width, height, toComponents, xo, xe, yo, ye, bucketXO,
+                bucketYO, bucketWidth, bucketData, fromComponents, scale);
+            break;
+        default:
+            TF_CODING_ERROR("Unsupported render buffer format.");
+    }
+}
+
+} // namespace
+
+HdAiRenderBuffer::HdAiRenderBuffer(
+    HdAiRenderParam* renderParam, const SdfPath& id)
+    : HdRenderBuffer(id), _renderParam(renderParam) {}
 
 bool HdAiRenderBuffer::Allocate(
     const GfVec3i& dimensions, HdFormat format, bool multiSampled) {
-    return false;
+    TF_UNUSED(multiSampled);
+    _Deallocate();
+    if (dimensions[2] != 1) {
+        TF_WARN(
+            "Render buffer allocated with dims <%i, %i, %i> and format %s; "
+            "depth must be 1!",
+            dimensions[0], dimensions[1], dimensions[2],
+            TfEnum::GetName(format).c_str());
+        return false;
+    }
+    if (HdGetComponentFormat(format) == HdFormatInvalid) {
+        TF_WARN(
+            "Render buffer allocated with unsupported format %s",
+            TfEnum::GetName(format).c_str());
+        return false;
+    }
+    _width = static_cast<unsigned int>(std::max(0, dimensions[0]));
+    _height = static_cast<unsigned int>(std::max(0, dimensions[1]));
+    _format = format;
+    _buffer.resize(_width * _height * HdDataSizeOfFormat(format), 0);
+    if (!_clearValue.IsEmpty()) { Clear(_clearValue); }
+    return true;
 }
 
-unsigned int HdAiRenderBuffer::GetWidth() const { return 0; }
+unsigned int HdAiRenderBuffer::GetWidth() const { return _width; }
 
-unsigned int HdAiRenderBuffer::GetHeight() const { return 0; }
+unsigned int HdAiRenderBuffer::GetHeight() const { return _height; }
 
-unsigned int HdAiRenderBuffer::GetDepth() const { return 0; }
+unsigned int HdAiRenderBuffer::GetDepth() const { return 1; }
 
-HdFormat HdAiRenderBuffer::GetFormat() const { return HdFormatUNorm8; }
+HdFormat HdAiRenderBuffer::GetFormat() const { return _format; }
 
+// Arnold filters the samples for us, so we never expose a multi sampled
+// buffer.
 bool HdAiRenderBuffer::IsMultiSampled() const { return false; }
 
-uint8_t* HdAiRenderBuffer::Map() { return nullptr; }
+uint8_t* HdAiRenderBuffer::Map() {
+    _mappers++;
+    return _buffer.data();
+}
 
-void HdAiRenderBuffer::Unmap() {}
+void HdAiRenderBuffer::Unmap() { _mappers--; }
 
-bool HdAiRenderBuffer::IsMapped() const { return false; }
+bool HdAiRenderBuffer::IsMapped() const { return _mappers.load() != 0; }
 
 void HdAiRenderBuffer::Resolve() {}
 
-bool HdAiRenderBuffer::IsConverged() const { return false; }
+bool HdAiRenderBuffer::IsConverged() const { return _converged.load(); }
+
+void HdAiRenderBuffer::SetConverged(bool converged) { _converged = converged; }
+
+void HdAiRenderBuffer::WriteBucket(
+    int bucketXO, int bucketYO, int bucketWidth, int bucketHeight,
+    HdFormat format, const void* bucketData, int scale) {
+    if (scale < 1) { return; }
+    const auto width = static_cast<int>(_width);
+    const auto height = static_cast<int>(_height);
+    // Size of the downscaled image the bucket belongs to.
+    const auto scaledWidth = (width + scale - 1) / scale;
+    const auto scaledHeight = (height + scale - 1) / scale;
+    const auto xo = std::max(0, bucketXO);
+    const auto xe = std::min(scaledWidth, bucketXO + bucketWidth);
+    if (xe <= xo) { return; }
+    const auto yo = std::max(0, bucketYO);
+    const auto ye = std::min(scaledHeight, bucketYO + bucketHeight);
+    if (ye <= yo) { return; }
+    const auto fromComponents = HdGetComponentCount(format);
+    switch (HdGetComponentFormat(format)) {
+        case HdFormatFloat32:
+            _WriteBucket<float>(
+                _buffer.data(), width, height, _format, xo, xe, yo, ye,
+                bucketXO, bucketYO, bucketWidth, bucketData, fromComponents,
+                scale);
+            break;
+        case HdFormatInt32:
+            _WriteBucket<int>(
+                _buffer.data(), width, height, _format, xo, xe, yo, ye,
+                bucketXO, bucketYO, bucketWidth, bucketData, fromComponents,
+                scale);
+            break;
+        default:
+            TF_CODING_ERROR("Unsupported bucket format.");
+    }
+}
 
-void HdAiRenderBuffer::_Deallocate() {}
+void HdAiRenderBuffer::Clear(const VtValue& value) {
+    _clearValue = value;
+    if (_buffer.empty()) { return; }
+    const auto width = static_cast<int>(_width);
+    // We convert a single row to the buffer format, then replicate it.
+    if (value.IsHolding<int>()) {
+        std::vector<int> row(_width, value.UncheckedGet<int>());
+        WriteBucket(0, 0, width, 1, HdFormatInt32, row.data());
+    } else {
+        GfVec4f pixel(0.0f);
+        if (value.IsHolding<float>()) {
+            pixel[0] = value.UncheckedGet<float>();
+        } else if (value.IsHolding<GfVec2f>()) {
+            const auto& v = value.UncheckedGet<GfVec2f>();
+            pixel = GfVec4f(v[0], v[1], 0.0f, 0.0f);
+        } else if (value.IsHolding<GfVec3f>()) {
+            const auto& v = value.UncheckedGet<GfVec3f>();
+            pixel = GfVec4f(v[0], v[1], v[2], 0.0f);
+        } else if (value.IsHolding<GfVec4f>()) {
+            pixel = value.UncheckedGet<GfVec4f>();
+        }
+        std::vector<GfVec4f> row(_width, pixel);
+        WriteBucket(0, 0, width, 1, HdFormatFloat32Vec4, row.data());
+    }
+    // WriteBucket flips the rows, so the converted row is the last one.
+    const auto rowSize = _width * HdDataSizeOfFormat(_format);
+    const auto* lastRow = _buffer.data() + rowSize * (_height - 1);
+    for (auto y = decltype(_height){0}; y < _height - 1; ++y) {
+        memcpy(_buffer.data() + rowSize * y, lastRow, rowSize);
+    }
+}
+
+void HdAiRenderBuffer::_Deallocate() {
+    // Bprims are synced and finalized while Arnold is rendering, and the
+    // driver writes to the buffer from the render threads.
+    if (!_buffer.empty() && _renderParam != nullptr) {
+        _renderParam->Interrupt();
+    }
+    _width = 0;
+    _height = 0;
+    _format = HdFormatInvalid;
+    _buffer.clear();
+    _buffer.shrink_to_fit();
+    _converged = false;
+}
 
 PXR_NAMESPACE_CLOSE_SCOPE
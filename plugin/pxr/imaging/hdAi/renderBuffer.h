@@ -17,17 +17,27 @@
 #include <pxr/pxr.h>
 #include "pxr/imaging/hdAi/api.h"
 
+#include <pxr/base/vt/value.h>
 #include <pxr/imaging/hd/renderBuffer.h>
 
+#include "pxr/imaging/hdAi/renderParam.h"
+
+#include <atomic>
+#include <vector>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdAiRenderBuffer : public HdRenderBuffer {
 public:
+    /// @p renderParam is interrupted before the buffer is reallocated or
+    /// freed, as the driver might be writing to it.
     HDAI_API
-    HdAiRenderBuffer(const SdfPath& id);
+    HdAiRenderBuffer(HdAiRenderParam* renderParam, const SdfPath& id);
     HDAI_API
     ~HdAiRenderBuffer() override = default;
 
+    /// Allocates the buffer and fills it with the last value passed to
+    /// Clear.
     HDAI_API
     bool Allocate(
         const GfVec3i& dimensions, HdFormat format, bool multiSampled) override;
@@ -53,9 +63,43 @@ public:
     HDAI_API
     bool IsConverged() const override;
 
+    /// Sets the convergence state of the buffer, called by the render pass.
+    HDAI_API
+    void SetConverged(bool converged);
+
+    /// Writes a bucket coming from Arnold into the buffer.
+    ///
+    /// The bucket is flipped vertically and converted from @p format to the
+    /// format of the buffer, components missing from the source are set to
+    /// zero. Buckets are disjoint, so this is safe to call from multiple
+    /// threads, as long as the buffer is not reallocated in the meantime.
+    ///
+    /// When @p scale is larger than one, the bucket comes from an image
+    /// downscaled by @p scale, and each of its pixels is replicated to cover
+    /// scale by scale pixels of the buffer.
+    HDAI_API
+    void WriteBucket(
+        int bucketXO, int bucketYO, int bucketWidth, int bucketHeight,
+        HdFormat format, const void* bucketData, int scale = 1);
+
+    /// Fills the whole buffer with @p value, converted to the buffer format.
+    /// The value is kept, and used again when the buffer is reallocated.
+    HDAI_API
+    void Clear(const VtValue& value);
+
 protected:
     HDAI_API
     void _Deallocate() override;
+
+private:
+    HdAiRenderParam* _renderParam;
+    std::vector<uint8_t> _buffer;
+    VtValue _clearValue;
+    unsigned int _width = 0;
+    unsigned int _height = 0;
+    HdFormat _format = HdFormatInvalid;
+    std::atomic<int> _mappers{0};
+    std::atomic<bool> _converged{false};
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
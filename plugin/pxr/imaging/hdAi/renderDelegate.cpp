@@ -13,7 +13,8 @@
 // limitations under the License.
 #include "pxr/imaging/hdAi/renderDelegate.h"
 
-#include <pxr/base/tf/getenv.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/vec4f.h>
 
 #include <pxr/imaging/glf/glew.h>
 #include <pxr/imaging/hd/bprim.h>
@@ -21,16 +22,20 @@
 #include <pxr/imaging/hd/instancer.h>
 #include <pxr/imaging/hd/resourceRegistry.h>
 #include <pxr/imaging/hd/rprim.h>
+#include <pxr/imaging/hd/sceneDelegate.h>
 #include <pxr/imaging/hd/tokens.h>
 
+#include "pxr/imaging/hdAi/basisCurves.h"
 #include "pxr/imaging/hdAi/config.h"
+#include "pxr/imaging/hdAi/instancer.h"
 #include "pxr/imaging/hdAi/light.h"
 #include "pxr/imaging/hdAi/material.h"
 #include "pxr/imaging/hdAi/mesh.h"
-#include "pxr/imaging/hdAi/nodes/nodes.h"
 #include "pxr/imaging/hdAi/openvdbAsset.h"
+#include "pxr/imaging/hdAi/points.h"
 #include "pxr/imaging/hdAi/renderBuffer.h"
 #include "pxr/imaging/hdAi/renderPass.h"
+#include "pxr/imaging/hdAi/session.h"
 #include "pxr/imaging/hdAi/volume.h"
 
 #include <unordered_map>
@@ -38,7 +43,10 @@
 
 PXR_NAMESPACE_OPEN_SCOPE
 
-TF_DEFINE_PRIVATE_TOKENS(_tokens, (openvdbAsset));
+TF_DEFINE_PRIVATE_TOKENS(
+    _tokens,
+    (openvdbAsset)(target_frame_time)(shutter_start)(shutter_end)(
+        subdiv_polygon_budget));
 
 namespace {
 // The following patters might look a bit weird at first glance, but
@@ -145,8 +153,9 @@ bool _SetNodeParam(AtNode* node, const TfToken& key, const VtValue& value) {
 }
 
 inline const TfTokenVector& _SupportedRprimTypes() {
-    static const TfTokenVector r{HdPrimTypeTokens->mesh,
-                                 HdPrimTypeTokens->volume};
+    static const TfTokenVector r{
+        HdPrimTypeTokens->mesh, HdPrimTypeTokens->volume,
+        HdPrimTypeTokens->points, HdPrimTypeTokens->basisCurves};
     return r;
 }
 
@@ -173,20 +182,20 @@ HdResourceRegistrySharedPtr HdAiRenderDelegate::_resourceRegistry;
 
 HdAiRenderDelegate::HdAiRenderDelegate() {
     _id = SdfPath(TfToken(TfStringPrintf("/HdAiRenderDelegate_%p", this)));
-    if (AiUniverseIsActive()) {
-        TF_CODING_ERROR("There is already an active Arnold universe!");
-    }
-    AiBegin(AI_SESSION_INTERACTIVE);
-    std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
-    if (_counterResourceRegistry.fetch_add(1) == 0) {
-        _resourceRegistry.reset(new HdResourceRegistry());
+    {
+        std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
+        if (_counterResourceRegistry.fetch_add(1) == 0) {
+            _resourceRegistry.reset(new HdResourceRegistry());
+        }
     }
-    AiMsgSetConsoleFlags(AI_LOG_WARNINGS | AI_LOG_ERRORS);
-    hdAiInstallNodes();
-    const auto arnoldPluginPath = TfGetenv("ARNOLD_PLUGIN_PATH");
-    if (!arnoldPluginPath.empty()) { AiLoadPlugins(arnoldPluginPath.c_str()); }
 
-    _universe = nullptr;
+    _universe = HdAiSession::GetInstance().AcquireUniverse();
+    if (_universe != nullptr) {
+        TF_WARN(
+            "The default Arnold universe is already used by another render "
+            "delegate, %s won't render.",
+            _id.GetText());
+    }
 
     _options = AiUniverseGetOptions(_universe);
     for (const auto& o : _DefaultValueOverrides()) {
@@ -196,23 +205,31 @@ HdAiRenderDelegate::HdAiRenderDelegate() {
     _fallbackShader = AiNode(_universe, "utility");
     AiNodeSetStr(_fallbackShader, "shade_mode", "ambocc");
     AiNodeSetStr(_fallbackShader, "color_mode", "color");
-    auto* userDataReader = AiNode(_universe, "user_data_rgba");
-    AiNodeSetStr(userDataReader, "attribute", "color");
-    AiNodeSetRGBA(userDataReader, "default", 1.0f, 1.0f, 1.0f, 1.0f);
-    AiNodeLink(userDataReader, "color", _fallbackShader);
-
-    _renderParam.reset(new HdAiRenderParam());
+    _fallbackUserData = AiNode(_universe, "user_data_rgba");
+    AiNodeSetStr(_fallbackUserData, "attribute", "color");
+    AiNodeSetRGBA(_fallbackUserData, "default", 1.0f, 1.0f, 1.0f, 1.0f);
+    AiNodeLink(_fallbackUserData, "color", _fallbackShader);
+
+    _renderParam.reset(new HdAiRenderParam(_universe == nullptr));
+    _targetFrameTime = HdAiConfig::GetInstance().target_frame_time;
+    _shutter = GfVec2f(
+        HdAiConfig::GetInstance().shutter_start,
+        HdAiConfig::GetInstance().shutter_end);
+    _subdivBudget.SetBudget(static_cast<size_t>(
+        HdAiConfig::GetInstance().subdiv_polygon_budget));
 }
 
 HdAiRenderDelegate::~HdAiRenderDelegate() {
+    _renderParam->End();
+    // The prims and the render passes destroy their own nodes, the default
+    // universe is shared with the rest of the process, so it is only reset.
+    AiNodeDestroy(_fallbackShader);
+    AiNodeDestroy(_fallbackUserData);
+    HdAiSession::GetInstance().ReleaseUniverse(_universe);
     std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
     if (_counterResourceRegistry.fetch_sub(1) == 1) {
         _resourceRegistry.reset();
     }
-    _renderParam->End();
-    hdAiUninstallNodes();
-    AiUniverseDestroy(_universe);
-    AiEnd();
 }
 
 HdRenderParam* HdAiRenderDelegate::GetRenderParam() const {
@@ -220,7 +237,25 @@ HdRenderParam* HdAiRenderDelegate::GetRenderParam() const {
 }
 
 void HdAiRenderDelegate::CommitResources(HdChangeTracker* tracker) {
-    TF_UNUSED(tracker);
+    // All the rprims are synced at this point, so the recorded node edits can
+    // be applied from a single thread.
+    if (_nodeEditJournal.HasEdits()) {
+        _renderParam->Interrupt();
+        _nodeEditJournal.Commit();
+    }
+    // Instanced meshes with new geometry need a full sync to get their own
+    // geometry back.
+    for (const auto& id : _meshCache.TakeResyncRequests()) {
+        tracker->MarkRprimDirty(id, HdAiMeshCache::resyncDirtyBits);
+    }
+    // The motion keys are distributed over the shutter, so they have to be
+    // rebuilt on the next sync.
+    _dirtyMaterialsCollected = false;
+    if (_shutterChanged) {
+        _shutterChanged = false;
+        tracker->MarkAllRprimsDirty(
+            HdChangeTracker::DirtyTransform | HdChangeTracker::DirtyPoints);
+    }
 }
 
 const TfTokenVector& HdAiRenderDelegate::GetSupportedRprimTypes() const {
@@ -237,10 +272,60 @@ const TfTokenVector& HdAiRenderDelegate::GetSupportedBprimTypes() const {
 
 void HdAiRenderDelegate::SetRenderSetting(
     const TfToken& key, const VtValue& value) {
-    if (_SetNodeParam(_options, key, value)) { _renderParam->End(); }
+    // Not an Arnold option, the render pass picks it up on the next frame.
+    if (key == _tokens->target_frame_time) {
+        if (value.IsHolding<float>()) {
+            _targetFrameTime = value.UncheckedGet<float>();
+        } else if (value.IsHolding<double>()) {
+            _targetFrameTime =
+                static_cast<float>(value.UncheckedGet<double>());
+        } else if (value.IsHolding<int>()) {
+            _targetFrameTime = static_cast<float>(value.UncheckedGet<int>());
+        }
+        _targetFrameTime = std::max(0.0f, _targetFrameTime);
+        return;
+    }
+    // The shutter is used by the camera and for the motion keys of the prims.
+    if (key == _tokens->shutter_start || key == _tokens->shutter_end) {
+        auto shutter = _shutter;
+        auto& v = key == _tokens->shutter_start ? shutter[0] : shutter[1];
+        if (value.IsHolding<float>()) {
+            v = value.UncheckedGet<float>();
+        } else if (value.IsHolding<double>()) {
+            v = static_cast<float>(value.UncheckedGet<double>());
+        }
+        if (shutter != _shutter) {
+            _renderParam->Interrupt();
+            _shutter = shutter;
+            _shutterChanged = true;
+        }
+        return;
+    }
+    // Applied by the render pass, which knows the size of the meshes on
+    // screen.
+    if (key == _tokens->subdiv_polygon_budget) {
+        if (value.IsHolding<int>()) {
+            _renderParam->Interrupt();
+            _subdivBudget.SetBudget(static_cast<size_t>(
+                std::max(0, value.UncheckedGet<int>())));
+        }
+        return;
+    }
+    if (_SetNodeParam(_options, key, value)) {
+        _renderParam->Interrupt();
+    }
 }
 
 VtValue HdAiRenderDelegate::GetRenderSetting(const TfToken& key) const {
+    if (key == _tokens->target_frame_time) {
+        return VtValue(_targetFrameTime);
+    } else if (key == _tokens->shutter_start) {
+        return VtValue(_shutter[0]);
+    } else if (key == _tokens->shutter_end) {
+        return VtValue(_shutter[1]);
+    } else if (key == _tokens->subdiv_polygon_budget) {
+        return VtValue(static_cast<int>(_subdivBudget.GetBudget()));
+    }
     const auto* nentry = AiNodeGetNodeEntry(_options);
     const auto* pentry = AiNodeEntryLookUpParameter(nentry, key.GetText());
     if (pentry == nullptr) { return {}; }
@@ -304,6 +389,24 @@ HdRenderSettingDescriptorList HdAiRenderDelegate::GetRenderSettingDescriptors()
         ret.push_back(desc);
     }
     AiParamIteratorDestroy(piter);
+    HdRenderSettingDescriptor desc;
+    desc.name = "Target Frame Time (ms)";
+    desc.key = _tokens->target_frame_time;
+    desc.defaultValue = VtValue(HdAiConfig::GetInstance().target_frame_time);
+    ret.push_back(desc);
+    desc.name = "Shutter Start";
+    desc.key = _tokens->shutter_start;
+    desc.defaultValue = VtValue(HdAiConfig::GetInstance().shutter_start);
+    ret.push_back(desc);
+    desc.name = "Shutter End";
+    desc.key = _tokens->shutter_end;
+    desc.defaultValue = VtValue(HdAiConfig::GetInstance().shutter_end);
+    ret.push_back(desc);
+    desc.name = "Subdivision Polygon Budget";
+    desc.key = _tokens->subdiv_polygon_budget;
+    desc.defaultValue =
+        VtValue(HdAiConfig::GetInstance().subdiv_polygon_budget);
+    ret.push_back(desc);
     return ret;
 }
 
@@ -318,10 +421,7 @@ HdRenderPassSharedPtr HdAiRenderDelegate::CreateRenderPass(
 
 HdInstancer* HdAiRenderDelegate::CreateInstancer(
     HdSceneDelegate* delegate, const SdfPath& id, const SdfPath& instancerId) {
-    TF_UNUSED(delegate);
-    TF_UNUSED(id);
-    TF_UNUSED(instancerId);
-    return nullptr;
+    return new HdAiInstancer(this, delegate, id, instancerId);
 }
 
 void HdAiRenderDelegate::DestroyInstancer(HdInstancer* instancer) {
@@ -330,25 +430,33 @@ void HdAiRenderDelegate::DestroyInstancer(HdInstancer* instancer) {
 
 HdRprim* HdAiRenderDelegate::CreateRprim(
     const TfToken& typeId, const SdfPath& rprimId, const SdfPath& instancerId) {
-    _renderParam->End();
+    _renderParam->Interrupt();
     if (typeId == HdPrimTypeTokens->mesh) {
         return new HdAiMesh(this, rprimId, instancerId);
     }
     if (typeId == HdPrimTypeTokens->volume) {
         return new HdAiVolume(this, rprimId, instancerId);
     }
+    if (typeId == HdPrimTypeTokens->points) {
+        return new HdAiPoints(this, rprimId, instancerId);
+    }
+    if (typeId == HdPrimTypeTokens->basisCurves) {
+        return new HdAiBasisCurves(this, rprimId, instancerId);
+    }
     TF_CODING_ERROR("Unknown Rprim Type %s", typeId.GetText());
     return nullptr;
 }
 
 void HdAiRenderDelegate::DestroyRprim(HdRprim* rPrim) {
-    _renderParam->End();
+    _renderParam->Interrupt();
+    // Recorded edits might reference the nodes of the rprim.
+    _nodeEditJournal.Commit();
     delete rPrim;
 }
 
 HdSprim* HdAiRenderDelegate::CreateSprim(
     const TfToken& typeId, const SdfPath& sprimId) {
-    _renderParam->End();
+    _renderParam->Interrupt();
     if (typeId == HdPrimTypeTokens->camera) { return new HdCamera(sprimId); }
     if (typeId == HdPrimTypeTokens->material) {
         return new HdAiMaterial(this, sprimId);
@@ -405,14 +513,14 @@ HdSprim* HdAiRenderDelegate::CreateFallbackSprim(const TfToken& typeId) {
 }
 
 void HdAiRenderDelegate::DestroySprim(HdSprim* sPrim) {
-    _renderParam->End();
+    _renderParam->Interrupt();
     delete sPrim;
 }
 
 HdBprim* HdAiRenderDelegate::CreateBprim(
     const TfToken& typeId, const SdfPath& bprimId) {
     if (typeId == HdPrimTypeTokens->renderBuffer) {
-        return new HdAiRenderBuffer(bprimId);
+        return new HdAiRenderBuffer(_renderParam.get(), bprimId);
     }
     if (typeId == _tokens->openvdbAsset) {
         return new HdAiOpenvdbAsset(this, bprimId);
@@ -423,7 +531,7 @@ HdBprim* HdAiRenderDelegate::CreateBprim(
 
 HdBprim* HdAiRenderDelegate::CreateFallbackBprim(const TfToken& typeId) {
     if (typeId == HdPrimTypeTokens->renderBuffer) {
-        return new HdAiRenderBuffer(SdfPath());
+        return new HdAiRenderBuffer(_renderParam.get(), SdfPath());
     }
     if (typeId == _tokens->openvdbAsset) {
         return new HdAiOpenvdbAsset(this, SdfPath());
@@ -438,16 +546,84 @@ TfToken HdAiRenderDelegate::GetMaterialBindingPurpose() const {
     return HdTokens->full;
 }
 
+HdAovDescriptor HdAiRenderDelegate::GetDefaultAovDescriptor(
+    const TfToken& name) const {
+    if (name == HdAovTokens->color) {
+        return HdAovDescriptor(
+            HdFormatFloat32Vec4, false, VtValue(GfVec4f(0.0f)));
+    }
+    if (name == HdAovTokens->depth) {
+        return HdAovDescriptor(HdFormatFloat32, false, VtValue(1.0f));
+    }
+    if (name == HdAovTokens->primId || name == HdAovTokens->instanceId ||
+        name == HdAovTokens->elementId) {
+        return HdAovDescriptor(HdFormatInt32, false, VtValue(-1));
+    }
+    if (name == HdAovTokens->normal) {
+        return HdAovDescriptor(
+            HdFormatFloat32Vec3, false, VtValue(GfVec3f(0.0f)));
+    }
+    // Light path expressions and the built-in Arnold AOVs are colors.
+    return HdAovDescriptor(HdFormatFloat32Vec3, false, VtValue(GfVec3f(0.0f)));
+}
+
 AtString HdAiRenderDelegate::GetLocalNodeName(const AtString& name) const {
     return AtString(_id.AppendChild(TfToken(name.c_str())).GetText());
 }
 
 AtUniverse* HdAiRenderDelegate::GetUniverse() const { return _universe; }
 
+HdAiNodeEditJournal& HdAiRenderDelegate::GetNodeEditJournal() {
+    return _nodeEditJournal;
+}
+
+HdAiMaterialBindings& HdAiRenderDelegate::GetMaterialBindings() {
+    return _materialBindings;
+}
+
+HdAiMeshCache& HdAiRenderDelegate::GetMeshCache() { return _meshCache; }
+
+HdAiShaderCache& HdAiRenderDelegate::GetShaderCache() { return _shaderCache; }
+
+HdAiSubdivBudget& HdAiRenderDelegate::GetSubdivBudget() {
+    return _subdivBudget;
+}
+
 AtNode* HdAiRenderDelegate::GetOptions() const { return _options; }
 
+const SdfPathVector& HdAiRenderDelegate::GetDirtyMaterials(
+    HdSceneDelegate* sceneDelegate) {
+    if (_dirtyMaterialsCollected) { return _dirtyMaterials; }
+    _dirtyMaterialsCollected = true;
+    auto& renderIndex = sceneDelegate->GetRenderIndex();
+    auto& changeTracker = renderIndex.GetChangeTracker();
+    const auto& root = sceneDelegate->GetDelegateID();
+    const auto version = changeTracker.GetSprimIndexVersion();
+    if (root != _materialsRoot || version != _materialsVersion) {
+        _materialsRoot = root;
+        _materialsVersion = version;
+        _materials =
+            renderIndex.GetSprimSubtree(HdPrimTypeTokens->material, root);
+    }
+    _dirtyMaterials.clear();
+    for (const auto& id : _materials) {
+        if (changeTracker.GetSprimDirtyBits(id) & HdMaterial::DirtyResource) {
+            _dirtyMaterials.push_back(id);
+        }
+    }
+    return _dirtyMaterials;
+}
+
 AtNode* HdAiRenderDelegate::GetFallbackShader() const {
     return _fallbackShader;
 }
 
+const GfVec2f& HdAiRenderDelegate::GetShutterRange() const {
+    return _shutter;
+}
+
+float HdAiRenderDelegate::GetTargetFrameTime() const {
+    return _targetFrameTime;
+}
+
 PXR_NAMESPACE_CLOSE_SCOPE
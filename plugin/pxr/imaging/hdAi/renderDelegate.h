@@ -17,11 +17,19 @@
 #include <pxr/pxr.h>
 #include "pxr/imaging/hdAi/api.h"
 
+#include <pxr/base/gf/vec2f.h>
+
+#include <pxr/imaging/hd/aov.h>
 #include <pxr/imaging/hd/renderDelegate.h>
 #include <pxr/imaging/hd/renderThread.h>
 #include <pxr/imaging/hd/resourceRegistry.h>
 
+#include "pxr/imaging/hdAi/materialBindings.h"
+#include "pxr/imaging/hdAi/meshCache.h"
+#include "pxr/imaging/hdAi/nodeEditJournal.h"
 #include "pxr/imaging/hdAi/renderParam.h"
+#include "pxr/imaging/hdAi/shaderCache.h"
+#include "pxr/imaging/hdAi/subdivBudget.h"
 
 #include <ai.h>
 
@@ -82,19 +90,61 @@ public:
     void CommitResources(HdChangeTracker* tracker) override;
     HDAI_API
     TfToken GetMaterialBindingPurpose() const override;
+    HDAI_API
+    HdAovDescriptor GetDefaultAovDescriptor(
+        TfToken const& name) const override;
 
     HDAI_API
     AtString GetLocalNodeName(const AtString& name) const;
 
+    /// Returns the universe of the delegate, nullptr if the delegate owns the
+    /// default universe.
     HDAI_API
     AtUniverse* GetUniverse() const;
 
     HDAI_API
     AtNode* GetOptions() const;
 
+    /// Returns the journal rprims record their node edits into during Sync.
+    HDAI_API
+    HdAiNodeEditJournal& GetNodeEditJournal();
+
+    /// Returns the materials bound to the rprims.
+    HDAI_API
+    HdAiMaterialBindings& GetMaterialBindings();
+
+    /// Returns the cache deduplicating the geometry of the meshes.
+    HDAI_API
+    HdAiMeshCache& GetMeshCache();
+
+    /// Returns the cache sharing shader nodes between the materials.
+    HDAI_API
+    HdAiShaderCache& GetShaderCache();
+
+    /// Returns the budget limiting the polygons of the subdivided meshes.
+    HDAI_API
+    HdAiSubdivBudget& GetSubdivBudget();
+
+    /// Returns the materials of @p sceneDelegate with a dirty resource at
+    /// the start of the sync pass. They are collected by the first call of
+    /// each pass.
+    HDAI_API
+    const SdfPathVector& GetDirtyMaterials(HdSceneDelegate* sceneDelegate);
+
     HDAI_API
     AtNode* GetFallbackShader() const;
 
+    /// Returns the target time of the first pass after a camera change in
+    /// milliseconds, or zero if the render pass should not adapt the
+    /// resolution.
+    HDAI_API
+    float GetTargetFrameTime() const;
+
+    /// Returns the shutter range set by the shutter_start and shutter_end
+    /// render settings, relative to the current frame.
+    HDAI_API
+    const GfVec2f& GetShutterRange() const;
+
 private:
     static std::mutex _mutexResourceRegistry;
     static std::atomic_int _counterResourceRegistry;
@@ -103,10 +153,26 @@ private:
     HdAiRenderDelegate& operator=(const HdAiRenderDelegate&) = delete;
 
     std::unique_ptr<HdAiRenderParam> _renderParam;
+    HdAiNodeEditJournal _nodeEditJournal;
+    HdAiMaterialBindings _materialBindings;
+    HdAiMeshCache _meshCache;
+    HdAiShaderCache _shaderCache;
+    HdAiSubdivBudget _subdivBudget;
     SdfPath _id;
     AtUniverse* _universe;
     AtNode* _options;
     AtNode* _fallbackShader;
+    AtNode* _fallbackUserData;
+    GfVec2f _shutter;
+    float _targetFrameTime = 0.0f;
+    // Materials of the scene delegate, updated when sprims are inserted or
+    // removed, and the ones dirty in the current sync pass.
+    SdfPath _materialsRoot;
+    SdfPathVector _materials;
+    unsigned int _materialsVersion = 0;
+    SdfPathVector _dirtyMaterials;
+    bool _dirtyMaterialsCollected = false;
+    bool _shutterChanged = false;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
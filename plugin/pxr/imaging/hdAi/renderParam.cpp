@@ -13,38 +13,70 @@
 // limitations under the License.
 #include "pxr/imaging/hdAi/renderParam.h"
 
+#include "pxr/imaging/hdAi/debugCodes.h"
+
 #include <ai.h>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
 bool HdAiRenderParam::Render() {
+    _lastFrame.edits = _edits.exchange(0);
+    _lastFrame.interrupts = _interrupts.exchange(0);
+    _lastFrame.ends = _ends.exchange(0);
+    if (_lastFrame.edits != 0 || _lastFrame.ends != 0) {
+        TF_DEBUG(HDAI_RENDER)
+            .Msg(
+                "HdAiRenderParam: %u edits, %u interrupts, %u ended "
+                "sessions.\n",
+                _lastFrame.edits, _lastFrame.interrupts, _lastFrame.ends);
+    }
+    // Nothing is ever rendered without the render session, so the render
+    // never converges.
+    if (!_ownsRenderSession) { return false; }
     const auto status = AiRenderGetStatus();
     if (status == AI_RENDER_STATUS_NOT_STARTED) {
         AiRenderBegin();
         return false;
     }
     if (status == AI_RENDER_STATUS_PAUSED) {
+        _needsRestart = false;
         AiRenderRestart();
         return false;
     }
-    if (status == AI_RENDER_STATUS_FINISHED) { return true; }
+    if (status == AI_RENDER_STATUS_FINISHED) {
+        if (_needsRestart.exchange(false)) {
+            AiRenderRestart();
+            return false;
+        }
+        return true;
+    }
     if (status == AI_RENDER_STATUS_RESTARTING) { return false; }
     AiRenderBegin();
     return false;
 }
 
-void HdAiRenderParam::Restart() {
+void HdAiRenderParam::Interrupt() {
+    _edits++;
+    if (!_ownsRenderSession) { return; }
+    // The render stays paused until the next call to Render, so only the
+    // first edit of a sync pays for the interrupt.
+    std::lock_guard<std::mutex> guard(_mutex);
     const auto status = AiRenderGetStatus();
-    if (status != AI_RENDER_STATUS_NOT_STARTED) {
-        if (status == AI_RENDER_STATUS_RENDERING) {
-            AiRenderInterrupt(AI_BLOCKING);
-        } else if (status == AI_RENDER_STATUS_FINISHED) {
-            AiRenderRestart();
-        }
+    if (status == AI_RENDER_STATUS_RENDERING ||
+        status == AI_RENDER_STATUS_RESTARTING) {
+        AiRenderInterrupt(AI_BLOCKING);
+        _interrupts++;
+    } else if (status == AI_RENDER_STATUS_FINISHED) {
+        // Restarting right away would let the Arnold threads write to the
+        // buffers while the caller is still modifying the scene.
+        _needsRestart = true;
     }
 }
 
 void HdAiRenderParam::End() {
+    if (!_ownsRenderSession) { return; }
+    std::lock_guard<std::mutex> guard(_mutex);
+    _needsRestart = false;
     const auto status = AiRenderGetStatus();
     if (status != AI_RENDER_STATUS_NOT_STARTED) {
         if (status == AI_RENDER_STATUS_RENDERING ||
@@ -52,6 +84,7 @@ void HdAiRenderParam::End() {
             AiRenderAbort(AI_BLOCKING);
         }
         AiRenderEnd();
+        _ends++;
     }
 }
 
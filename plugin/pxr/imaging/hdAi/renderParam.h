@@ -18,15 +18,55 @@
 
 #include <pxr/imaging/hd/renderDelegate.h>
 
+#include <atomic>
+#include <mutex>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdAiRenderParam final : public HdRenderParam {
 public:
+    /// @p ownsRenderSession is false when the render delegate does not own the
+    /// default universe, in which case the render session is never touched.
+    explicit HdAiRenderParam(bool ownsRenderSession = true)
+        : _ownsRenderSession(ownsRenderSession) {}
     ~HdAiRenderParam() override = default;
 
+    /// Returns true if this render param drives the Arnold render session.
+    bool OwnsRenderSession() const { return _ownsRenderSession; }
+
+    /// Starts or restarts the render if needed, returns true if the render
+    /// has converged. Always returns false without the render session.
     bool Render();
-    void Restart();
+    /// Stops the Arnold threads so the scene can be edited.
+    ///
+    /// All the edits between two calls to Render are gathered in a single
+    /// transaction, only the first call interrupts the render and the render
+    /// is restarted once, by the next call to Render. Safe to call from
+    /// multiple threads.
+    void Interrupt();
+    /// Ends the render session. Only required when the outputs of the render
+    /// change, scene edits should use Interrupt.
     void End();
+
+    /// Number of scene edits, interrupts and ended sessions since the last
+    /// call to Render.
+    struct Counters {
+        unsigned int edits = 0;
+        unsigned int interrupts = 0;
+        unsigned int ends = 0;
+    };
+
+    /// Returns the counters of the last frame.
+    const Counters& GetLastFrameCounters() const { return _lastFrame; }
+
+private:
+    std::mutex _mutex;
+    std::atomic<bool> _needsRestart{false};
+    std::atomic<unsigned int> _edits{0};
+    std::atomic<unsigned int> _interrupts{0};
+    std::atomic<unsigned int> _ends{0};
+    Counters _lastFrame;
+    const bool _ownsRenderSession;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -11,12 +11,11 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
-/*
- * TODO:
- * - Writing to the render buffers directly.
- */
 #include "pxr/imaging/hdAi/renderPass.h"
 
+#include <pxr/base/gf/vec4f.h>
+
+#include <pxr/imaging/hd/aov.h>
 #include <pxr/imaging/hd/renderPassState.h>
 
 #include "pxr/imaging/hdAi/config.h"
@@ -40,12 +39,35 @@ const AtString name("name");
 const AtString gaussian_filter("gaussian_filter");
 const AtString closest_filter("closest_filter");
 const AtString outputs("outputs");
+const AtString light_path_expressions("light_path_expressions");
+const AtString RGBA("RGBA");
+const AtString P("P");
+const AtString ID("ID");
+const AtString N("N");
 const AtString shutter_start("shutter_start");
 const AtString shutter_end("shutter_end");
 const AtString fov("fov");
 const AtString xres("xres");
 const AtString yres("yres");
+const AtString bucket_size("bucket_size");
 } // namespace Str
+
+// Largest factor the resolution is divided by when rendering interactively.
+constexpr int maxResolutionScale = 16;
+
+const char* _GetArnoldType(HdFormat format) {
+    if (HdGetComponentFormat(format) == HdFormatInt32) { return "INT"; }
+    switch (HdGetComponentCount(format)) {
+        case 1:
+            return "FLOAT";
+        case 2:
+            return "VECTOR2";
+        case 3:
+            return "RGB";
+        default:
+            return "RGBA";
+    }
+}
 } // namespace
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -70,22 +92,22 @@ HdAiRenderPass::HdAiRenderPass(
     _driver = AiNode(universe, HdAiNodeNames::driver);
     AiNodeSetStr(
         _driver, Str::name, _delegate->GetLocalNodeName(Str::renderPassDriver));
+    _SetupOutputs({});
+    const auto& config = HdAiConfig::GetInstance();
     auto* options = _delegate->GetOptions();
-    auto* outputsArray = AiArrayAllocate(2, 1, AI_TYPE_STRING);
-    const auto beautyString = TfStringPrintf(
-        "RGBA RGBA %s %s", AiNodeGetName(_beautyFilter),
-        AiNodeGetName(_driver));
-    // We need NDC, and the easiest way is to use the position.
-    const auto positionString = TfStringPrintf(
-        "P VECTOR %s %s", AiNodeGetName(_closestFilter),
-        AiNodeGetName(_driver));
-    AiArraySetStr(outputsArray, 0, beautyString.c_str());
-    AiArraySetStr(outputsArray, 1, positionString.c_str());
-    AiNodeSetArray(options, Str::outputs, outputsArray);
+    const auto bucketSize = AiNodeGetInt(options, Str::bucket_size);
+    _bucketQueue.Reset(
+        AiNodeGetInt(options, Str::xres), AiNodeGetInt(options, Str::yres),
+        bucketSize);
+    AiNodeSetPtr(_driver, HdAiDriver::bucketQueue, &_bucketQueue);
+    AiNodeSetPtr(_driver, HdAiDriver::passCount, &_passCount);
+    if (config.direct_framebuffer) {
+        AiNodeSetPtr(_driver, HdAiDriver::framebuffer, &_framebuffer);
+    }
 
-    const auto& config = HdAiConfig::GetInstance();
-    AiNodeSetFlt(_camera, Str::shutter_start, config.shutter_start);
-    AiNodeSetFlt(_camera, Str::shutter_end, config.shutter_end);
+    _shutter = _delegate->GetShutterRange();
+    AiNodeSetFlt(_camera, Str::shutter_start, _shutter[0]);
+    AiNodeSetFlt(_camera, Str::shutter_end, _shutter[1]);
 }
 
 HdAiRenderPass::~HdAiRenderPass() {
@@ -105,11 +127,21 @@ void HdAiRenderPass::_Execute(
     const auto projMtx = renderPassState->GetProjectionMatrix();
     const auto viewMtx = renderPassState->GetWorldToViewMatrix();
     auto restarted = false;
+    auto cameraChanged = false;
+    const auto& shutter = _delegate->GetShutterRange();
+    if (shutter != _shutter) {
+        renderParam->Interrupt();
+        restarted = true;
+        _shutter = shutter;
+        AiNodeSetFlt(_camera, Str::shutter_start, _shutter[0]);
+        AiNodeSetFlt(_camera, Str::shutter_end, _shutter[1]);
+    }
     if (projMtx != _projMtx || viewMtx != _viewMtx) {
         _projMtx = projMtx;
         _viewMtx = viewMtx;
-        renderParam->Restart();
+        renderParam->Interrupt();
         restarted = true;
+        cameraChanged = true;
         AiNodeSetMatrix(
             _camera, Str::matrix, HdAiConvertMatrix(_viewMtx.GetInverse()));
         AiNodeSetMatrix(
@@ -121,59 +153,122 @@ void HdAiRenderPass::_Execute(
         AiNodeSetFlt(_camera, Str::fov, fov);
     }
 
+    // The subdivision budget is distributed by the size of the meshes on
+    // screen.
+    auto& subdivBudget = _delegate->GetSubdivBudget();
+    if (subdivBudget.IsDirty() ||
+        (cameraChanged && subdivBudget.GetBudget() != 0)) {
+        if (!restarted) {
+            renderParam->Interrupt();
+            restarted = true;
+        }
+        subdivBudget.Apply(_viewMtx * _projMtx);
+    }
+
+    const auto& aovBindings = renderPassState->GetAovBindings();
+    if (aovBindings != _aovBindings) {
+        // Changing the outputs requires a new render session.
+        renderParam->End();
+        restarted = true;
+        _bucketQueue.Clear();
+        _aovBindings = aovBindings;
+        _SetupOutputs(_aovBindings);
+    }
+
+    // The slots of the queue are sized for the largest bucket.
+    const auto bucketSize =
+        AiNodeGetInt(_delegate->GetOptions(), Str::bucket_size);
+    const auto bucketSizeChanged =
+        bucketSize != _bucketQueue.GetBucketSize();
+    if (bucketSizeChanged) {
+        renderParam->End();
+        restarted = true;
+    }
+
     const auto width = static_cast<int>(vp[2]);
     const auto height = static_cast<int>(vp[3]);
-    const auto numPixels = static_cast<size_t>(width * height);
-    if (width != _width || height != _height) {
-        if (!restarted) { renderParam->Restart(); }
-        hdAiEmptyBucketQueue([](const HdAiBucketData*) {});
-        const auto oldNumPixels = static_cast<size_t>(_width * _height);
+    const auto scale = _UpdateResolutionScale(cameraChanged);
+    if (width != _width || height != _height || scale != _resolutionScale) {
+        if (!restarted) {
+            renderParam->Interrupt();
+            restarted = true;
+        }
+        _bucketQueue.Clear();
         _width = width;
         _height = height;
+        _resolutionScale = scale;
 
+        // The render buffers upscale the buckets themselves, and the
+        // compositor stretches the framebuffer over the viewport.
+        const auto renderWidth = (_width + scale - 1) / scale;
+        const auto renderHeight = (_height + scale - 1) / scale;
         auto* options = _delegate->GetOptions();
-        AiNodeSetInt(options, Str::xres, _width);
-        AiNodeSetInt(options, Str::yres, _height);
-
-        if (oldNumPixels < numPixels) {
-            _colorBuffer.resize(numPixels, AtRGBA8());
-            _depthBuffer.resize(numPixels, 1.0f);
-            memset(_colorBuffer.data(), 0, oldNumPixels * sizeof(AtRGBA8));
-            std::fill(
-                _depthBuffer.begin(), _depthBuffer.begin() + oldNumPixels,
-                1.0f);
-        } else {
-            if (numPixels != oldNumPixels) {
-                _colorBuffer.resize(numPixels);
-                _depthBuffer.resize(numPixels);
-            }
-            memset(_colorBuffer.data(), 0, numPixels * sizeof(AtRGBA8));
-            std::fill(_depthBuffer.begin(), _depthBuffer.end(), 1.0f);
+        AiNodeSetInt(options, Str::xres, renderWidth);
+        AiNodeSetInt(options, Str::yres, renderHeight);
+        AiNodeSetInt(_driver, HdAiDriver::scale, scale);
+
+        const auto numPixels = static_cast<size_t>(renderWidth * renderHeight);
+        _framebuffer.color.assign(numPixels, AtRGBA8());
+        _framebuffer.depth.assign(numPixels, 1.0f);
+        _framebuffer.width = renderWidth;
+        _framebuffer.height = renderHeight;
+        _framebuffer.dirty = false;
+    }
+
+    // There is a slot for every bucket of a pass, the buckets the render
+    // thread falls behind on are overwritten by the following passes.
+    const auto queueWidth = (_width + _resolutionScale - 1) / _resolutionScale;
+    const auto queueHeight =
+        (_height + _resolutionScale - 1) / _resolutionScale;
+    if (bucketSizeChanged || !_bucketQueue.Covers(queueWidth, queueHeight)) {
+        if (!restarted) {
+            renderParam->Interrupt();
+            restarted = true;
+        }
+        _bucketQueue.Reset(queueWidth, queueHeight, bucketSize);
+    }
+
+    // Arnold reports convergence for the downscaled image too.
+    _isConverged = renderParam->Render() && _resolutionScale == 1;
+    if (!renderParam->OwnsRenderSession()) {
+        _DrawSessionError();
+        return;
+    }
+    // The driver is writing directly to the render buffers, there is nothing
+    // left to copy or composite.
+    if (!_aovBindings.empty()) {
+        for (const auto& binding : _aovBindings) {
+            auto* buffer = static_cast<HdAiRenderBuffer*>(binding.renderBuffer);
+            if (buffer != nullptr) { buffer->SetConverged(_isConverged); }
         }
+        return;
     }
 
-    _isConverged = renderParam->Render();
-    bool needsUpdate = false;
-    hdAiEmptyBucketQueue([this, &needsUpdate](const HdAiBucketData* data) {
-        const auto xo = AiClamp(data->xo, 0, _width - 1);
-        const auto xe = AiClamp(data->xo + data->sizeX, 0, _width - 1);
+    // The driver is either writing directly to the framebuffer, or queueing
+    // the buckets for us to copy.
+    auto needsUpdate = _framebuffer.dirty.exchange(false);
+    const auto fbWidth = _framebuffer.width;
+    const auto fbHeight = _framebuffer.height;
+    _bucketQueue.Drain([&](const HdAiBucketData& data) {
+        const auto xo = AiClamp(data.xo, 0, fbWidth);
+        const auto xe = AiClamp(data.xo + data.sizeX, 0, fbWidth);
         if (xe == xo) { return; }
-        const auto yo = AiClamp(data->yo, 0, _height - 1);
-        const auto ye = AiClamp(data->yo + data->sizeY, 0, _height - 1);
+        const auto yo = AiClamp(data.yo, 0, fbHeight);
+        const auto ye = AiClamp(data.yo + data.sizeY, 0, fbHeight);
         if (ye == yo) { return; }
         needsUpdate = true;
         const auto beautyWidth = (xe - xo) * sizeof(AtRGBA8);
         const auto depthWidth = (xe - xo) * sizeof(float);
-        const auto inOffsetG = xo - data->xo - data->sizeX * data->yo;
-        const auto outOffsetG = _width * (_height - 1);
+        const auto inOffsetG = xo - data.xo - data.sizeX * data.yo;
+        const auto outOffsetG = fbWidth * (fbHeight - 1);
         for (auto y = yo; y < ye; ++y) {
-            const auto inOffset = data->sizeX * y + inOffsetG;
-            const auto outOffset = xo + outOffsetG - _width * y;
+            const auto inOffset = data.sizeX * y + inOffsetG;
+            const auto outOffset = xo + outOffsetG - fbWidth * y;
             memcpy(
-                _colorBuffer.data() + outOffset, data->beauty.data() + inOffset,
+                _framebuffer.color.data() + outOffset, data.beauty + inOffset,
                 beautyWidth);
             memcpy(
-                _depthBuffer.data() + outOffset, data->depth.data() + inOffset,
+                _framebuffer.depth.data() + outOffset, data.depth + inOffset,
                 depthWidth);
         }
     });
@@ -181,11 +276,178 @@ void HdAiRenderPass::_Execute(
     // If the buffers are empty, needsUpdate will be false.
     if (needsUpdate) {
         _compositor.UpdateColor(
-            _width, _height, reinterpret_cast<uint8_t*>(_colorBuffer.data()));
+            fbWidth, fbHeight,
+            reinterpret_cast<uint8_t*>(_framebuffer.color.data()));
         _compositor.UpdateDepth(
-            _width, _height, reinterpret_cast<uint8_t*>(_depthBuffer.data()));
+            fbWidth, fbHeight,
+            reinterpret_cast<uint8_t*>(_framebuffer.depth.data()));
     }
     _compositor.Draw();
 }
 
+void HdAiRenderPass::_DrawSessionError() {
+    // Another render delegate owns the render session, so we show an
+    // explicit error instead of an empty image.
+    const GfVec4f errorColor(1.0f, 0.0f, 1.0f, 1.0f);
+    if (!_aovBindings.empty()) {
+        for (const auto& binding : _aovBindings) {
+            auto* buffer = static_cast<HdAiRenderBuffer*>(binding.renderBuffer);
+            if (buffer == nullptr) { continue; }
+            if (binding.aovName == HdAovTokens->color) {
+                buffer->Clear(VtValue(errorColor));
+            } else {
+                buffer->Clear(binding.clearValue);
+            }
+            buffer->SetConverged(false);
+        }
+        return;
+    }
+    const auto fbWidth = _framebuffer.width;
+    const auto fbHeight = _framebuffer.height;
+    const auto numPixels = static_cast<size_t>(fbWidth * fbHeight);
+    if (numPixels != 0) {
+        AtRGBA8 pixel;
+        pixel.r = 255;
+        pixel.g = 0;
+        pixel.b = 255;
+        pixel.a = 255;
+        _framebuffer.color.assign(numPixels, pixel);
+        _framebuffer.depth.assign(numPixels, 1.0f);
+        _compositor.UpdateColor(
+            fbWidth, fbHeight,
+            reinterpret_cast<uint8_t*>(_framebuffer.color.data()));
+        _compositor.UpdateDepth(
+            fbWidth, fbHeight,
+            reinterpret_cast<uint8_t*>(_framebuffer.depth.data()));
+    }
+    _compositor.Draw();
+}
+
+int HdAiRenderPass::_UpdateResolutionScale(bool cameraChanged) {
+    const auto targetFrameTime = _delegate->GetTargetFrameTime();
+    if (targetFrameTime <= 0.0f) {
+        _interactiveScale = 1;
+        return 1;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration<float, std::milli>(
+                             now - _cameraChangeTime)
+                             .count();
+    const auto passCount = _passCount.load();
+    const auto firstPassDone = passCount != _cameraChangePassCount;
+    // Halving the scale quadruples the number of pixels to render, so we
+    // only lower it when the first pass is well below the target.
+    if (!_firstPassTimed && (firstPassDone || elapsed > targetFrameTime)) {
+        _firstPassTimed = true;
+        if (elapsed > targetFrameTime) {
+            _interactiveScale =
+                std::min(maxResolutionScale, _interactiveScale * 2);
+        } else if (elapsed * 4.0f < targetFrameTime) {
+            _interactiveScale = std::max(1, _interactiveScale / 2);
+        }
+    }
+    if (cameraChanged) {
+        _cameraChangeTime = now;
+        _cameraChangePassCount = passCount;
+        _firstPassTimed = false;
+        return _interactiveScale;
+    }
+    // Once the camera rests, we switch to the full resolution, and the
+    // progressive passes of Arnold take care of increasing the samples.
+    if (_resolutionScale > 1 && firstPassDone && elapsed >= targetFrameTime) {
+        return 1;
+    }
+    return _resolutionScale;
+}
+
+void HdAiRenderPass::_SetupOutputs(
+    const HdRenderPassAovBindingVector& aovBindings) {
+    std::vector<std::string> outputs;
+    std::vector<std::string> lightPathExpressions;
+    const auto* beautyFilter = AiNodeGetName(_beautyFilter);
+    const auto* closestFilter = AiNodeGetName(_closestFilter);
+    const auto* driver = AiNodeGetName(_driver);
+    auto addOutput = [&](const char* name, const char* type,
+                         const char* filter) {
+        auto output = TfStringPrintf("%s %s %s %s", name, type, filter, driver);
+        if (std::find(outputs.begin(), outputs.end(), output) ==
+            outputs.end()) {
+            outputs.push_back(std::move(output));
+        }
+    };
+    _driverAovs.clear();
+    if (aovBindings.empty()) {
+        addOutput("RGBA", "RGBA", beautyFilter);
+        // We need NDC, and the easiest way is to use the position.
+        addOutput("P", "VECTOR", closestFilter);
+    }
+    for (const auto& binding : aovBindings) {
+        auto* buffer = static_cast<HdAiRenderBuffer*>(binding.renderBuffer);
+        if (buffer == nullptr) { continue; }
+        buffer->Clear(binding.clearValue);
+        HdAiDriverAov aov;
+        aov.buffer = buffer;
+        if (binding.aovName == HdAovTokens->color) {
+            aov.outputName = Str::RGBA;
+            addOutput("RGBA", "RGBA", beautyFilter);
+        } else if (binding.aovName == HdAovTokens->depth) {
+            aov.outputName = Str::P;
+            aov.type = HdAiDriverAov::Type::Depth;
+            addOutput("P", "VECTOR", closestFilter);
+        } else if (binding.aovName == HdAovTokens->primId) {
+            // Shapes store their prim id offset by one in the id parameter.
+            aov.outputName = Str::ID;
+            aov.type = HdAiDriverAov::Type::PrimId;
+            addOutput("ID", "UINT", closestFilter);
+        } else if (binding.aovName == HdAovTokens->normal) {
+            aov.outputName = Str::N;
+            addOutput("N", "VECTOR", closestFilter);
+        } else {
+            const HdParsedAovToken parsedAov(binding.aovName);
+            // Instancing is handled by Arnold, and we have no equivalent of
+            // the element and instance ids or arbitrary primvar AOVs, so
+            // these are left at their clear value.
+            if (parsedAov.isPrimvar ||
+                binding.aovName == HdAovTokens->instanceId ||
+                binding.aovName == HdAovTokens->elementId) {
+                continue;
+            }
+            const auto format = buffer->GetFormat();
+            const auto isInt = HdGetComponentFormat(format) == HdFormatInt32;
+            if (parsedAov.isLpe) {
+                const auto name =
+                    TfStringPrintf("HdAiLpe%lu", lightPathExpressions.size());
+                lightPathExpressions.push_back(TfStringPrintf(
+                    "%s %s", name.c_str(), parsedAov.name.GetText()));
+                aov.outputName = AtString(name.c_str());
+            } else {
+                // Everything else, including AOVs described by UsdAiAOV, is
+                // passed to Arnold as is.
+                aov.outputName = AtString(parsedAov.name.GetText());
+            }
+            addOutput(
+                aov.outputName.c_str(), _GetArnoldType(format),
+                isInt ? closestFilter : beautyFilter);
+        }
+        _driverAovs.push_back(aov);
+    }
+
+    auto* options = _delegate->GetOptions();
+    auto* outputsArray = AiArrayAllocate(outputs.size(), 1, AI_TYPE_STRING);
+    for (auto i = decltype(outputs.size()){0}; i < outputs.size(); ++i) {
+        AiArraySetStr(outputsArray, i, outputs[i].c_str());
+    }
+    AiNodeSetArray(options, Str::outputs, outputsArray);
+    auto* lpeArray =
+        AiArrayAllocate(lightPathExpressions.size(), 1, AI_TYPE_STRING);
+    for (auto i = decltype(lightPathExpressions.size()){0};
+         i < lightPathExpressions.size(); ++i) {
+        AiArraySetStr(lpeArray, i, lightPathExpressions[i].c_str());
+    }
+    AiNodeSetArray(options, Str::light_path_expressions, lpeArray);
+    AiNodeSetPtr(
+        _driver, HdAiDriver::aovs,
+        _driverAovs.empty() ? nullptr : &_driverAovs);
+}
+
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -18,14 +18,20 @@
 #include "pxr/imaging/hdAi/api.h"
 
 #include <pxr/base/gf/matrix4d.h>
+#include <pxr/base/gf/vec2f.h>
 #include <pxr/imaging/hd/renderPass.h>
+#include <pxr/imaging/hd/renderPassState.h>
 #include <pxr/imaging/hdx/compositor.h>
 
 #include "pxr/imaging/hdAi/nodes/nodes.h"
+#include "pxr/imaging/hdAi/renderBuffer.h"
 #include "pxr/imaging/hdAi/renderDelegate.h"
 
 #include <ai.h>
 
+#include <atomic>
+#include <chrono>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdAiRenderPass : public HdRenderPass {
@@ -46,22 +52,52 @@ protected:
         const TfTokenVector& renderTags) override;
 
 private:
-    std::vector<AtRGBA8> _colorBuffer;
-    std::vector<float> _depthBuffer;
+    /// Builds the outputs of the options and the routing table of the driver
+    /// from the AOV bindings. Without any bindings, the beauty and the
+    /// position are rendered for the compositor.
+    void _SetupOutputs(const HdRenderPassAovBindingVector& aovBindings);
+
+    /// Fills the outputs with an error color, used when the render delegate
+    /// doesn't own the Arnold render session and can't render anything.
+    void _DrawSessionError();
+
+    /// Returns the factor the resolution is divided by for the next render.
+    ///
+    /// When the render delegate has a target frame time, camera changes are
+    /// rendered at a lower resolution, adapted so that the first pass stays
+    /// close to the target, and the full resolution is restored once the
+    /// camera rests.
+    int _UpdateResolutionScale(bool cameraChanged);
+
+    HdAiFramebuffer _framebuffer;
+    HdAiBucketQueue _bucketQueue;
     HdAiRenderDelegate* _delegate;
     AtNode* _camera = nullptr;
     AtNode* _beautyFilter = nullptr;
     AtNode* _closestFilter = nullptr;
     AtNode* _driver = nullptr;
 
+    // When there are AOV bindings, the driver writes directly into the bound
+    // render buffers and the compositor is skipped.
+    HdRenderPassAovBindingVector _aovBindings;
+    HdAiDriverAovs _driverAovs;
+
     HdxCompositor _compositor;
 
     GfMatrix4d _viewMtx;
     GfMatrix4d _projMtx;
+    GfVec2f _shutter;
 
     int _width = 0;
     int _height = 0;
 
+    std::chrono::steady_clock::time_point _cameraChangeTime;
+    std::atomic<unsigned int> _passCount{0};
+    unsigned int _cameraChangePassCount = 0;
+    int _resolutionScale = 1;
+    int _interactiveScale = 1;
+    bool _firstPassTimed = true;
+
     bool _isConverged = false;
 };
 
@@ -0,0 +1,81 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/session.h"
+
+#include <pxr/base/tf/diagnostic.h>
+#include <pxr/base/tf/getenv.h>
+#include <pxr/base/tf/instantiateSingleton.h>
+
+#include "pxr/imaging/hdAi/config.h"
+#include "pxr/imaging/hdAi/nodes/nodes.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+TF_INSTANTIATE_SINGLETON(HdAiSession);
+
+HdAiSession& HdAiSession::GetInstance() {
+    return TfSingleton<HdAiSession>::GetInstance();
+}
+
+AtUniverse* HdAiSession::AcquireUniverse() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (!_isActive) { _Begin(); }
+    ++_universeCount;
+    if (!_defaultUniverseInUse) {
+        _defaultUniverseInUse = true;
+        return nullptr;
+    }
+    return AiUniverse();
+}
+
+void HdAiSession::ReleaseUniverse(AtUniverse* universe) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (!TF_VERIFY(_universeCount > 0)) { return; }
+    if (universe == nullptr) {
+        _ResetDefaultUniverse();
+        _defaultUniverseInUse = false;
+    } else {
+        AiUniverseDestroy(universe);
+    }
+    if (--_universeCount == 0 &&
+        !HdAiConfig::GetInstance().persistent_session) {
+        _End();
+    }
+}
+
+void HdAiSession::_Begin() {
+    if (AiUniverseIsActive()) {
+        TF_CODING_ERROR("There is already an active Arnold universe!");
+    }
+    AiBegin(AI_SESSION_INTERACTIVE);
+    AiMsgSetConsoleFlags(AI_LOG_WARNINGS | AI_LOG_ERRORS);
+    hdAiInstallNodes();
+    const auto arnoldPluginPath = TfGetenv("ARNOLD_PLUGIN_PATH");
+    if (!arnoldPluginPath.empty()) { AiLoadPlugins(arnoldPluginPath.c_str()); }
+    _isActive = true;
+}
+
+void HdAiSession::_End() {
+    hdAiUninstallNodes();
+    AiEnd();
+    _isActive = false;
+}
+
+void HdAiSession::_ResetDefaultUniverse() {
+    // Every render delegate destroys the nodes it created, the rest of the
+    // default universe might belong to the host application.
+    AiNodeReset(AiUniverseGetOptions(nullptr));
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
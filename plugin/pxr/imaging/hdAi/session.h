@@ -0,0 +1,78 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_SESSION_H
+#define HDAI_SESSION_H
+
+#include <pxr/pxr.h>
+
+#include <pxr/base/tf/singleton.h>
+
+#include "pxr/imaging/hdAi/api.h"
+
+#include <ai.h>
+
+#include <mutex>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Manages the Arnold session shared by the render delegates of the process.
+///
+/// The session is started when the first universe is acquired, which installs
+/// the nodes of the render delegate and loads the plugins from
+/// ARNOLD_PLUGIN_PATH. By default the session ends when the last universe is
+/// released. When HDAI_persistent_session is enabled, the session is kept
+/// alive until the process exits, so recreating a render delegate doesn't
+/// pay for the startup again.
+class HdAiSession {
+public:
+    HDAI_API
+    static HdAiSession& GetInstance();
+
+    /// Returns a clean universe, starting the session if needed.
+    ///
+    /// Arnold 5 can only render the default universe. The first caller gets
+    /// it, represented by nullptr, and the rest get their own universe until
+    /// the default universe is released.
+    HDAI_API
+    AtUniverse* AcquireUniverse();
+
+    /// Releases a universe returned by AcquireUniverse. The options of the
+    /// default universe are reset, the nodes are left to the render delegate
+    /// that created them.
+    HDAI_API
+    void ReleaseUniverse(AtUniverse* universe);
+
+private:
+    HDAI_API
+    HdAiSession() = default;
+    ~HdAiSession() = default;
+    HdAiSession(const HdAiSession&) = delete;
+    HdAiSession(HdAiSession&&) = delete;
+    HdAiSession& operator=(const HdAiSession&) = delete;
+
+    void _Begin();
+    void _End();
+    void _ResetDefaultUniverse();
+
+    friend class TfSingleton<HdAiSession>;
+
+    std::mutex _mutex;
+    int _universeCount = 0;
+    bool _isActive = false;
+    bool _defaultUniverseInUse = false;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_SESSION_H
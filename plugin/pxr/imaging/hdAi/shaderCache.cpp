@@ -0,0 +1,64 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/shaderCache.h"
+
+#include <pxr/base/tf/diagnostic.h>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+AtNode* HdAiShaderCache::Acquire(uint64_t hash) {
+    const auto it = _entries.find(hash);
+    if (it == _entries.end()) { return nullptr; }
+    ++it->second.refCount;
+    return it->second.node;
+}
+
+void HdAiShaderCache::Add(uint64_t hash, AtNode* node) {
+    auto& entry = _entries[hash];
+    if (!TF_VERIFY(entry.node == nullptr)) { return; }
+    entry.node = node;
+    entry.refCount = 1;
+}
+
+void HdAiShaderCache::Release(uint64_t hash) {
+    const auto it = _entries.find(hash);
+    if (!TF_VERIFY(it != _entries.end())) { return; }
+    if (--it->second.refCount == 0) {
+        AiNodeDestroy(it->second.node);
+        _entries.erase(it);
+    }
+}
+
+bool HdAiShaderCache::IsUnique(uint64_t hash) const {
+    const auto it = _entries.find(hash);
+    return it != _entries.end() && it->second.refCount == 1;
+}
+
+bool HdAiShaderCache::Contains(uint64_t hash) const {
+    return _entries.find(hash) != _entries.end();
+}
+
+void HdAiShaderCache::Rehash(uint64_t from, uint64_t to) {
+    if (from == to) { return; }
+    const auto it = _entries.find(from);
+    if (!TF_VERIFY(
+            it != _entries.end() && it->second.refCount == 1 &&
+            !Contains(to))) {
+        return;
+    }
+    _entries[to] = it->second;
+    _entries.erase(from);
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
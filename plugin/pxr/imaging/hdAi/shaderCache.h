@@ -0,0 +1,88 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_SHADER_CACHE_H
+#define HDAI_SHADER_CACHE_H
+
+#include <pxr/pxr.h>
+#include "pxr/imaging/hdAi/api.h"
+
+#include <ai.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Shares the shader nodes of identical material sub-networks.
+///
+/// Shader nodes are keyed by a hash of their content: the type of the node,
+/// the values of its parameters and the hashes of the nodes linked to it.
+/// Materials with identical sub-networks, like the texture readers of the
+/// variants of a look, reference the same Arnold nodes, so the nodes and
+/// the texture handles are only created once.
+///
+/// Nodes are reference counted, and destroyed when the last material
+/// referencing them releases them. A node referenced only once can be
+/// edited in place by its material, which then rehashes it.
+///
+/// Not thread safe, used while syncing the materials.
+class HdAiShaderCache {
+public:
+    HdAiShaderCache() = default;
+    ~HdAiShaderCache() = default;
+
+    /// Returns the node with @p hash and adds a reference to it, or nullptr
+    /// if there is no such node.
+    HDAI_API
+    AtNode* Acquire(uint64_t hash);
+
+    /// Adds @p node with @p hash, referenced once.
+    HDAI_API
+    void Add(uint64_t hash, AtNode* node);
+
+    /// Removes a reference to the node with @p hash, and destroys the node
+    /// if it's no longer referenced.
+    HDAI_API
+    void Release(uint64_t hash);
+
+    /// Returns true if the node with @p hash is referenced only once, so it
+    /// can be edited in place.
+    HDAI_API
+    bool IsUnique(uint64_t hash) const;
+
+    /// Returns true if there is a node with @p hash.
+    HDAI_API
+    bool Contains(uint64_t hash) const;
+
+    /// Changes the hash of a node referenced only once, after it was edited
+    /// in place.
+    HDAI_API
+    void Rehash(uint64_t from, uint64_t to);
+
+private:
+    HdAiShaderCache(const HdAiShaderCache&) = delete;
+    HdAiShaderCache& operator=(const HdAiShaderCache&) = delete;
+
+    struct _Entry {
+        AtNode* node = nullptr;
+        size_t refCount = 0;
+    };
+
+    std::unordered_map<uint64_t, _Entry> _entries;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_SHADER_CACHE_H
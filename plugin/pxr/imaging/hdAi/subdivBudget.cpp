@@ -0,0 +1,153 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/imaging/hdAi/subdivBudget.h"
+
+#include <pxr/base/gf/range2d.h>
+#include <pxr/base/gf/vec4d.h>
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace {
+namespace Str {
+const AtString subdiv_iterations("subdiv_iterations");
+const AtString subdiv_adaptive_error("subdiv_adaptive_error");
+const AtString subdiv_adaptive_space("subdiv_adaptive_space");
+const AtString raster("raster");
+} // namespace Str
+
+// Edge length in pixels used by displaced meshes over the budget.
+constexpr float _budgetAdaptiveError = 1.0f;
+
+// Returns the fraction of the screen covered by the bounds of the mesh.
+double _GetScreenArea(
+    const HdAiSubdivRequest& request, const GfMatrix4d& viewProjection) {
+    if (request.extent.IsEmpty()) { return 0.0; }
+    const auto objectToClip = request.transform * viewProjection;
+    GfRange2d bounds;
+    for (auto i = 0u; i < 8; ++i) {
+        const auto& corner = request.extent.GetCorner(i);
+        const auto p =
+            GfVec4d(corner[0], corner[1], corner[2], 1.0) * objectToClip;
+        // Meshes crossing the near plane are treated as covering the screen.
+        if (p[3] <= 0.0) { return 1.0; }
+        bounds.UnionWith(GfVec2d(p[0] / p[3], p[1] / p[3]));
+    }
+    bounds.IntersectWith(GfRange2d(GfVec2d(-1.0), GfVec2d(1.0)));
+    if (bounds.IsEmpty()) { return 0.0; }
+    const auto size = bounds.GetSize();
+    // The clip space covers two units on both axes.
+    return size[0] * size[1] * 0.25;
+}
+
+// The first iteration splits every face into quads, one per face vertex,
+// and every further iteration splits each quad into four.
+double _GetNumPolygons(const HdAiSubdivRequest& request, uint8_t iterations) {
+    if (iterations == 0) { return static_cast<double>(request.numFaces); }
+    return std::ldexp(
+        static_cast<double>(request.numFaceVertices), 2 * (iterations - 1));
+}
+
+} // namespace
+
+void HdAiSubdivBudget::Update(
+    AtNode* polymesh, const HdAiSubdivRequest& request, bool isWritten) {
+    const auto inserted = _entries.emplace(polymesh, _Entry());
+    auto& entry = inserted.first->second;
+    entry.request = request;
+    // Apply only sets the settings that differ from the ones on the node, so
+    // they are only reset when the mesh rewrote them.
+    if (isWritten || inserted.second) {
+        entry.adaptiveError = request.adaptiveError;
+        entry.adaptiveSpace = request.adaptiveSpace;
+        entry.iterations = request.iterations;
+    }
+    if (_budget != 0) { _dirty = true; }
+}
+
+void HdAiSubdivBudget::Remove(AtNode* polymesh) {
+    if (_entries.erase(polymesh) != 0 && _budget != 0) { _dirty = true; }
+}
+
+void HdAiSubdivBudget::SetBudget(size_t budget) {
+    if (budget == _budget) { return; }
+    _budget = budget;
+    _dirty = true;
+}
+
+size_t HdAiSubdivBudget::GetBudget() const { return _budget; }
+
+bool HdAiSubdivBudget::IsDirty() const { return _dirty; }
+
+void HdAiSubdivBudget::Apply(const GfMatrix4d& viewProjection) {
+    _dirty = false;
+    std::vector<std::pair<AtNode*, _Entry*>> entries;
+    std::vector<double> areas;
+    entries.reserve(_entries.size());
+    areas.reserve(_entries.size());
+    auto totalArea = 0.0;
+    for (auto& it : _entries) {
+        if (AiNodeIsDisabled(it.first)) { continue; }
+        const auto area =
+            _budget == 0 ? 0.0
+                         : _GetScreenArea(it.second.request, viewProjection);
+        entries.emplace_back(it.first, &it.second);
+        areas.push_back(area);
+        totalArea += area;
+    }
+    for (auto i = decltype(entries.size()){0}; i < entries.size(); ++i) {
+        auto* polymesh = entries[i].first;
+        auto& entry = *entries[i].second;
+        const auto& request = entry.request;
+        auto iterations = request.iterations;
+        auto adaptiveError = request.adaptiveError;
+        auto adaptiveSpace = request.adaptiveSpace;
+        // Adaptive subdivision in raster space already limits the polygons
+        // to what's needed on screen.
+        const auto isRasterAdaptive = request.adaptiveError > 0.0f &&
+                                      request.adaptiveSpace == Str::raster;
+        if (_budget != 0 && !isRasterAdaptive) {
+            const auto share = totalArea > 0.0
+                                   ? static_cast<double>(_budget) * areas[i] /
+                                         totalArea
+                                   : 0.0;
+            while (iterations > 0 &&
+                   _GetNumPolygons(request, iterations) > share) {
+                --iterations;
+            }
+            if (iterations < request.iterations && request.displaced) {
+                iterations = request.iterations;
+                adaptiveError = _budgetAdaptiveError;
+                adaptiveSpace = Str::raster;
+            }
+        }
+        if (iterations != entry.iterations) {
+            entry.iterations = iterations;
+            AiNodeSetByte(polymesh, Str::subdiv_iterations, iterations);
+        }
+        if (adaptiveError != entry.adaptiveError) {
+            entry.adaptiveError = adaptiveError;
+            AiNodeSetFlt(polymesh, Str::subdiv_adaptive_error, adaptiveError);
+        }
+        if (adaptiveSpace != entry.adaptiveSpace) {
+            entry.adaptiveSpace = adaptiveSpace;
+            AiNodeSetStr(polymesh, Str::subdiv_adaptive_space, adaptiveSpace);
+        }
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
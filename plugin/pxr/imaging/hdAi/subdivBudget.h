@@ -0,0 +1,123 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef HDAI_SUBDIV_BUDGET_H
+#define HDAI_SUBDIV_BUDGET_H
+
+#include <pxr/pxr.h>
+#include "pxr/imaging/hdAi/api.h"
+
+#include <pxr/base/gf/matrix4d.h>
+#include <pxr/base/gf/range3d.h>
+
+#include <ai.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Subdivision settings requested by a mesh, and the size of the mesh.
+struct HdAiSubdivRequest {
+    /// Bounds of the mesh in object space.
+    GfRange3d extent;
+    /// Object to world transform of the mesh.
+    GfMatrix4d transform{1.0};
+    /// Number of faces of the base mesh.
+    size_t numFaces = 0;
+    /// Number of face vertices of the base mesh.
+    size_t numFaceVertices = 0;
+    /// Adaptive error of the mesh, zero when adaptive subdivision is off.
+    float adaptiveError = 0.0f;
+    /// Adaptive space of the mesh.
+    AtString adaptiveSpace{"raster"};
+    /// Subdivision iterations of the mesh.
+    uint8_t iterations = 0;
+    /// Whether the mesh has a displacement shader.
+    bool displaced = false;
+};
+
+/// Limits the number of polygons generated by subdividing the meshes.
+///
+/// The budget is shared by all the subdivided meshes, proportionally to
+/// the area they cover on screen. Meshes are subdivided with the highest
+/// number of iterations their share allows, up to the iterations they
+/// request. Displaced meshes need dense geometry where it's visible, so
+/// instead of lowering their iterations they switch to adaptive
+/// subdivision in raster space, and Arnold stops subdividing once the edges
+/// are smaller than a pixel.
+///
+/// Meshes set their requested settings on their polymesh, the budget only
+/// overrides them when it's applied. Disabled polymeshes, like the ones
+/// rendered through the mesh cache, are left untouched.
+///
+/// Not thread safe, used while committing the node edit journal and by the
+/// render pass.
+class HdAiSubdivBudget {
+public:
+    HdAiSubdivBudget() = default;
+    ~HdAiSubdivBudget() = default;
+
+    /// Updates the request of @p polymesh.
+    ///
+    /// @p isWritten is true when the requested settings were just set on the
+    /// node, otherwise the node keeps the settings last applied by the
+    /// budget.
+    HDAI_API
+    void Update(
+        AtNode* polymesh, const HdAiSubdivRequest& request, bool isWritten);
+
+    /// Removes @p polymesh before it's destroyed, or when it's no longer
+    /// subdivided.
+    HDAI_API
+    void Remove(AtNode* polymesh);
+
+    /// Sets the number of polygons shared by the meshes, zero disables the
+    /// budget.
+    HDAI_API
+    void SetBudget(size_t budget);
+
+    /// Returns the number of polygons shared by the meshes.
+    HDAI_API
+    size_t GetBudget() const;
+
+    /// Returns true if the budget has to be applied again.
+    HDAI_API
+    bool IsDirty() const;
+
+    /// Distributes the budget based on the size of the meshes on screen, and
+    /// updates the subdivision parameters of the polymeshes.
+    HDAI_API
+    void Apply(const GfMatrix4d& viewProjection);
+
+private:
+    HdAiSubdivBudget(const HdAiSubdivBudget&) = delete;
+    HdAiSubdivBudget& operator=(const HdAiSubdivBudget&) = delete;
+
+    struct _Entry {
+        HdAiSubdivRequest request;
+        // Settings currently on the polymesh.
+        float adaptiveError = 0.0f;
+        AtString adaptiveSpace;
+        uint8_t iterations = 0;
+    };
+
+    std::unordered_map<AtNode*, _Entry> _entries;
+    size_t _budget = 0;
+    bool _dirty = false;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDAI_SUBDIV_BUDGET_H
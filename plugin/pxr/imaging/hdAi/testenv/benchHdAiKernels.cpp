@@ -0,0 +1,146 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/pxr.h"
+#include "pxr/base/gf/frustum.h"
+#include "pxr/base/gf/matrix4f.h"
+#include "pxr/base/gf/vec3f.h"
+
+#include "pxr/imaging/hdAi/kernels.h"
+
+#include <ai.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+// Measures the per bucket cost of converting the beauty and the depth for
+// the compositor, comparing the kernels with the per pixel Arnold and Gf
+// calls the driver used before.
+
+constexpr auto numIterations = 2000;
+
+template <typename F>
+double timeBucket(F&& f) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (auto i = 0; i < numIterations; ++i) { f(); }
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() /
+           numIterations;
+}
+
+void benchBucketSize(int bucketSize, const GfMatrix4f& viewMtx,
+                     const GfMatrix4f& projMtx) {
+    const auto numPixels = static_cast<size_t>(bucketSize * bucketSize);
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<AtRGBA> beauty(numPixels);
+    std::vector<GfVec3f> p(numPixels);
+    for (auto i = decltype(numPixels){0}; i < numPixels; ++i) {
+        beauty[i] = AtRGBA(
+            std::abs(dist(gen)), std::abs(dist(gen)), std::abs(dist(gen)),
+            dist(gen) > -0.8f ? 1.0f : 0.0f);
+        p[i] = GfVec3f(dist(gen), dist(gen), dist(gen) * 10.0f - 20.0f);
+    }
+    std::vector<AtRGBA8> outBeauty(numPixels);
+    std::vector<float> outDepth(numPixels);
+    std::vector<GfHalf> outHalf(numPixels * 4);
+
+    const auto reference = timeBucket([&]() {
+        for (auto i = decltype(numPixels){0}; i < numPixels; ++i) {
+            const auto x = static_cast<int>(i) % bucketSize;
+            const auto y = static_cast<int>(i) / bucketSize;
+            const auto& in = beauty[i];
+            auto& out = outBeauty[i];
+            out.r = AiQuantize8bit(x, y, 0, in.r, true);
+            out.g = AiQuantize8bit(x, y, 1, in.g, true);
+            out.b = AiQuantize8bit(x, y, 2, in.b, true);
+            out.a = AiQuantize8bit(x, y, 3, in.a, true);
+            const auto pp = projMtx.Transform(viewMtx.Transform(p[i]));
+            outDepth[i] = std::max(-1.0f, std::min(1.0f, pp[2]));
+        }
+        for (auto i = decltype(numPixels){0}; i < numPixels; ++i) {
+            if (outBeauty[i].a == 0) { outDepth[i] = 1.0f - AI_EPSILON; }
+        }
+    });
+
+    const auto viewProjMtx = viewMtx * projMtx;
+    const HdAiDepthRange range{1.0f, 0.0f, -1.0f, 1.0f, 1.0f - AI_EPSILON};
+    const auto kernels = timeBucket([&]() {
+        for (auto y = 0; y < bucketSize; ++y) {
+            const auto offset = static_cast<size_t>(y * bucketSize);
+            HdAiQuantizeRGBA8(
+                &beauty[offset].r, &outBeauty[offset].r, bucketSize, 0, y);
+            HdAiProjectDepth(
+                viewProjMtx, p[offset].data(), &beauty[offset].r,
+                outDepth.data() + offset, bucketSize, range);
+        }
+    });
+
+    const auto half = timeBucket([&]() {
+        HdAiConvertFloatToHalf(&beauty[0].r, outHalf.data(), numPixels * 4);
+    });
+
+    printf(
+        "%2ix%-2i  per pixel calls: %9.3f us  kernels: %9.3f us  "
+        "float to half: %9.3f us\n",
+        bucketSize, bucketSize, reference, kernels, half);
+}
+
+// Measures narrowing double and half precision primvars to floats.
+void benchNarrowing(size_t count) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(-100.0, 100.0);
+    std::vector<double> doubles(count);
+    std::vector<GfHalf> halves(count);
+    for (auto i = decltype(count){0}; i < count; ++i) {
+        doubles[i] = dist(gen);
+        halves[i] = static_cast<float>(doubles[i]);
+    }
+    std::vector<float> out(count);
+    const auto reference = timeBucket([&]() {
+        for (auto i = decltype(count){0}; i < count; ++i) {
+            out[i] = static_cast<float>(doubles[i]);
+        }
+    });
+    const auto fromDouble = timeBucket([&]() {
+        HdAiConvertDoubleToFloat(doubles.data(), out.data(), count);
+    });
+    const auto fromHalf = timeBucket([&]() {
+        HdAiConvertHalfToFloat(halves.data(), out.data(), count);
+    });
+    printf(
+        "%7zu values  per value casts: %9.3f us  double to float: %9.3f us  "
+        "half to float: %9.3f us\n",
+        count, reference, fromDouble, fromHalf);
+}
+
+int main() {
+    AiBegin();
+    GfFrustum frustum;
+    frustum.SetPosition(GfVec3d(0.0, 0.0, 5.0));
+    const GfMatrix4f viewMtx(frustum.ComputeViewMatrix());
+    const GfMatrix4f projMtx(frustum.ComputeProjectionMatrix());
+    for (const auto bucketSize : {16, 32, 64}) {
+        benchBucketSize(bucketSize, viewMtx, projMtx);
+    }
+    for (const auto count : {size_t{4096}, size_t{65536}}) {
+        benchNarrowing(count);
+    }
+    AiEnd();
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/pxr.h"
+#include "pxr/base/vt/types.h"
+
+#include "pxr/imaging/hdAi/utils.h"
+
+#include <ai.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+// Measures the throughput of uploading mesh topology to Arnold, comparing the
+// bulk conversion with the per element calls the mesh used before.
+
+constexpr auto numIterations = 5;
+
+template <typename F>
+double timeUpload(F&& f) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (auto i = 0; i < numIterations; ++i) { AiArrayDestroy(f()); }
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() /
+           numIterations;
+}
+
+void benchIndexCount(size_t numIndices) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, 1 << 20);
+    VtIntArray indices(numIndices);
+    for (auto& index : indices) { index = dist(gen); }
+
+    const auto reference = timeUpload([&]() -> AtArray* {
+        auto* a = AiArrayAllocate(numIndices, 1, AI_TYPE_UINT);
+        for (auto i = decltype(numIndices){0}; i < numIndices; ++i) {
+            AiArraySetUInt(a, i, static_cast<unsigned int>(indices[i]));
+        }
+        return a;
+    });
+    const auto bulk =
+        timeUpload([&]() -> AtArray* { return HdAiConvertIndices(indices); });
+    const auto idxs = timeUpload([&]() -> AtArray* {
+        return HdAiGenerateIdxs(static_cast<unsigned int>(numIndices));
+    });
+
+    const auto throughput = [numIndices](double ms) -> double {
+        return static_cast<double>(numIndices) / (ms * 1000.0);
+    };
+    printf(
+        "%9zu indices  per element calls: %9.3f ms (%7.1f M/s)  "
+        "bulk: %9.3f ms (%7.1f M/s)  generated: %9.3f ms (%7.1f M/s)\n",
+        numIndices, reference, throughput(reference), bulk, throughput(bulk),
+        idxs, throughput(idxs));
+}
+
+int main() {
+    AiBegin();
+    for (const auto numIndices : {size_t{100000}, size_t{2000000},
+                                  size_t{20000000}}) {
+        benchIndexCount(numIndices);
+    }
+    AiEnd();
+    return 0;
+}
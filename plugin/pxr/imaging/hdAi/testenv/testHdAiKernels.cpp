@@ -0,0 +1,188 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/pxr.h"
+#include "pxr/base/gf/frustum.h"
+#include "pxr/base/gf/matrix4f.h"
+#include "pxr/base/gf/vec3f.h"
+
+#include "pxr/imaging/hdAi/kernels.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+// The kernels pick the widest SIMD implementation the CPU supports, and
+// process the remainder with the scalar code. The lengths cover the tails of
+// the 4 and 8 wide kernels, and the offsets move the data off the alignment
+// of the allocations.
+const std::vector<size_t> lengths{0,  1,  2,  3,  4,  5,  7,   8,  9,
+                                  15, 16, 17, 31, 33, 64, 100, 1027};
+const std::vector<size_t> offsets{0, 1, 3};
+
+constexpr float ditherMatrix[4][4] = {
+    {0.5f / 16.0f, 8.5f / 16.0f, 2.5f / 16.0f, 10.5f / 16.0f},
+    {12.5f / 16.0f, 4.5f / 16.0f, 14.5f / 16.0f, 6.5f / 16.0f},
+    {3.5f / 16.0f, 11.5f / 16.0f, 1.5f / 16.0f, 9.5f / 16.0f},
+    {15.5f / 16.0f, 7.5f / 16.0f, 13.5f / 16.0f, 5.5f / 16.0f}};
+
+uint8_t quantizeReference(float in, int x, int y) {
+    return static_cast<uint8_t>(
+        std::max(0.0f, std::min(1.0f, in)) * 255.0f +
+        ditherMatrix[y & 3][x & 3]);
+}
+
+std::vector<float> randomFloats(size_t count, float min, float max) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(min, max);
+    std::vector<float> ret(count);
+    for (auto& each : ret) { each = dist(gen); }
+    return ret;
+}
+
+TEST(HdAiKernels, QuantizeRGBA8) {
+    // Values outside of [0, 1] are clamped.
+    const auto in =
+        randomFloats((lengths.back() + offsets.back()) * 4, -0.5f, 1.5f);
+    for (const auto length : lengths) {
+        for (const auto offset : offsets) {
+            for (const auto x : {0, 1, 2, 3}) {
+                const auto y = static_cast<int>(length + offset);
+                std::vector<uint8_t> out(length * 4 + offset, 0);
+                HdAiQuantizeRGBA8(
+                    in.data() + offset, out.data() + offset, length, x, y);
+                for (auto i = decltype(length){0}; i < length * 4; ++i) {
+                    const auto px = x + static_cast<int>(i / 4);
+                    EXPECT_EQ(
+                        out[offset + i],
+                        quantizeReference(in[offset + i], px, y))
+                        << "length " << length << " offset " << offset
+                        << " index " << i;
+                }
+            }
+        }
+    }
+}
+
+TEST(HdAiKernels, ProjectDepth) {
+    GfFrustum frustum;
+    frustum.SetPosition(GfVec3d(0.0, 0.0, 5.0));
+    const GfMatrix4f viewProj(
+        frustum.ComputeViewMatrix() * frustum.ComputeProjectionMatrix());
+    const HdAiDepthRange range{0.5f, 0.5f, 0.0f, 1.0f, 1.0f};
+    const auto maxCount = lengths.back() + offsets.back();
+    const auto p = randomFloats(maxCount * 3, -10.0f, 2.0f);
+    auto rgba = randomFloats(maxCount * 4, 0.0f, 1.0f);
+    // Every third pixel is background.
+    for (auto i = decltype(maxCount){0}; i < maxCount; i += 3) {
+        rgba[i * 4 + 3] = 0.0f;
+    }
+    for (const auto length : lengths) {
+        for (const auto offset : offsets) {
+            const std::vector<const float*> alphas{
+                rgba.data() + offset * 4, nullptr};
+            for (const auto* alpha : alphas) {
+                std::vector<float> out(length + offset, -1.0f);
+                HdAiProjectDepth(
+                    viewProj, p.data() + offset * 3, alpha,
+                    out.data() + offset, length, range);
+                for (auto i = decltype(length){0}; i < length; ++i) {
+                    const auto* pp = p.data() + (offset + i) * 3;
+                    if (alpha != nullptr && alpha[i * 4 + 3] == 0.0f) {
+                        EXPECT_EQ(out[offset + i], range.background);
+                        continue;
+                    }
+                    const auto clip =
+                        viewProj.Transform(GfVec3f(pp[0], pp[1], pp[2]));
+                    const auto expected = std::max(
+                        range.min,
+                        std::min(
+                            range.max, clip[2] * range.scale + range.offset));
+                    // The SIMD kernels sum the matrix terms in a different
+                    // order.
+                    EXPECT_NEAR(out[offset + i], expected, 1e-5f)
+                        << "length " << length << " offset " << offset
+                        << " index " << i;
+                }
+            }
+        }
+    }
+}
+
+TEST(HdAiKernels, ConvertFloatToHalf) {
+    auto in = randomFloats(lengths.back() + offsets.back(), -1000.0f, 1000.0f);
+    // Values rounding to denormal halves.
+    for (auto i = decltype(in.size()){0}; i < in.size(); i += 5) {
+        in[i] *= 1e-8f;
+    }
+    for (const auto length : lengths) {
+        for (const auto offset : offsets) {
+            std::vector<GfHalf> out(length + offset);
+            HdAiConvertFloatToHalf(
+                in.data() + offset, out.data() + offset, length);
+            for (auto i = decltype(length){0}; i < length; ++i) {
+                EXPECT_EQ(
+                    out[offset + i].bits(), GfHalf(in[offset + i]).bits())
+                    << "length " << length << " offset " << offset
+                    << " index " << i;
+            }
+        }
+    }
+}
+
+TEST(HdAiKernels, ConvertDoubleToFloat) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(-1e6, 1e6);
+    std::vector<double> in(lengths.back() + offsets.back());
+    for (auto& each : in) { each = dist(gen); }
+    for (const auto length : lengths) {
+        for (const auto offset : offsets) {
+            std::vector<float> out(length + offset);
+            HdAiConvertDoubleToFloat(
+                in.data() + offset, out.data() + offset, length);
+            for (auto i = decltype(length){0}; i < length; ++i) {
+                EXPECT_EQ(out[offset + i], static_cast<float>(in[offset + i]))
+                    << "length " << length << " offset " << offset
+                    << " index " << i;
+            }
+        }
+    }
+}
+
+TEST(HdAiKernels, ConvertHalfToFloat) {
+    // Every bit pattern that isn't a NaN, including the denormals and the
+    // infinities.
+    std::vector<GfHalf> in;
+    for (auto bits = 0u; bits < 0x10000u; ++bits) {
+        GfHalf h;
+        h.setBits(static_cast<unsigned short>(bits));
+        if (!h.isNan()) { in.push_back(h); }
+    }
+    auto checkLength = [&](size_t length, size_t offset) {
+        std::vector<float> out(length + offset);
+        HdAiConvertHalfToFloat(in.data() + offset, out.data() + offset, length);
+        for (auto i = decltype(length){0}; i < length; ++i) {
+            EXPECT_EQ(out[offset + i], static_cast<float>(in[offset + i]))
+                << "length " << length << " offset " << offset << " index "
+                << i;
+        }
+    };
+    for (const auto length : lengths) {
+        for (const auto offset : offsets) { checkLength(length, offset); }
+    }
+    checkLength(in.size() - 1, 1);
+}
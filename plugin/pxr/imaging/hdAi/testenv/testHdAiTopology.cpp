@@ -0,0 +1,67 @@
+// Copyright 2019 Luma Pictures
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pxr/pxr.h"
+#include "pxr/base/vt/types.h"
+
+#include "pxr/imaging/hdAi/utils.h"
+
+#include <ai.h>
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+class HdAiTopology : public testing::Test {
+protected:
+    static void SetUpTestCase() { AiBegin(); }
+    static void TearDownTestCase() { AiEnd(); }
+};
+
+// The bulk conversions copy the whole array at once, and have to match the
+// per element calls.
+TEST_F(HdAiTopology, ConvertIndices) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, 1 << 20);
+    for (const auto numIndices : {size_t{0}, size_t{1}, size_t{7},
+                                  size_t{1027}, size_t{100000}}) {
+        VtIntArray indices(numIndices);
+        for (auto& index : indices) { index = dist(gen); }
+        auto* array = HdAiConvertIndices(indices);
+        ASSERT_NE(array, nullptr);
+        EXPECT_EQ(AiArrayGetType(array), AI_TYPE_UINT);
+        EXPECT_EQ(AiArrayGetNumKeys(array), 1u);
+        ASSERT_EQ(AiArrayGetNumElements(array), numIndices);
+        for (auto i = decltype(numIndices){0}; i < numIndices; ++i) {
+            EXPECT_EQ(
+                AiArrayGetUInt(array, i),
+                static_cast<unsigned int>(indices[i]));
+        }
+        AiArrayDestroy(array);
+    }
+}
+
+TEST_F(HdAiTopology, GenerateIdxs) {
+    for (const auto count : {0u, 1u, 7u, 1027u, 100000u}) {
+        auto* array = HdAiGenerateIdxs(count);
+        ASSERT_NE(array, nullptr);
+        EXPECT_EQ(AiArrayGetType(array), AI_TYPE_UINT);
+        ASSERT_EQ(AiArrayGetNumElements(array), count);
+        for (auto i = 0u; i < count; ++i) {
+            EXPECT_EQ(AiArrayGetUInt(array, i), i);
+        }
+        AiArrayDestroy(array);
+    }
+}
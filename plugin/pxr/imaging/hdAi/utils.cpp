@@ -13,126 +13,433 @@
 // limitations under the License.
 #include "pxr/imaging/hdAi/utils.h"
 
+#include <pxr/base/arch/hash.h>
+#include <pxr/base/gf/half.h>
 #include <pxr/base/gf/vec2f.h>
 
+#include <pxr/base/work/loops.h>
+
+#include <tbb/concurrent_unordered_map.h>
+
 #include <pxr/usd/sdf/assetPath.h>
 
+#include "pxr/imaging/hdAi/config.h"
+#include "pxr/imaging/hdAi/kernels.h"
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 TF_DEFINE_PRIVATE_TOKENS(
-    _tokens, (BOOL)(BYTE)(INT)(UINT)(FLOAT)(VECTOR2)(VECTOR)(RGB)(RGBA)(STRING)(
-                 constant)(uniform)(varying)(indexed)(
-                 (constantArray, "constant ARRAY")));
+    _tokens,
+    (BOOL)(BYTE)(INT)(UINT)(FLOAT)(VECTOR2)(VECTOR)(RGB)(RGBA)(STRING)(MATRIX)(
+        constant)(uniform)(varying)(indexed)(
+        (constantArray, "constant ARRAY")));
 
 namespace {
 
-inline bool _Declare(
-    AtNode* node, const TfToken& name, const TfToken& scope,
-    const TfToken& type) {
-    return AiNodeDeclare(
-        node, name.GetText(),
-        TfStringPrintf("%s %s", scope.GetText(), type.GetText()).c_str());
+// Large arrays are narrowed in parallel chunks.
+constexpr size_t _grainSize = 16384;
+
+inline void _Narrow(const double* in, float* out, size_t count) {
+    HdAiConvertDoubleToFloat(in, out, count);
+}
+
+inline void _Narrow(const GfHalf* in, float* out, size_t count) {
+    HdAiConvertHalfToFloat(in, out, count);
+}
+
+template <typename S>
+void _ParallelNarrow(const S* in, float* out, size_t count) {
+    if (count < _grainSize * 2) {
+        _Narrow(in, out, count);
+        return;
+    }
+    WorkParallelForN(
+        (count + _grainSize - 1) / _grainSize,
+        [in, out, count](size_t begin, size_t end) {
+            const auto first = begin * _grainSize;
+            const auto last = std::min(count, end * _grainSize);
+            _Narrow(in + first, out + first, last - first);
+        });
+}
+
+// Copies arrays with the same memory layout as the Arnold type.
+template <typename T>
+AtArray* _ConvertArray(const VtValue& value, uint8_t arnoldType) {
+    const auto& v = value.UncheckedGet<VtArray<T>>();
+    return AiArrayConvert(
+        static_cast<uint32_t>(v.size()), 1, arnoldType, v.cdata());
+}
+
+// Narrows arrays of double or half precision values with @p N components of
+// type S.
+template <typename T, typename S, size_t N>
+AtArray* _NarrowArray(const VtValue& value, uint8_t arnoldType) {
+    const auto& v = value.UncheckedGet<VtArray<T>>();
+    const auto count = static_cast<uint32_t>(v.size());
+    auto* a = AiArrayAllocate(count, 1, arnoldType);
+    if (count == 0) { return a; }
+    _ParallelNarrow(
+        reinterpret_cast<const S*>(v.cdata()),
+        static_cast<float*>(AiArrayMap(a)), count * N);
+    AiArrayUnmap(a);
+    return a;
+}
+
+inline const char* _GetCString(const std::string& v) { return v.c_str(); }
+
+inline const char* _GetCString(const TfToken& v) { return v.GetText(); }
+
+inline const char* _GetCString(const SdfAssetPath& v) {
+    return v.GetResolvedPath().empty() ? v.GetAssetPath().c_str()
+                                       : v.GetResolvedPath().c_str();
+}
+
+template <typename T>
+AtArray* _ConvertStringArray(const VtValue& value, uint8_t arnoldType) {
+    const auto& v = value.UncheckedGet<VtArray<T>>();
+    const auto count = static_cast<uint32_t>(v.size());
+    auto* a = AiArrayAllocate(count, 1, arnoldType);
+    for (auto i = decltype(count){0}; i < count; ++i) {
+        AiArraySetStr(a, i, _GetCString(v[i]));
+    }
+    return a;
+}
+
+// Describes how the arrays of a type are converted. The color type is used
+// for primvars with the color role.
+struct _ArrayConversion {
+    uint8_t arnoldType;
+    uint8_t colorType;
+    AtArray* (*convert)(const VtValue& value, uint8_t arnoldType);
+};
+
+// Same for the constant values.
+struct _ConstantConversion {
+    uint8_t arnoldType;
+    uint8_t colorType;
+    void (*set)(
+        AtNode* node, const AtString& name, const VtValue& value,
+        uint8_t arnoldType);
+};
+
+template <typename T>
+void _SetVec2(
+    AtNode* node, const AtString& name, const VtValue& value, uint8_t) {
+    const auto& v = value.UncheckedGet<T>();
+    AiNodeSetVec2(
+        node, name, static_cast<float>(v[0]), static_cast<float>(v[1]));
+}
+
+template <typename T>
+void _SetVec3(
+    AtNode* node, const AtString& name, const VtValue& value,
+    uint8_t arnoldType) {
+    const auto& v = value.UncheckedGet<T>();
+    const auto x = static_cast<float>(v[0]);
+    const auto y = static_cast<float>(v[1]);
+    const auto z = static_cast<float>(v[2]);
+    if (arnoldType == AI_TYPE_RGB) {
+        AiNodeSetRGB(node, name, x, y, z);
+    } else {
+        AiNodeSetVec(node, name, x, y, z);
+    }
 }
 
 template <typename T>
-inline uint32_t _DeclareAndConvertArray(
-    AtNode* node, const TfToken& name, const TfToken& scope,
-    const TfToken& type, uint8_t arnoldType, const VtValue& value) {
-    if (!_Declare(node, name, scope, type)) { return 0; }
+void _SetVec4(
+    AtNode* node, const AtString& name, const VtValue& value, uint8_t) {
     const auto& v = value.UncheckedGet<T>();
-    auto a = AiArrayConvert(v.size(), 1, arnoldType, v.data());
-    AiNodeSetArray(node, name.GetText(), a);
-    return AiArrayGetNumElements(a);
+    AiNodeSetRGBA(
+        node, name, static_cast<float>(v[0]), static_cast<float>(v[1]),
+        static_cast<float>(v[2]), static_cast<float>(v[3]));
+}
+
+template <typename T>
+void _SetMatrix(
+    AtNode* node, const AtString& name, const VtValue& value, uint8_t) {
+    AiNodeSetMatrix(node, name, HdAiConvertMatrix(value.UncheckedGet<T>()));
+}
+
+template <typename T>
+void _SetString(
+    AtNode* node, const AtString& name, const VtValue& value, uint8_t) {
+    AiNodeSetStr(node, name, _GetCString(value.UncheckedGet<T>()));
+}
+
+// The conversions are looked up by type, so the cost of the dispatch doesn't
+// depend on the number of supported types.
+const _ArrayConversion* _GetArrayConversion(const VtValue& value) {
+    static const std::unordered_map<std::type_index, _ArrayConversion>
+        conversions{
+            {typeid(VtBoolArray),
+             {AI_TYPE_BOOLEAN, AI_TYPE_BOOLEAN, _ConvertArray<bool>}},
+            {typeid(VtUCharArray),
+             {AI_TYPE_BYTE, AI_TYPE_BYTE, _ConvertArray<unsigned char>}},
+            {typeid(VtUIntArray),
+             {AI_TYPE_UINT, AI_TYPE_UINT, _ConvertArray<unsigned int>}},
+            {typeid(VtIntArray),
+             {AI_TYPE_INT, AI_TYPE_INT, _ConvertArray<int>}},
+            {typeid(VtFloatArray),
+             {AI_TYPE_FLOAT, AI_TYPE_FLOAT, _ConvertArray<float>}},
+            {typeid(VtDoubleArray),
+             {AI_TYPE_FLOAT, AI_TYPE_FLOAT, _NarrowArray<double, double, 1>}},
+            {typeid(VtHalfArray),
+             {AI_TYPE_FLOAT, AI_TYPE_FLOAT, _NarrowArray<GfHalf, GfHalf, 1>}},
+            {typeid(VtVec2fArray),
+             {AI_TYPE_VECTOR2, AI_TYPE_VECTOR2, _ConvertArray<GfVec2f>}},
+            {typeid(VtVec2dArray),
+             {AI_TYPE_VECTOR2, AI_TYPE_VECTOR2,
+              _NarrowArray<GfVec2d, double, 2>}},
+            {typeid(VtVec2hArray),
+             {AI_TYPE_VECTOR2, AI_TYPE_VECTOR2,
+              _NarrowArray<GfVec2h, GfHalf, 2>}},
+            {typeid(VtVec3fArray),
+             {AI_TYPE_VECTOR, AI_TYPE_RGB, _ConvertArray<GfVec3f>}},
+            {typeid(VtVec3dArray),
+             {AI_TYPE_VECTOR, AI_TYPE_RGB, _NarrowArray<GfVec3d, double, 3>}},
+            {typeid(VtVec3hArray),
+             {AI_TYPE_VECTOR, AI_TYPE_RGB, _NarrowArray<GfVec3h, GfHalf, 3>}},
+            {typeid(VtVec4fArray),
+             {AI_TYPE_RGBA, AI_TYPE_RGBA, _ConvertArray<GfVec4f>}},
+            {typeid(VtVec4dArray),
+             {AI_TYPE_RGBA, AI_TYPE_RGBA, _NarrowArray<GfVec4d, double, 4>}},
+            {typeid(VtVec4hArray),
+             {AI_TYPE_RGBA, AI_TYPE_RGBA, _NarrowArray<GfVec4h, GfHalf, 4>}},
+            {typeid(VtMatrix4fArray),
+             {AI_TYPE_MATRIX, AI_TYPE_MATRIX, _ConvertArray<GfMatrix4f>}},
+            {typeid(VtMatrix4dArray),
+             {AI_TYPE_MATRIX, AI_TYPE_MATRIX,
+              _NarrowArray<GfMatrix4d, double, 16>}},
+            {typeid(VtStringArray),
+             {AI_TYPE_STRING, AI_TYPE_STRING,
+              _ConvertStringArray<std::string>}},
+            {typeid(VtTokenArray),
+             {AI_TYPE_STRING, AI_TYPE_STRING, _ConvertStringArray<TfToken>}},
+            {typeid(VtArray<SdfAssetPath>),
+             {AI_TYPE_STRING, AI_TYPE_STRING,
+              _ConvertStringArray<SdfAssetPath>}},
+        };
+    const auto it = conversions.find(std::type_index(value.GetTypeid()));
+    return it == conversions.end() ? nullptr : &it->second;
+}
+
+const _ConstantConversion* _GetConstantConversion(const VtValue& value) {
+    static const std::unordered_map<std::type_index, _ConstantConversion>
+        conversions{
+            {typeid(bool),
+             {AI_TYPE_BOOLEAN, AI_TYPE_BOOLEAN,
+              [](AtNode* node, const AtString& name, const VtValue& value,
+                 uint8_t) {
+                  AiNodeSetBool(node, name, value.UncheckedGet<bool>());
+              }}},
+            {typeid(unsigned char),
+             {AI_TYPE_BYTE, AI_TYPE_BYTE,
+              [](AtNode* node, const AtString& name, const VtValue& value,
+                 uint8_t) {
+                  AiNodeSetByte(
+                      node, name, value.UncheckedGet<unsigned char>());
+              }}},
+            {typeid(unsigned int),
+             {AI_TYPE_UINT, AI_TYPE_UINT,
+              [](AtNode* node, const AtString& name, const VtValue& value,
+                 uint8_t) {
+                  AiNodeSetUInt(node, name, value.UncheckedGet<unsigned int>());
+              }}},
+            {typeid(int),
+             {AI_TYPE_INT, AI_TYPE_INT,
+              [](AtNode* node, const AtString& name, const VtValue& value,
+                 uint8_t) {
+                  AiNodeSetInt(node, name, value.UncheckedGet<int>());
+              }}},
+            {typeid(float),
+             {AI_TYPE_FLOAT, AI_TYPE_FLOAT,
+              [](AtNode* node, const AtString& name, const VtValue& value,
+                 uint8_t) {
+                  AiNodeSetFlt(node, name, value.UncheckedGet<float>());
+              }}},
+            {typeid(double),
+             {AI_TYPE_FLOAT, AI_TYPE_FLOAT,
+              [](AtNode* node, const AtString& name, const VtValue& value,
+                 uint8_t) {
+                  AiNodeSetFlt(
+                      node, name,
+                      static_cast<float>(value.UncheckedGet<double>()));
+              }}},
+            {typeid(GfHalf),
+             {AI_TYPE_FLOAT, AI_TYPE_FLOAT,
+              [](AtNode* node, const AtString& name, const VtValue& value,
+                 uint8_t) {
+                  AiNodeSetFlt(
+                      node, name,
+                      static_cast<float>(value.UncheckedGet<GfHalf>()));
+              }}},
+            {typeid(GfVec2f),
+             {AI_TYPE_VECTOR2, AI_TYPE_VECTOR2, _SetVec2<GfVec2f>}},
+            {typeid(GfVec2d),
+             {AI_TYPE_VECTOR2, AI_TYPE_VECTOR2, _SetVec2<GfVec2d>}},
+            {typeid(GfVec2h),
+             {AI_TYPE_VECTOR2, AI_TYPE_VECTOR2, _SetVec2<GfVec2h>}},
+            {typeid(GfVec3f), {AI_TYPE_VECTOR, AI_TYPE_RGB, _SetVec3<GfVec3f>}},
+            {typeid(GfVec3d), {AI_TYPE_VECTOR, AI_TYPE_RGB, _SetVec3<GfVec3d>}},
+            {typeid(GfVec3h), {AI_TYPE_VECTOR, AI_TYPE_RGB, _SetVec3<GfVec3h>}},
+            {typeid(GfVec4f), {AI_TYPE_RGBA, AI_TYPE_RGBA, _SetVec4<GfVec4f>}},
+            {typeid(GfVec4d), {AI_TYPE_RGBA, AI_TYPE_RGBA, _SetVec4<GfVec4d>}},
+            {typeid(GfVec4h), {AI_TYPE_RGBA, AI_TYPE_RGBA, _SetVec4<GfVec4h>}},
+            {typeid(GfMatrix4f),
+             {AI_TYPE_MATRIX, AI_TYPE_MATRIX, _SetMatrix<GfMatrix4f>}},
+            {typeid(GfMatrix4d),
+             {AI_TYPE_MATRIX, AI_TYPE_MATRIX, _SetMatrix<GfMatrix4d>}},
+            {typeid(std::string),
+             {AI_TYPE_STRING, AI_TYPE_STRING, _SetString<std::string>}},
+            {typeid(TfToken),
+             {AI_TYPE_STRING, AI_TYPE_STRING, _SetString<TfToken>}},
+            {typeid(SdfAssetPath),
+             {AI_TYPE_STRING, AI_TYPE_STRING, _SetString<SdfAssetPath>}},
+        };
+    const auto it = conversions.find(std::type_index(value.GetTypeid()));
+    return it == conversions.end() ? nullptr : &it->second;
+}
+
+const TfToken& _GetTypeToken(uint8_t arnoldType) {
+    switch (arnoldType) {
+        case AI_TYPE_BOOLEAN: return _tokens->BOOL;
+        case AI_TYPE_BYTE: return _tokens->BYTE;
+        case AI_TYPE_UINT: return _tokens->UINT;
+        case AI_TYPE_INT: return _tokens->INT;
+        case AI_TYPE_FLOAT: return _tokens->FLOAT;
+        case AI_TYPE_VECTOR2: return _tokens->VECTOR2;
+        case AI_TYPE_VECTOR: return _tokens->VECTOR;
+        case AI_TYPE_RGB: return _tokens->RGB;
+        case AI_TYPE_RGBA: return _tokens->RGBA;
+        case AI_TYPE_MATRIX: return _tokens->MATRIX;
+        default: return _tokens->STRING;
+    }
+}
+
+// Names of a primvar interned as AtStrings, so the user parameters are not
+// looked up by formatting and hashing strings on every node.
+struct _PrimvarNames {
+    AtString name;
+    AtString idxsName;
+};
+
+// Declaration of a user parameter, and how Arnold reports it once declared.
+struct _Declaration {
+    std::string declaration;
+    uint8_t category;
+    uint8_t type;
+    uint8_t arrayType;
+};
+
+// The caches are shared by all the rprims, and filled from their Sync.
+// Entries are never erased, so references to them stay valid.
+const _PrimvarNames& _GetPrimvarNames(const TfToken& name) {
+    static tbb::concurrent_unordered_map<
+        TfToken, _PrimvarNames, TfToken::HashFunctor>
+        cache;
+    const auto it = cache.find(name);
+    if (it != cache.end()) { return it->second; }
+    const _PrimvarNames names{
+        AtString(name.GetText()),
+        AtString(TfStringPrintf("%sidxs", name.GetText()).c_str())};
+    return cache.insert({name, names}).first->second;
+}
+
+using _DeclarationKey = std::pair<TfToken, uint8_t>;
+
+struct _DeclarationKeyHash {
+    size_t operator()(const _DeclarationKey& key) const {
+        return TfToken::HashFunctor()(key.first) * 31 + key.second;
+    }
+};
+
+const _Declaration& _GetDeclaration(const TfToken& scope, uint8_t arnoldType) {
+    static tbb::concurrent_unordered_map<
+        _DeclarationKey, _Declaration, _DeclarationKeyHash>
+        cache;
+    const _DeclarationKey key{scope, arnoldType};
+    const auto it = cache.find(key);
+    if (it != cache.end()) { return it->second; }
+    _Declaration declaration{
+        TfStringPrintf(
+            "%s %s", scope.GetText(), _GetTypeToken(arnoldType).GetText()),
+        AI_USERDEF_CONSTANT, arnoldType, AI_TYPE_NONE};
+    if (scope == _tokens->constantArray) {
+        declaration.type = AI_TYPE_ARRAY;
+        declaration.arrayType = arnoldType;
+    } else if (scope == _tokens->uniform) {
+        declaration.category = AI_USERDEF_UNIFORM;
+    } else if (scope == _tokens->varying) {
+        declaration.category = AI_USERDEF_VARYING;
+    } else if (scope == _tokens->indexed) {
+        declaration.category = AI_USERDEF_INDEXED;
+    }
+    return cache.insert({key, declaration}).first->second;
+}
+
+// Declaring a user parameter twice fails, so the declaration is skipped if
+// the node already has a matching user parameter. Mismatching ones are
+// removed first.
+inline bool _Declare(
+    AtNode* node, const AtString& name, const _Declaration& declaration) {
+    const auto* entry = AiNodeLookUpUserParameter(node, name);
+    if (entry != nullptr) {
+        if (AiUserParamGetCategory(entry) == declaration.category &&
+            AiUserParamGetType(entry) == declaration.type &&
+            (declaration.type != AI_TYPE_ARRAY ||
+             AiUserParamGetArrayType(entry) == declaration.arrayType)) {
+            return true;
+        }
+        AiNodeResetParameter(node, name.c_str());
+    }
+    return AiNodeDeclare(node, name, declaration.declaration.c_str());
 }
 
-// This is useful for uniform, vertex and face-varying. We need to know the size
-// to generate the indices for faceVarying data.
+// The array is converted right away, only declaring the user parameter and
+// setting the array is recorded in the journal. This is useful for uniform,
+// vertex and face-varying. We need to know the size to generate the indices
+// for faceVarying data.
 inline uint32_t _DeclareAndAssignFromArray(
-    AtNode* node, const TfToken& name, const TfToken& scope,
-    const VtValue& value, bool isColor = false) {
-    if (value.IsHolding<VtBoolArray>()) {
-        return _DeclareAndConvertArray<VtBoolArray>(
-            node, name, scope, _tokens->BOOL, AI_TYPE_BOOLEAN, value);
-    } else if (value.IsHolding<VtUCharArray>()) {
-        return _DeclareAndConvertArray<VtUCharArray>(
-            node, name, scope, _tokens->BYTE, AI_TYPE_BYTE, value);
-    } else if (value.IsHolding<VtUIntArray>()) {
-        return _DeclareAndConvertArray<VtUIntArray>(
-            node, name, scope, _tokens->UINT, AI_TYPE_UINT, value);
-    } else if (value.IsHolding<VtIntArray>()) {
-        return _DeclareAndConvertArray<VtIntArray>(
-            node, name, scope, _tokens->INT, AI_TYPE_INT, value);
-    } else if (value.IsHolding<VtFloatArray>()) {
-        return _DeclareAndConvertArray<VtFloatArray>(
-            node, name, scope, _tokens->FLOAT, AI_TYPE_FLOAT, value);
-    } else if (value.IsHolding<VtDoubleArray>()) {
-        // TODO
-    } else if (value.IsHolding<VtVec2fArray>()) {
-        return _DeclareAndConvertArray<VtVec2fArray>(
-            node, name, scope, _tokens->VECTOR2, AI_TYPE_VECTOR2, value);
-    } else if (value.IsHolding<VtVec3fArray>()) {
-        if (isColor) {
-            return _DeclareAndConvertArray<VtVec3fArray>(
-                node, name, scope, _tokens->RGB, AI_TYPE_RGB, value);
+    HdAiNodeEditJournal& journal, AtNode* node, const TfToken& name,
+    const TfToken& scope, const VtValue& value, bool isColor = false) {
+    const auto* conversion = _GetArrayConversion(value);
+    if (conversion == nullptr) { return 0; }
+    const auto arnoldType =
+        isColor ? conversion->colorType : conversion->arnoldType;
+    auto* a = conversion->convert(value, arnoldType);
+    const auto* names = &_GetPrimvarNames(name);
+    const auto* declaration = &_GetDeclaration(scope, arnoldType);
+    journal.Record([node, names, declaration, a]() {
+        if (_Declare(node, names->name, *declaration)) {
+            AiNodeSetArray(node, names->name, a);
         } else {
-            return _DeclareAndConvertArray<VtVec3fArray>(
-                node, name, scope, _tokens->VECTOR, AI_TYPE_VECTOR, value);
+            AiArrayDestroy(a);
         }
-    } else if (value.IsHolding<VtVec4fArray>()) {
-        return _DeclareAndConvertArray<VtVec4fArray>(
-            node, name, scope, _tokens->RGBA, AI_TYPE_RGBA, value);
-    }
-    return 0;
+    });
+    return static_cast<uint32_t>(value.GetArraySize());
 }
 
 inline void _DeclareAndAssignConstant(
     AtNode* node, const TfToken& name, const VtValue& value,
     bool isColor = false) {
-    auto declareConstant = [&node, &name](const TfToken& type) -> bool {
-        return _Declare(node, name, _tokens->constant, type);
-    };
-    if (value.IsHolding<bool>()) {
-        if (!declareConstant(_tokens->BOOL)) { return; }
-        AiNodeSetBool(node, name.GetText(), value.UncheckedGet<bool>());
-    } else if (value.IsHolding<uint8_t>()) {
-        if (!declareConstant(_tokens->BYTE)) { return; }
-        AiNodeSetByte(node, name.GetText(), value.UncheckedGet<uint8_t>());
-    } else if (value.IsHolding<unsigned int>()) {
-        if (!declareConstant(_tokens->UINT)) { return; }
-        AiNodeSetUInt(node, name.GetText(), value.UncheckedGet<unsigned int>());
-    } else if (value.IsHolding<int>()) {
-        if (!declareConstant(_tokens->INT)) { return; }
-        AiNodeSetInt(node, name.GetText(), value.UncheckedGet<int>());
-    } else if (value.IsHolding<float>()) {
-        if (!declareConstant(_tokens->FLOAT)) { return; }
-        AiNodeSetFlt(node, name.GetText(), value.UncheckedGet<float>());
-    } else if (value.IsHolding<double>()) {
-        if (!declareConstant(_tokens->FLOAT)) { return; }
-        AiNodeSetFlt(
-            node, name.GetText(),
-            static_cast<float>(value.UncheckedGet<double>()));
-    } else if (value.IsHolding<GfVec2f>()) {
-        if (!declareConstant(_tokens->VECTOR2)) { return; }
-        const auto& v = value.UncheckedGet<GfVec2f>();
-        AiNodeSetVec2(node, name.GetText(), v[0], v[1]);
-    } else if (value.IsHolding<GfVec3f>()) {
-        if (isColor) {
-            if (!declareConstant(_tokens->RGB)) { return; }
-            const auto& v = value.UncheckedGet<GfVec3f>();
-            AiNodeSetRGB(node, name.GetText(), v[0], v[1], v[2]);
-        } else {
-            if (!declareConstant(_tokens->VECTOR)) { return; }
-            const auto& v = value.UncheckedGet<GfVec3f>();
-            AiNodeSetVec(node, name.GetText(), v[0], v[1], v[2]);
-        }
-    } else if (value.IsHolding<GfVec4f>()) {
-        if (!declareConstant(_tokens->RGBA)) { return; }
-        const auto& v = value.UncheckedGet<GfVec4f>();
-        AiNodeSetRGBA(node, name.GetText(), v[0], v[1], v[2], v[3]);
-    } else {
-        _DeclareAndAssignFromArray(
-            node, name, _tokens->constantArray, value, isColor);
+    const auto* conversion = _GetConstantConversion(value);
+    if (conversion == nullptr) { return; }
+    const auto arnoldType =
+        isColor ? conversion->colorType : conversion->arnoldType;
+    const auto& names = _GetPrimvarNames(name);
+    if (!_Declare(
+            node, names.name,
+            _GetDeclaration(_tokens->constant, arnoldType))) {
+        return;
     }
+    conversion->set(node, names.name, value, arnoldType);
 }
 
 } // namespace
@@ -200,186 +507,431 @@ GfMatrix4f HdAiConvertMatrix(const AtMatrix& in) {
     return out;
 }
 
-void HdAiSetTransform(
-    AtNode* node, HdSceneDelegate* delegate, const SdfPath& id) {
-    // For now this is hardcoded to two samples and 0.0 / 1.0 sample times.
-    constexpr size_t maxSamples = 2;
-    HdTimeSampleArray<GfMatrix4d, maxSamples> xf;
+AtArray* HdAiConvertTransform(
+    HdSceneDelegate* delegate, const SdfPath& id, const GfVec2f& shutter) {
+    HdTimeSampleArray<GfMatrix4d, HdAiMaxMotionSamples> xf;
     delegate->SampleTransform(id, &xf);
-    AtArray* matrices = AiArrayAllocate(1, xf.count, AI_TYPE_MATRIX);
-    for (auto i = decltype(xf.count){0}; i < xf.count; ++i) {
-        AiArraySetMtx(matrices, i, HdAiConvertMatrix(xf.values[i]));
+    const auto numKeys = std::max<size_t>(
+        1, std::min<size_t>(
+               xf.count, HdAiConfig::GetInstance().max_motion_samples));
+    AtArray* matrices = AiArrayAllocate(1, numKeys, AI_TYPE_MATRIX);
+    auto* out = static_cast<AtMatrix*>(AiArrayMap(matrices));
+    for (auto i = decltype(numKeys){0}; i < numKeys; ++i) {
+        if (xf.count == 0) {
+            out[i] = AiM4Identity();
+            continue;
+        }
+        const auto sample = HdAiGetKeySample(xf, i, numKeys, shutter);
+        if (sample.first == sample.second) {
+            out[i] = HdAiConvertMatrix(xf.values[sample.first]);
+        } else {
+            out[i] = HdAiConvertMatrix(
+                xf.values[sample.first] * (1.0 - sample.weight) +
+                xf.values[sample.second] * sample.weight);
+        }
     }
-    AiNodeSetArray(node, "matrix", matrices);
+    AiArrayUnmap(matrices);
+    return matrices;
 }
 
-void HdAiSetTransform(
-    std::vector<AtNode*>& nodes, HdSceneDelegate* delegate, const SdfPath& id) {
-    constexpr size_t maxSamples = 3;
-    HdTimeSampleArray<GfMatrix4d, maxSamples> xf;
-    delegate->SampleTransform(id, &xf);
-    AtArray* matrices = AiArrayAllocate(1, xf.count, AI_TYPE_MATRIX);
-    for (auto i = decltype(xf.count){0}; i < xf.count; ++i) {
-        AiArraySetMtx(matrices, i, HdAiConvertMatrix(xf.values[i]));
+namespace {
+
+template <typename T, typename S>
+void _NarrowPoints(VtValue& value) {
+    const auto& v = value.UncheckedGet<VtArray<T>>();
+    VtVec3fArray points(v.size());
+    _ParallelNarrow(
+        reinterpret_cast<const S*>(v.cdata()),
+        reinterpret_cast<float*>(points.data()), v.size() * 3);
+    value = VtValue::Take(points);
+}
+
+void _NarrowPoints(VtValue& value) {
+    if (value.IsHolding<VtVec3dArray>()) {
+        _NarrowPoints<GfVec3d, double>(value);
+    } else if (value.IsHolding<VtVec3hArray>()) {
+        _NarrowPoints<GfVec3h, GfHalf>(value);
     }
-    const auto nodeCount = nodes.size();
-    if (nodeCount > 0) {
-        // IIRC you can't set the same array on two different nodes,
-        // because it causes a double-free.
-        // TODO: we need to check if it's still the case with Arnold 5.
-        for (auto i = decltype(nodeCount){1}; i < nodeCount; ++i) {
-            AiNodeSetArray(nodes[i], "matrix", AiArrayCopy(matrices));
+}
+
+} // namespace
+
+AtArray* HdAiConvertPoints(
+    HdSceneDelegate* delegate, const SdfPath& id, const TfToken& primvar,
+    const GfVec2f& shutter) {
+    HdTimeSampleArray<VtValue, HdAiMaxMotionSamples> samples;
+    delegate->SamplePrimvar(id, primvar, &samples);
+    // Double and half precision points are narrowed to floats first.
+    for (auto i = decltype(samples.count){0}; i < samples.count; ++i) {
+        _NarrowPoints(samples.values[i]);
+    }
+    if (samples.count == 0 ||
+        ARCH_UNLIKELY(!samples.values[0].IsHolding<VtVec3fArray>())) {
+        return nullptr;
+    }
+    // Samples with a different type or point count can't be interpolated
+    // and are ignored.
+    const auto& v0 = samples.values[0].UncheckedGet<VtVec3fArray>();
+    const auto numPoints = v0.size();
+    size_t count = 1;
+    for (; count < samples.count; ++count) {
+        const auto& v = samples.values[count];
+        if (ARCH_UNLIKELY(
+                !v.IsHolding<VtVec3fArray>() ||
+                v.UncheckedGet<VtVec3fArray>().size() != numPoints)) {
+            break;
+        }
+    }
+    samples.count = count;
+    const auto numKeys = std::max<size_t>(
+        1, std::min<size_t>(
+               count, HdAiConfig::GetInstance().max_motion_samples));
+    auto* arr = AiArrayAllocate(numPoints, numKeys, AI_TYPE_VECTOR);
+    if (numPoints == 0) { return arr; }
+    auto* out = static_cast<GfVec3f*>(AiArrayMap(arr));
+    for (auto i = decltype(numKeys){0}; i < numKeys; ++i, out += numPoints) {
+        const auto sample = HdAiGetKeySample(samples, i, numKeys, shutter);
+        const auto& p0 =
+            samples.values[sample.first].UncheckedGet<VtVec3fArray>();
+        if (sample.first == sample.second || sample.weight == 0.0f) {
+            std::copy(p0.cbegin(), p0.cend(), out);
+            continue;
+        }
+        const auto& p1 =
+            samples.values[sample.second].UncheckedGet<VtVec3fArray>();
+        const auto w = sample.weight;
+        for (auto j = decltype(numPoints){0}; j < numPoints; ++j) {
+            out[j] = p0[j] + (p1[j] - p0[j]) * w;
         }
-        AiNodeSetArray(nodes[0], "matrix", matrices);
     }
+    AiArrayUnmap(arr);
+    return arr;
 }
 
-void HdAiSetParameter(
-    AtNode* node, const AtParamEntry* pentry, const VtValue& value) {
-    const auto paramName = AiParamGetName(pentry);
-    switch (AiParamGetType(pentry)) {
+void HdAiSetTransform(
+    AtNode* node, HdSceneDelegate* delegate, const SdfPath& id,
+    const GfVec2f& shutter) {
+    AiNodeSetArray(node, "matrix", HdAiConvertTransform(delegate, id, shutter));
+    HdAiSetMotionRange(node, shutter);
+}
+
+void HdAiSetMotionRange(AtNode* node, const GfVec2f& shutter) {
+    AiNodeSetFlt(node, "motion_start", shutter[0]);
+    AiNodeSetFlt(node, "motion_end", shutter[1]);
+}
+
+AtArray* HdAiConvertIndices(const VtIntArray& indices) {
+    static_assert(
+        sizeof(int) == sizeof(uint32_t),
+        "Indices have to be copied as unsigned integers.");
+    return AiArrayConvert(
+        static_cast<uint32_t>(indices.size()), 1, AI_TYPE_UINT,
+        indices.cdata());
+}
+
+namespace {
+
+template <typename T>
+bool _CollapseFaceVarying(
+    const VtValue& value, const VtIntArray& vertexIndices, VtValue* out) {
+    const auto& values = value.UncheckedGet<VtArray<T>>();
+    const auto numIndices = vertexIndices.size();
+    if (values.size() != numIndices || numIndices == 0) { return false; }
+    const auto numVertices = static_cast<size_t>(
+        *std::max_element(vertexIndices.cbegin(), vertexIndices.cend()) + 1);
+    // Only worth it if there are fewer vertices than face-vertices.
+    if (numVertices >= numIndices) { return false; }
+    VtArray<T> collapsed(numVertices);
+    std::vector<bool> assigned(numVertices, false);
+    for (auto i = decltype(numIndices){0}; i < numIndices; ++i) {
+        const auto vertex = vertexIndices[i];
+        if (vertex < 0) { return false; }
+        if (!assigned[vertex]) {
+            collapsed[vertex] = values[i];
+            assigned[vertex] = true;
+        } else if (collapsed[vertex] != values[i]) {
+            return false;
+        }
+    }
+    *out = VtValue::Take(collapsed);
+    return true;
+}
+
+} // namespace
+
+bool HdAiCollapseFaceVarying(
+    const VtValue& value, const VtIntArray& vertexIndices, VtValue* out) {
+    if (value.IsHolding<VtVec2fArray>()) {
+        return _CollapseFaceVarying<GfVec2f>(value, vertexIndices, out);
+    } else if (value.IsHolding<VtVec3fArray>()) {
+        return _CollapseFaceVarying<GfVec3f>(value, vertexIndices, out);
+    } else if (value.IsHolding<VtVec4fArray>()) {
+        return _CollapseFaceVarying<GfVec4f>(value, vertexIndices, out);
+    } else if (value.IsHolding<VtFloatArray>()) {
+        return _CollapseFaceVarying<float>(value, vertexIndices, out);
+    } else if (value.IsHolding<VtIntArray>()) {
+        return _CollapseFaceVarying<int>(value, vertexIndices, out);
+    }
+    return false;
+}
+
+uint64_t HdAiHashArray(AtArray* array, uint64_t seed) {
+    const auto size = static_cast<size_t>(AiArrayGetKeySize(array)) *
+                      static_cast<size_t>(AiArrayGetNumKeys(array));
+    if (size == 0) { return seed; }
+    const auto hash = ArchHash64(
+        static_cast<const char*>(AiArrayMap(array)), size, seed);
+    AiArrayUnmap(array);
+    return hash;
+}
+
+AtArray* HdAiConvertWidths(const VtFloatArray& widths) {
+    const auto numWidths = static_cast<uint32_t>(widths.size());
+    auto* a = AiArrayAllocate(numWidths, 1, AI_TYPE_FLOAT);
+    if (numWidths == 0) { return a; }
+    auto* out = static_cast<float*>(AiArrayMap(a));
+    const auto* in = widths.cdata();
+    WorkParallelForN(numWidths, [out, in](size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) { out[i] = in[i] * 0.5f; }
+    });
+    AiArrayUnmap(a);
+    return a;
+}
+
+AtArray* HdAiGenerateIdxs(unsigned int count) {
+    auto* a = AiArrayAllocate(count, 1, AI_TYPE_UINT);
+    if (count == 0) { return a; }
+    auto* out = static_cast<uint32_t*>(AiArrayMap(a));
+    std::iota(out, out + count, 0u);
+    AiArrayUnmap(a);
+    return a;
+}
+
+bool HdAiConvertParameter(
+    const AtParamEntry* pentry, const VtValue& value,
+    HdAiParameterValue* out) {
+    out->name = AiParamGetName(pentry);
+    out->type = AiParamGetType(pentry);
+    auto setFloats = [&](const float* v, int count) -> bool {
+        for (auto i = 0; i < count; ++i) { out->f[i] = v[i]; }
+        return true;
+    };
+    switch (out->type) {
         case AI_TYPE_BYTE:
-            if (value.IsHolding<int>()) {
-                AiNodeSetByte(
-                    node, paramName,
-                    static_cast<uint8_t>(value.UncheckedGet<int>()));
-            }
-            break;
         case AI_TYPE_INT:
             if (value.IsHolding<int>()) {
-                AiNodeSetInt(node, paramName, value.UncheckedGet<int>());
+                out->i = value.UncheckedGet<int>();
+                return true;
             }
-            break;
+            return false;
         case AI_TYPE_UINT:
         case AI_TYPE_USHORT:
             if (value.IsHolding<unsigned int>()) {
-                AiNodeSetUInt(
-                    node, paramName, value.UncheckedGet<unsigned int>());
+                out->u = value.UncheckedGet<unsigned int>();
+                return true;
             }
-            break;
+            return false;
         case AI_TYPE_BOOLEAN:
             if (value.IsHolding<bool>()) {
-                AiNodeSetBool(node, paramName, value.UncheckedGet<bool>());
+                out->i = value.UncheckedGet<bool>() ? 1 : 0;
+                return true;
             }
-            break;
+            return false;
         case AI_TYPE_FLOAT:
         case AI_TYPE_HALF:
             if (value.IsHolding<float>()) {
-                AiNodeSetFlt(node, paramName, value.UncheckedGet<float>());
+                out->f[0] = value.UncheckedGet<float>();
+                return true;
             }
-            break;
+            return false;
         case AI_TYPE_RGB:
+        case AI_TYPE_VECTOR:
             if (value.IsHolding<GfVec3f>()) {
-                const auto& v = value.UncheckedGet<GfVec3f>();
-                AiNodeSetRGB(node, paramName, v[0], v[1], v[2]);
+                return setFloats(value.UncheckedGet<GfVec3f>().data(), 3);
             }
-            break;
+            return false;
         case AI_TYPE_RGBA:
-            if (value.IsHolding<GfVec3f>()) {
-                const auto& v = value.UncheckedGet<GfVec4f>();
-                AiNodeSetRGBA(node, paramName, v[0], v[1], v[2], v[3]);
-            }
-            break;
-        case AI_TYPE_VECTOR:
-            if (value.IsHolding<GfVec3f>()) {
-                const auto& v = value.UncheckedGet<GfVec3f>();
-                AiNodeSetVec(node, paramName, v[0], v[1], v[2]);
+            if (value.IsHolding<GfVec4f>()) {
+                return setFloats(value.UncheckedGet<GfVec4f>().data(), 4);
             }
-            break;
+            return false;
         case AI_TYPE_VECTOR2:
             if (value.IsHolding<GfVec2f>()) {
-                const auto& v = value.UncheckedGet<GfVec2f>();
-                AiNodeSetVec2(node, paramName, v[0], v[1]);
+                return setFloats(value.UncheckedGet<GfVec2f>().data(), 2);
             }
-            break;
+            return false;
         case AI_TYPE_STRING:
             if (value.IsHolding<TfToken>()) {
-                AiNodeSetStr(
-                    node, paramName, value.UncheckedGet<TfToken>().GetText());
+                out->str = AtString(value.UncheckedGet<TfToken>().GetText());
+                return true;
             } else if (value.IsHolding<SdfAssetPath>()) {
                 const auto& assetPath = value.UncheckedGet<SdfAssetPath>();
-                AiNodeSetStr(
-                    node, paramName,
+                out->str = AtString(
                     assetPath.GetResolvedPath().empty()
                         ? assetPath.GetAssetPath().c_str()
                         : assetPath.GetResolvedPath().c_str());
+                return true;
             }
-            break;
+            return false;
         case AI_TYPE_POINTER:
         case AI_TYPE_NODE:
-            break; // Should be in the relationships list.
+            return false; // Should be in the relationships list.
         case AI_TYPE_MATRIX:
-            break; // TODO
+            return false; // TODO
         case AI_TYPE_ENUM:
-            break; // TODO
+            return false; // TODO
         case AI_TYPE_CLOSURE:
-            break; // Should be in the relationships list.
+            return false; // Should be in the relationships list.
         default:
             AiMsgError(
-                "Unsupported parameter %s.%s", AiNodeGetName(node),
-                AiParamGetName(pentry).c_str());
+                "Unsupported parameter %s", AiParamGetName(pentry).c_str());
+            return false;
+    }
+}
+
+void HdAiSetParameter(AtNode* node, const HdAiParameterValue& value) {
+    const auto& name = value.name;
+    const auto* f = value.f;
+    switch (value.type) {
+        case AI_TYPE_BYTE:
+            AiNodeSetByte(node, name, static_cast<uint8_t>(value.i));
+            break;
+        case AI_TYPE_INT:
+            AiNodeSetInt(node, name, value.i);
+            break;
+        case AI_TYPE_UINT:
+        case AI_TYPE_USHORT:
+            AiNodeSetUInt(node, name, value.u);
+            break;
+        case AI_TYPE_BOOLEAN:
+            AiNodeSetBool(node, name, value.i != 0);
+            break;
+        case AI_TYPE_FLOAT:
+        case AI_TYPE_HALF:
+            AiNodeSetFlt(node, name, f[0]);
+            break;
+        case AI_TYPE_RGB:
+            AiNodeSetRGB(node, name, f[0], f[1], f[2]);
+            break;
+        case AI_TYPE_RGBA:
+            AiNodeSetRGBA(node, name, f[0], f[1], f[2], f[3]);
+            break;
+        case AI_TYPE_VECTOR:
+            AiNodeSetVec(node, name, f[0], f[1], f[2]);
+            break;
+        case AI_TYPE_VECTOR2:
+            AiNodeSetVec2(node, name, f[0], f[1]);
+            break;
+        case AI_TYPE_STRING:
+            AiNodeSetStr(node, name, value.str);
+            break;
+        default:
+            break;
+    }
+}
+
+void HdAiSetParameter(
+    AtNode* node, const AtParamEntry* pentry, const VtValue& value) {
+    HdAiParameterValue converted;
+    if (HdAiConvertParameter(pentry, value, &converted)) {
+        HdAiSetParameter(node, converted);
     }
 }
 
 void HdAiSetConstantPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc) {
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value) {
     const auto isColor = primvarDesc.role == HdPrimvarRoleTokens->color;
-    if (primvarDesc.name == HdPrimvarRoleTokens->color && isColor) {
-        if (!_Declare(
-                node, primvarDesc.name, _tokens->constant, _tokens->RGBA)) {
-            return;
-        }
-        const auto value = delegate->Get(id, primvarDesc.name);
-        if (value.IsHolding<GfVec4f>()) {
-            const auto& v = value.UncheckedGet<GfVec4f>();
-            AiNodeSetRGBA(
-                node, primvarDesc.name.GetText(), v[0], v[1], v[2], v[3]);
-        } else if (value.IsHolding<VtVec4fArray>()) {
-            const auto& arr = value.UncheckedGet<VtVec4fArray>();
-            if (arr.empty()) { return; }
-            const auto& v = arr[0];
-            AiNodeSetRGBA(
-                node, primvarDesc.name.GetText(), v[0], v[1], v[2], v[3]);
-        }
+    const auto& name = primvarDesc.name;
+    if (value.IsArrayValued() &&
+        !(name == HdPrimvarRoleTokens->color && isColor)) {
+        _DeclareAndAssignFromArray(
+            journal, node, name, _tokens->constantArray, value, isColor);
+        return;
+    }
+    if (name == HdPrimvarRoleTokens->color && isColor) {
+        const auto* names = &_GetPrimvarNames(name);
+        const auto* declaration =
+            &_GetDeclaration(_tokens->constant, AI_TYPE_RGBA);
+        journal.Record([node, names, declaration, value]() {
+            if (!_Declare(node, names->name, *declaration)) { return; }
+            if (value.IsHolding<GfVec4f>()) {
+                const auto& v = value.UncheckedGet<GfVec4f>();
+                AiNodeSetRGBA(node, names->name, v[0], v[1], v[2], v[3]);
+            } else if (value.IsHolding<VtVec4fArray>()) {
+                const auto& arr = value.UncheckedGet<VtVec4fArray>();
+                if (arr.empty()) { return; }
+                const auto& v = arr[0];
+                AiNodeSetRGBA(node, names->name, v[0], v[1], v[2], v[3]);
+            }
+        });
+        return;
     }
+    journal.Record([node, name, value, isColor]() {
+        _DeclareAndAssignConstant(node, name, value, isColor);
+    });
+}
+
+void HdAiAssignConstantPrimvar(
+    AtNode* node, const HdPrimvarDescriptor& primvarDesc,
+    const VtValue& value) {
     _DeclareAndAssignConstant(
-        node, primvarDesc.name, delegate->Get(id, primvarDesc.name), isColor);
+        node, primvarDesc.name, value,
+        primvarDesc.role == HdPrimvarRoleTokens->color);
 }
 
 void HdAiSetUniformPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc) {
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value) {
     _DeclareAndAssignFromArray(
-        node, primvarDesc.name, _tokens->uniform,
-        delegate->Get(id, primvarDesc.name),
-        primvarDesc.role == HdPrimvarRoleTokens->color);
+        journal, node, primvarDesc.name, _tokens->uniform,
+        value, primvarDesc.role == HdPrimvarRoleTokens->color);
 }
 
 void HdAiSetVertexPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc) {
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value) {
     _DeclareAndAssignFromArray(
-        node, primvarDesc.name, _tokens->varying,
-        delegate->Get(id, primvarDesc.name),
-        primvarDesc.role == HdPrimvarRoleTokens->color);
+        journal, node, primvarDesc.name, _tokens->varying,
+        value, primvarDesc.role == HdPrimvarRoleTokens->color);
+}
+
+void HdAiRemovePrimvar(
+    HdAiNodeEditJournal& journal, AtNode* node, const TfToken& name) {
+    const auto* names = &_GetPrimvarNames(name);
+    journal.Record([node, names]() {
+        if (AiNodeLookUpUserParameter(node, names->name) != nullptr) {
+            AiNodeResetParameter(node, names->name.c_str());
+        }
+    });
 }
 
 void HdAiSetFaceVaryingPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc) {
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value,
+    const VtIntArray* vertexIndices) {
+    // Per vertex values are shared by all the faces using the vertex, and are
+    // indexed with the vertex indices instead of an identity array.
+    VtValue collapsed;
+    const auto isCollapsed = vertexIndices != nullptr &&
+                             HdAiCollapseFaceVarying(
+                                 value, *vertexIndices, &collapsed);
     const auto numElements = _DeclareAndAssignFromArray(
-        node, primvarDesc.name, _tokens->indexed,
-        delegate->Get(id, primvarDesc.name),
+        journal, node, primvarDesc.name, _tokens->indexed,
+        isCollapsed ? collapsed : value,
         primvarDesc.role == HdPrimvarRoleTokens->color);
     if (numElements != 0) {
-        auto* a = AiArrayAllocate(numElements, 1, AI_TYPE_UINT);
-        for (auto i = decltype(numElements){0}; i < numElements; ++i) {
-            AiArraySetUInt(a, i, i);
-        }
-        AiNodeSetArray(
-            node, TfStringPrintf("%sidxs", primvarDesc.name.GetText()).c_str(),
-            a);
+        auto* a = isCollapsed ? HdAiConvertIndices(*vertexIndices)
+                              : HdAiGenerateIdxs(numElements);
+        const auto* names = &_GetPrimvarNames(primvarDesc.name);
+        journal.Record([node, names, a]() {
+            // The primvar itself might have failed to declare.
+            if (AiNodeLookUpUserParameter(node, names->name) == nullptr) {
+                AiArrayDestroy(a);
+                return;
+            }
+            AiNodeSetArray(node, names->idxsName, a);
+        });
     }
 }
 
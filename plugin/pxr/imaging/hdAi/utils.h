@@ -19,10 +19,15 @@
 
 #include <pxr/base/gf/matrix4d.h>
 #include <pxr/base/gf/matrix4f.h>
+#include <pxr/base/gf/vec2f.h>
 
+#include <pxr/base/vt/types.h>
 #include <pxr/base/vt/value.h>
 
 #include <pxr/imaging/hd/sceneDelegate.h>
+#include <pxr/imaging/hd/timeSampleArray.h>
+
+#include "pxr/imaging/hdAi/nodeEditJournal.h"
 
 #include <ai.h>
 
@@ -36,31 +41,133 @@ HDAI_API
 AtMatrix HdAiConvertMatrix(const GfMatrix4f& in);
 HDAI_API
 GfMatrix4f HdAiConvertMatrix(const AtMatrix& in);
+/// Capacity of the time sample arrays used to query motion from the scene
+/// delegate, HDAI_max_motion_samples can only lower the number of keys.
+constexpr unsigned int HdAiMaxMotionSamples = 16;
+/// Position of a motion key between two authored samples.
+struct HdAiKeySample {
+    size_t first;
+    size_t second;
+    float weight;
+};
+/// Arnold expects the motion keys to be evenly distributed between
+/// motion_start and motion_end, so key @p key out of @p numKeys is looked up
+/// in the authored sample times.
+template <typename T, unsigned int CAPACITY>
+HdAiKeySample HdAiGetKeySample(
+    const HdTimeSampleArray<T, CAPACITY>& samples, size_t key, size_t numKeys,
+    const GfVec2f& shutter) {
+    const auto t =
+        numKeys < 2 ? shutter[0]
+                    : shutter[0] + (shutter[1] - shutter[0]) *
+                                       static_cast<float>(key) /
+                                       static_cast<float>(numKeys - 1);
+    if (samples.count < 2 || t <= samples.times[0]) { return {0, 0, 0.0f}; }
+    const auto last = samples.count - 1;
+    if (t >= samples.times[last]) { return {last, last, 0.0f}; }
+    size_t i = 1;
+    while (samples.times[i] < t) { ++i; }
+    const auto t0 = samples.times[i - 1];
+    const auto t1 = samples.times[i];
+    return {i - 1, i, t1 > t0 ? (t - t0) / (t1 - t0) : 0.0f};
+}
+/// Samples the transform of @p id and converts it to an array of matrices.
+///
+/// The keys are evenly distributed over @p shutter, and interpolated from
+/// the authored samples.
 HDAI_API
-void HdAiSetTransform(
-    AtNode* node, HdSceneDelegate* delegate, const SdfPath& id);
+AtArray* HdAiConvertTransform(
+    HdSceneDelegate* delegate, const SdfPath& id, const GfVec2f& shutter);
+/// Samples a point primvar and converts it to an array of vectors, with the
+/// keys evenly distributed over @p shutter. Double and half precision points
+/// are narrowed to floats. Returns nullptr if the primvar doesn't hold
+/// points.
+HDAI_API
+AtArray* HdAiConvertPoints(
+    HdSceneDelegate* delegate, const SdfPath& id, const TfToken& primvar,
+    const GfVec2f& shutter);
+/// Sets the transform and the motion range of @p node.
 HDAI_API
 void HdAiSetTransform(
-    std::vector<AtNode*>& nodes, HdSceneDelegate* delegate, const SdfPath& id);
+    AtNode* node, HdSceneDelegate* delegate, const SdfPath& id,
+    const GfVec2f& shutter);
+/// Sets motion_start and motion_end of @p node to the shutter.
+HDAI_API
+void HdAiSetMotionRange(AtNode* node, const GfVec2f& shutter);
+/// Converts indices to an array of unsigned integers with a single copy.
+///
+/// Negative indices are invalid in Arnold, so the bits are reinterpreted.
+HDAI_API
+AtArray* HdAiConvertIndices(const VtIntArray& indices);
+/// Stores a single value per vertex in @p out, if the flattened face-varying
+/// @p value has the same value for every face-vertex of each vertex.
+HDAI_API
+bool HdAiCollapseFaceVarying(
+    const VtValue& value, const VtIntArray& vertexIndices, VtValue* out);
+/// Hashes the contents of all the keys of @p array.
+HDAI_API
+uint64_t HdAiHashArray(AtArray* array, uint64_t seed = 0);
+/// Converts widths to an array of radii, large arrays are converted in
+/// parallel chunks.
+HDAI_API
+AtArray* HdAiConvertWidths(const VtFloatArray& widths);
+/// Returns an array of unsigned integers from 0 to @p count - 1.
+HDAI_API
+AtArray* HdAiGenerateIdxs(unsigned int count);
+/// Value of a node parameter, converted to the type of the parameter. Only
+/// the members used by the type are set.
+struct HdAiParameterValue {
+    AtString name;
+    AtString str;
+    float f[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    int i = 0;
+    unsigned int u = 0;
+    uint8_t type = AI_TYPE_NONE;
+};
+/// Converts @p value to the type of @p pentry, without touching any node, so
+/// it can run in parallel. Returns false if the value can't be set.
+HDAI_API
+bool HdAiConvertParameter(
+    const AtParamEntry* pentry, const VtValue& value,
+    HdAiParameterValue* out);
+/// Sets a value converted by HdAiConvertParameter on @p node.
+HDAI_API
+void HdAiSetParameter(AtNode* node, const HdAiParameterValue& value);
 HDAI_API
 void HdAiSetParameter(
     AtNode* node, const AtParamEntry* pentry, const VtValue& value);
+// The primvar functions convert the values of the primvars right away, and
+// record the declaration of the user parameters in the journal.
 HDAI_API
 void HdAiSetConstantPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc);
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value);
+/// Declares and sets a constant user parameter right away, only called while
+/// the journal is committed.
+HDAI_API
+void HdAiAssignConstantPrimvar(
+    AtNode* node, const HdPrimvarDescriptor& primvarDesc,
+    const VtValue& value);
 HDAI_API
 void HdAiSetUniformPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc);
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value);
 HDAI_API
 void HdAiSetVertexPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc);
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value);
+/// Removes the user parameter of a primvar that is no longer authored.
+HDAI_API
+void HdAiRemovePrimvar(
+    HdAiNodeEditJournal& journal, AtNode* node, const TfToken& name);
+/// When @p vertexIndices is set and the values of the primvar only change
+/// per vertex, one value is stored per vertex and indexed with the vertex
+/// indices.
 HDAI_API
 void HdAiSetFaceVaryingPrimvar(
-    AtNode* node, const SdfPath& id, HdSceneDelegate* delegate,
-    const HdPrimvarDescriptor& primvarDesc);
+    HdAiNodeEditJournal& journal, AtNode* node,
+    const HdPrimvarDescriptor& primvarDesc, const VtValue& value,
+    const VtIntArray* vertexIndices = nullptr);
 
 PXR_NAMESPACE_CLOSE_SCOPE
 
@@ -31,6 +31,7 @@ const AtString volume("volume");
 const AtString filename("filename");
 const AtString grids("grids");
 const AtString shader("shader");
+const AtString id("id");
 } // namespace Str
 } // namespace
 
@@ -39,6 +40,7 @@ HdAiVolume::HdAiVolume(
     : HdVolume(id, instancerId), _delegate(delegate) {}
 
 HdAiVolume::~HdAiVolume() {
+    _delegate->GetMaterialBindings().Unbind(GetId());
     for (auto& volume : _volumes) { AiNodeDestroy(volume); }
 }
 
@@ -46,39 +48,84 @@ void HdAiVolume::Sync(
     HdSceneDelegate* delegate, HdRenderParam* renderParam,
     HdDirtyBits* dirtyBits, const TfToken& reprToken) {
     TF_UNUSED(reprToken);
-    auto* param = reinterpret_cast<HdAiRenderParam*>(renderParam);
+    TF_UNUSED(renderParam);
 
+    // The scene data is queried here, and the volume nodes are created and
+    // edited when the node edit journal is committed.
     const auto& id = GetId();
     auto volumesChanged = false;
+    _VolumeGrids grids;
     if (HdChangeTracker::IsTopologyDirty(*dirtyBits, id)) {
-        param->End();
-        _CreateVolumes(id, delegate);
+        grids = _GetVolumeGrids(id, delegate);
         volumesChanged = true;
     }
 
+    AtNode* shader = nullptr;
     if (volumesChanged || (*dirtyBits & HdChangeTracker::DirtyMaterialId)) {
-        param->End();
+        const auto materialId = delegate->GetMaterialId(id);
         const auto* material = reinterpret_cast<const HdAiMaterial*>(
             delegate->GetRenderIndex().GetSprim(
-                HdPrimTypeTokens->material, delegate->GetMaterialId(id)));
+                HdPrimTypeTokens->material, materialId));
+        auto* bindings = &_delegate->GetMaterialBindings();
+        _delegate->GetNodeEditJournal().Record([bindings, id, materialId]() {
+            bindings->Bind(id, materialId);
+        });
         if (material != nullptr) {
-            auto* surfaceShader = material->GetSurfaceShader();
-            for (auto& volume : _volumes) {
-                AiNodeSetPtr(volume, Str::shader, surfaceShader);
-            }
+            shader = material->GetVolumeShader();
         }
     }
 
-    if (HdChangeTracker::IsTransformDirty(*dirtyBits, id)) {
-        param->End();
-        HdAiSetTransform(_volumes, delegate, GetId());
+    // Newly created volumes need the transform as well.
+    const auto shutter = _delegate->GetShutterRange();
+    AtArray* matrices = nullptr;
+    if (volumesChanged || HdChangeTracker::IsTransformDirty(*dirtyBits, id)) {
+        matrices = HdAiConvertTransform(delegate, id, shutter);
+    }
+
+    const auto setPrimId =
+        volumesChanged || (*dirtyBits & HdChangeTracker::DirtyPrimID);
+    // The id is offset by one, so the background maps to -1 in the
+    // primId AOV.
+    const auto primId = static_cast<unsigned int>(GetPrimId()) + 1;
+
+    if (volumesChanged || shader != nullptr || matrices != nullptr ||
+        setPrimId) {
+        _delegate->GetNodeEditJournal().Record(
+            [this, id, volumesChanged, grids, shader, matrices,
+             shutter, setPrimId, primId]() {
+                if (volumesChanged) { _CreateVolumes(id, grids); }
+                for (auto& volume : _volumes) {
+                    if (shader != nullptr) {
+                        AiNodeSetPtr(volume, Str::shader, shader);
+                    }
+                    if (setPrimId) { AiNodeSetUInt(volume, Str::id, primId); }
+                }
+                if (matrices == nullptr) { return; }
+                const auto volumeCount = _volumes.size();
+                if (volumeCount == 0) {
+                    AiArrayDestroy(matrices);
+                    return;
+                }
+                // IIRC you can't set the same array on two different nodes,
+                // because it causes a double-free.
+                // TODO: we need to check if it's still the case with Arnold 5.
+                for (auto i = decltype(volumeCount){1}; i < volumeCount; ++i) {
+                    AiNodeSetArray(
+                        _volumes[i], "matrix", AiArrayCopy(matrices));
+                }
+                AiNodeSetArray(_volumes[0], "matrix", matrices);
+                for (auto& volume : _volumes) {
+                    HdAiSetMotionRange(volume, shutter);
+                }
+            });
     }
 
     *dirtyBits = HdChangeTracker::Clean;
 }
 
-void HdAiVolume::_CreateVolumes(const SdfPath& id, HdSceneDelegate* delegate) {
-    std::unordered_map<std::string, std::vector<TfToken>> openvdbs;
+HdAiVolume::_VolumeGrids HdAiVolume::_GetVolumeGrids(
+    const SdfPath& id, HdSceneDelegate* delegate) {
+    _VolumeGrids openvdbs;
     const auto fieldDescriptors = delegate->GetVolumeFieldDescriptors(id);
     for (const auto& field : fieldDescriptors) {
         auto* openvdbAsset =
@@ -98,7 +145,11 @@ void HdAiVolume::_CreateVolumes(const SdfPath& id, HdSceneDelegate* delegate) {
             }
         }
     }
+    return openvdbs;
+}
 
+void HdAiVolume::_CreateVolumes(
+    const SdfPath& id, const _VolumeGrids& openvdbs) {
     _volumes.erase(
         std::remove_if(
             _volumes.begin(), _volumes.end(),
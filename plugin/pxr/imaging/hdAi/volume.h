@@ -23,6 +23,8 @@
 
 #include <ai.h>
 
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -51,8 +53,18 @@ protected:
     HDAI_API
     void _InitRepr(const TfToken& reprToken, HdDirtyBits* dirtyBits) override;
 
+    /// Grid names for each OpenVDB file.
+    using _VolumeGrids =
+        std::unordered_map<std::string, std::vector<TfToken>>;
+
+    /// Collects the grids of the volume, safe to call from Sync.
+    HDAI_API
+    _VolumeGrids _GetVolumeGrids(const SdfPath& id, HdSceneDelegate* delegate);
+
+    /// Creates, updates and destroys the volume nodes, this has to be called
+    /// when the node edit journal is committed.
     HDAI_API
-    void _CreateVolumes(const SdfPath& id, HdSceneDelegate* delegate);
+    void _CreateVolumes(const SdfPath& id, const _VolumeGrids& openvdbs);
 
     HdAiRenderDelegate* _delegate;
     std::vector<AtNode*> _volumes;